@@ -0,0 +1,71 @@
+// Copyright (c) 2020 gladcow
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef ADDR_PARSER_ADDRESS_CACHE_H__
+#define ADDR_PARSER_ADDRESS_CACHE_H__
+
+#include <clock_cache.h>
+#include <script.h>
+#include <span.h>
+
+#include <cstdint>
+#include <cstring>
+
+/** Memo of encoded addresses keyed by the output script. Busy services receive
+ *  to the same scripts again and again; a hit skips solver() and the
+ *  base58/bech32 encoding. Only scripts of up to MAX_SCRIPT_SIZE bytes are
+ *  memoized, which covers every standard type but uncompressed P2PK.
+ *  Entries are added once an address has been encoded, so in watch mode,
+ *  where few outputs are encoded, the memo is not used.
+ */
+struct script_key_t
+{
+   static constexpr size_t MAX_SCRIPT_SIZE = 42;
+
+   //! script bytes zero padded to 47, its size in the last byte
+   uint64_t words_[6];
+
+   explicit script_key_t(btc_utils::byte_span_t script)
+   {
+      unsigned char* bytes = reinterpret_cast<unsigned char*>(words_);
+      std::memset(bytes, 0, sizeof(words_));
+      std::memcpy(bytes, script.data(), script.size());
+      bytes[sizeof(words_) - 1] = static_cast<unsigned char>(script.size());
+   }
+
+   bool operator==(const script_key_t& other) const
+   {
+      return std::memcmp(words_, other.words_, sizeof(words_)) == 0;
+   }
+};
+
+struct script_key_hasher_t
+{
+   uint64_t operator()(const script_key_t& key) const
+   {
+      uint64_t h = 0;
+      for (uint64_t w: key.words_)
+      {
+         h = (h ^ w) * 0x9e3779b97f4a7c15ull;
+         h ^= h >> 29;
+      }
+      return h;
+   }
+};
+
+/** Solved and encoded output script */
+struct encoded_address_t
+{
+   static constexpr size_t MAX_SIZE = 90; //!< bech32 length limit, base58 addresses are shorter
+
+   btc_utils::txnouttype type;
+   uint8_t size;
+   char text[MAX_SIZE];
+};
+
+typedef btc_utils::clock_cache_t<script_key_t, encoded_address_t, script_key_hasher_t> address_cache_t;
+
+static const size_t ADDRESS_CACHE_SIZE = 8192;
+
+#endif // ADDR_PARSER_ADDRESS_CACHE_H__
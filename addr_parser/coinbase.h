@@ -0,0 +1,85 @@
+// Copyright (c) 2020 gladcow
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef ADDR_PARSER_COINBASE_H__
+#define ADDR_PARSER_COINBASE_H__
+
+#include <pattern_matcher.h>
+#include <script.h>
+#include <span.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "markers.h"
+
+/** Built-in pool tags, text found anywhere in the coinbase scriptSig */
+static const struct
+{
+   const char* name;
+   const char* tag;
+} default_pool_tags[] = {
+   {"foundry", "Foundry USA Pool"},
+   {"antpool", "AntPool"},
+   {"f2pool", "F2Pool"},
+   {"viabtc", "/ViaBTC/"},
+   {"binance", "/Binance/"},
+   {"marapool", "MARA Pool"},
+   {"luxor", "/LUXOR/"},
+   {"spiderpool", "SpiderPool"},
+   {"braiins", "/slush/"},
+   {"braiins", "Braiins"},
+   {"btccom", "/BTC.COM/"},
+   {"btctop", "/BTC.TOP/"},
+   {"poolin", "/poolin.com"},
+   {"sbicrypto", "SBICrypto"},
+   {"secpool", "SecPool"},
+   {"ocean", "OCEAN.XYZ"},
+   {"ckpool", "ckpool"},
+   {"bitfury", "/BitFury/"},
+   {"ghash", "GHash.IO"},
+   {"btcguild", "BTC Guild"},
+   {"eligius", "Eligius"},
+   {"50btc", "50BTC"},
+};
+
+/** Attributes blocks to pools by the first tag found in their coinbase
+ *  scriptSig. All tags are searched in one pass over the scriptSig. */
+struct pool_tags_t : marker_dictionary_t
+{
+   pool_tags_t()
+   {
+      std::vector<marker_t> markers;
+      for (const auto& t: default_pool_tags)
+         markers.emplace_back(t.name, std::vector<unsigned char>(t.tag, t.tag + std::char_traits<char>::length(t.tag)));
+      build(markers);
+   }
+
+   /** Replace the tags with the "name tag text" lines of path */
+   void load(const std::string& path)
+   {
+      marker_dictionary_t::load(path, [](const std::string& tag) {
+         return std::vector<unsigned char>(tag.begin(), tag.end());
+      });
+   }
+
+   /** Coinbase tag of a block's addresses: "coinbase:height:pool", the pool
+    *  left out if no tag matches and the height "-" if it cannot be decoded */
+   std::string tag(btc_utils::byte_span_t script_sig, bool& known_pool) const
+   {
+      std::string res = "coinbase:";
+      uint64_t height;
+      res += btc_utils::decode_coinbase_height(script_sig, height) ? std::to_string(height) : "-";
+      uint32_t pool = matcher.find_first(script_sig);
+      known_pool = pool != btc_utils::multi_pattern_matcher_t::NO_MATCH;
+      if (known_pool)
+      {
+         res += ':';
+         res += names[pool];
+      }
+      return res;
+   }
+};
+
+#endif // ADDR_PARSER_COINBASE_H__
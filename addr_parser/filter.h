@@ -0,0 +1,61 @@
+// Copyright (c) 2020 gladcow
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef ADDR_PARSER_FILTER_H__
+#define ADDR_PARSER_FILTER_H__
+
+#include <script.h>
+
+#include <cstdint>
+#include <limits>
+#include <sstream>
+#include <string>
+
+/** Selects the outputs whose addresses are written. The block time is checked
+ *  once per block and the value before the script is looked at; the type is
+ *  checked right after solver(), so rejected outputs are never encoded.
+ */
+struct output_filter_t
+{
+   uint32_t type_mask = ~0u;  //!< bit per txnouttype
+   uint64_t min_value = 0;
+   uint64_t max_value = std::numeric_limits<uint64_t>::max();
+   uint32_t min_time = 0;
+   uint32_t max_time = std::numeric_limits<uint32_t>::max();
+
+   bool accepts_block(uint32_t time) const
+   {
+      return time >= min_time && time <= max_time;
+   }
+
+   bool accepts_value(uint64_t value) const
+   {
+      return value >= min_value && value <= max_value;
+   }
+
+   bool accepts_type(btc_utils::txnouttype type) const
+   {
+      return (type_mask >> type) & 1;
+   }
+
+   //! parses a comma separated list of txnouttype names, returns false on an unknown name
+   bool parse_types(const std::string& list)
+   {
+      type_mask = 0;
+      std::stringstream ss(list);
+      std::string name;
+      while (std::getline(ss, name, ','))
+      {
+         unsigned int i = 0;
+         while (i < btc_utils::TX_TYPE_COUNT && name != btc_utils::get_txn_output_type(static_cast<btc_utils::txnouttype>(i)))
+            i++;
+         if (i == btc_utils::TX_TYPE_COUNT)
+            return false;
+         type_mask |= 1u << i;
+      }
+      return type_mask != 0;
+   }
+};
+
+#endif // ADDR_PARSER_FILTER_H__
@@ -0,0 +1,104 @@
+// Copyright (c) 2020 gladcow
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef ADDR_PARSER_INSCRIPTIONS_H__
+#define ADDR_PARSER_INSCRIPTIONS_H__
+
+#include <block.h>
+#include <script.h>
+#include <span.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/** Inscription found while a block was deserialized. stack is the ordinal
+ *  of the witness stack among those read, until resolve() sets the input. */
+struct inscription_t
+{
+   uint32_t stack;
+   uint32_t tx_index;
+   uint32_t vin;
+   uint32_t content_type_offset;  //!< into inscription_scanner_t::text
+   uint32_t content_type_size;
+   uint64_t body_size;
+};
+
+/** Looks for inscription envelopes in the witness items handed to it by the
+ *  data source, which reads them in place. Only the content types are copied,
+ *  into one string per block; spaces and other bytes that would break the
+ *  output line are percent-encoded. */
+struct inscription_scanner_t
+{
+   std::vector<inscription_t> found;
+   std::string text;
+   uint32_t stacks = 0;  //!< witness stacks read since reset()
+
+   void reset()
+   {
+      found.clear();
+      text.clear();
+      stacks = 0;
+   }
+
+   void scan(btc_utils::byte_span_t item)
+   {
+      size_t pos = 0;
+      btc_utils::inscription_envelope_t envelope;
+      while (btc_utils::next_inscription_envelope(item, pos, envelope))
+      {
+         size_t offset = text.size();
+         append_content_type(envelope.content_type);
+         found.push_back(inscription_t{stacks, 0, 0, static_cast<uint32_t>(offset),
+                                       static_cast<uint32_t>(text.size() - offset), envelope.body_size});
+      }
+   }
+
+   //! the content type is arbitrary bytes, all but printable ASCII and '%' are percent-encoded
+   void append_content_type(btc_utils::byte_span_t content_type)
+   {
+      static const char hexmap[16] = { '0', '1', '2', '3', '4', '5', '6', '7',
+                                       '8', '9', 'A', 'B', 'C', 'D', 'E', 'F' };
+      for (unsigned char c: content_type)
+      {
+         if (c > ' ' && c < 0x7f && c != '%')
+            text += static_cast<char>(c);
+         else
+         {
+            text += '%';
+            text += hexmap[c >> 4];
+            text += hexmap[c & 15];
+         }
+      }
+   }
+
+   void end_stack()
+   {
+      stacks++;
+   }
+
+   /** Set the input of every inscription. Every input of a transaction with
+    *  witnesses has a stack, in the order they were read. */
+   void resolve(const btc_utils::block_t& block)
+   {
+      uint32_t stack = 0;
+      size_t next = 0;
+      for (size_t tx_index = 0; tx_index < block.txes_.size() && next < found.size(); tx_index++)
+      {
+         const auto& tx = block.txes_[tx_index];
+         if (!tx.has_witness())
+            continue;
+         for (size_t vin = 0; vin < tx.vin.size(); vin++, stack++)
+         {
+            for (; next < found.size() && found[next].stack == stack; next++)
+            {
+               found[next].tx_index = static_cast<uint32_t>(tx_index);
+               found[next].vin = static_cast<uint32_t>(vin);
+            }
+         }
+      }
+   }
+};
+
+#endif // ADDR_PARSER_INSCRIPTIONS_H__
@@ -0,0 +1,278 @@
+// Copyright (c) 2020 gladcow
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef ADDR_PARSER_LOGGER_H__
+#define ADDR_PARSER_LOGGER_H__
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include "tinyformat.h"
+
+enum log_level_t
+{
+   LOG_DEBUG,
+   LOG_INFO,
+   LOG_WARNING,
+   LOG_ERROR
+};
+
+/** Asynchronous logger.
+ *  Producers format the message and put it into a bounded lock-free ring
+ *  (Vyukov's bounded queue, multi-producer single-consumer use); a background
+ *  thread drains it to stdout and flushes once per batch. A log call never
+ *  waits for I/O: when the ring is full the message is dropped and counted.
+ *  Messages with the same format string are limited to a number per second,
+ *  the suppressed ones are reported when the next second starts or on stop().
+ */
+class async_logger_t
+{
+private:
+   static const size_t RING_SIZE = 4096;  //!< power of two
+   static constexpr size_t MESSAGE_SIZE = 240;
+   static const size_t RATE_SLOTS = 64;
+   static const uint32_t RATE_LIMIT = 10; //!< messages per format string and second
+
+   struct slot_t
+   {
+      std::atomic<size_t> seq;
+      uint16_t len;
+      char text[MESSAGE_SIZE];
+   };
+
+   struct rate_slot_t
+   {
+      std::atomic<const char*> fmt{nullptr};
+      std::atomic<int64_t> second{0};
+      std::atomic<uint32_t> count{0};
+      std::atomic<uint32_t> suppressed{0};
+   };
+
+   std::unique_ptr<slot_t[]> slots_;
+   std::atomic<size_t> enqueue_pos_;
+   size_t dequeue_pos_;
+   std::atomic<uint64_t> dropped_;
+   rate_slot_t rate_[RATE_SLOTS];
+   std::atomic<int> level_;
+   std::atomic<bool> stop_;
+   std::thread thread_;
+
+   static int64_t now_second()
+   {
+      return std::chrono::duration_cast<std::chrono::seconds>(
+         std::chrono::steady_clock::now().time_since_epoch()).count();
+   }
+
+   //! slot of the rate limiter for a format string, nullptr when the table is full
+   rate_slot_t* rate_slot(const char* fmt)
+   {
+      size_t h = std::hash<const char*>()(fmt);
+      for (size_t i = 0; i < RATE_SLOTS; i++)
+      {
+         rate_slot_t& slot = rate_[(h + i) % RATE_SLOTS];
+         const char* cur = slot.fmt.load(std::memory_order_acquire);
+         if (cur == fmt)
+            return &slot;
+         if (!cur && slot.fmt.compare_exchange_strong(cur, fmt, std::memory_order_acq_rel))
+            return &slot;
+         if (cur == fmt)
+            return &slot;
+      }
+      return nullptr;
+   }
+
+   //! returns false if the message has to be suppressed
+   bool admit(const char* fmt)
+   {
+      rate_slot_t* slot = rate_slot(fmt);
+      if (!slot)
+         return true;
+      int64_t second = now_second();
+      int64_t prev = slot->second.load(std::memory_order_relaxed);
+      if (prev != second && slot->second.compare_exchange_strong(prev, second, std::memory_order_relaxed))
+      {
+         slot->count.store(0, std::memory_order_relaxed);
+         uint32_t suppressed = slot->suppressed.exchange(0, std::memory_order_relaxed);
+         if (suppressed)
+            push(tfm::format("Suppressed %u messages like \"%s\"", suppressed, fmt));
+      }
+      if (slot->count.fetch_add(1, std::memory_order_relaxed) < RATE_LIMIT)
+         return true;
+      slot->suppressed.fetch_add(1, std::memory_order_relaxed);
+      return false;
+   }
+
+   void push(const std::string& msg)
+   {
+      size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+      slot_t* slot;
+      while (true)
+      {
+         slot = &slots_[pos & (RING_SIZE - 1)];
+         size_t seq = slot->seq.load(std::memory_order_acquire);
+         std::ptrdiff_t dif = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+         if (dif == 0)
+         {
+            if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+               break;
+         }
+         else if (dif < 0)
+         {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+         }
+         else
+         {
+            pos = enqueue_pos_.load(std::memory_order_relaxed);
+         }
+      }
+      // a message that does not fit is cut and ends with "..."
+      size_t len = std::min(msg.size(), MESSAGE_SIZE);
+      memcpy(slot->text, msg.data(), len);
+      if (msg.size() > MESSAGE_SIZE)
+         memcpy(slot->text + MESSAGE_SIZE - 3, "...", 3);
+      slot->len = static_cast<uint16_t>(len);
+      slot->seq.store(pos + 1, std::memory_order_release);
+   }
+
+   //! moves the queued messages to out, returns false if there were none
+   bool drain(std::string& out)
+   {
+      bool any = false;
+      while (true)
+      {
+         slot_t& slot = slots_[dequeue_pos_ & (RING_SIZE - 1)];
+         if (slot.seq.load(std::memory_order_acquire) != dequeue_pos_ + 1)
+            break;
+         out.append(slot.text, slot.len);
+         out += '\n';
+         slot.seq.store(dequeue_pos_ + RING_SIZE, std::memory_order_release);
+         dequeue_pos_++;
+         any = true;
+      }
+      uint64_t dropped = dropped_.exchange(0, std::memory_order_relaxed);
+      if (dropped)
+      {
+         out += tfm::format("Dropped %u log messages\n", dropped);
+         any = true;
+      }
+      return any;
+   }
+
+   void run()
+   {
+      std::string batch;
+      while (true)
+      {
+         bool stopping = stop_.load(std::memory_order_acquire);
+         batch.clear();
+         if (drain(batch))
+         {
+            fwrite(batch.data(), 1, batch.size(), stdout);
+            fflush(stdout);
+         }
+         else if (stopping)
+         {
+            break;
+         }
+         else
+         {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+         }
+      }
+   }
+
+public:
+   async_logger_t() :
+      slots_(new slot_t[RING_SIZE]), enqueue_pos_(0), dequeue_pos_(0), dropped_(0),
+      level_(LOG_INFO), stop_(false)
+   {
+      for (size_t i = 0; i < RING_SIZE; i++)
+         slots_[i].seq.store(i, std::memory_order_relaxed);
+   }
+
+   ~async_logger_t()
+   {
+      stop();
+   }
+
+   async_logger_t(const async_logger_t&) = delete;
+   async_logger_t& operator=(const async_logger_t&) = delete;
+
+   //! start the drain thread, messages logged before are kept in the ring
+   void start()
+   {
+      if (!thread_.joinable())
+      {
+         stop_ = false;
+         thread_ = std::thread(&async_logger_t::run, this);
+      }
+   }
+
+   //! write out everything that is queued and stop the drain thread
+   void stop()
+   {
+      for (rate_slot_t& slot: rate_)
+      {
+         uint32_t suppressed = slot.suppressed.exchange(0, std::memory_order_relaxed);
+         if (suppressed)
+            push(tfm::format("Suppressed %u messages like \"%s\"", suppressed, slot.fmt.load()));
+      }
+      if (thread_.joinable())
+      {
+         stop_ = true;
+         thread_.join();
+      }
+   }
+
+   void set_level(log_level_t level) { level_ = level; }
+   bool enabled(log_level_t level) const { return level >= level_.load(std::memory_order_relaxed); }
+
+   template <typename... Args>
+   void log(log_level_t level, const char* fmt, const Args&... args)
+   {
+      if (!enabled(level) || !admit(fmt))
+         return;
+      std::string msg;
+      try {
+         msg = tfm::format(fmt, args...);
+      } catch (tinyformat::format_error& fmterr) {
+         msg = "Error \"" + std::string(fmterr.what()) + "\" while formatting log message: " + fmt;
+      }
+      push(msg);
+   }
+};
+
+inline async_logger_t g_logger;
+
+template <typename... Args>
+static inline void log_printf(log_level_t level, const char* fmt, const Args&... args)
+{
+   g_logger.log(level, fmt, args...);
+}
+
+//! parses debug|info|warning|error, returns false for anything else
+inline bool parse_log_level(const std::string& name, log_level_t& level)
+{
+   static const char* names[] = {"debug", "info", "warning", "error"};
+   for (int i = 0; i <= LOG_ERROR; i++)
+   {
+      if (name == names[i])
+      {
+         level = static_cast<log_level_t>(i);
+         return true;
+      }
+   }
+   return false;
+}
+
+#endif // ADDR_PARSER_LOGGER_H__
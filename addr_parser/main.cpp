@@ -3,31 +3,41 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <address.h>
 #include <block.h>
+#include <block_index.h>
 #include <chainparams.h>
 #include <crypto.h>
+#include <script.h>
+#include <serialize.h>
+#include <watchlist.h>
+#include <algorithm>
 #include <array>
+#include <chrono>
 #include <cstring>
+#include <limits>
+#include <memory>
+#include <memory_resource>
+#include <fcntl.h>
+#include <fstream>
+#include <getopt.h>
+#include <iterator>
+#include <string_view>
+#include <sys/stat.h>
 #include <unistd.h>
+#include "address_cache.h"
+#include "coinbase.h"
+#include "filter.h"
+#include "inscriptions.h"
+#include "logger.h"
+#include "metrics.h"
+#include "null_data.h"
+#include "output.h"
+#include "stats.h"
 #include "tinyformat.h"
 
 using namespace btc_utils;
 
-static const unsigned int MAX_SIZE = 0x02000000;
-
-template <typename... Args>
-static inline void log_printf(const char* fmt, const Args&... args)
-{
-     std::string log_msg;
-     try {
-         log_msg = tfm::format(fmt, args...);
-     } catch (tinyformat::format_error& fmterr) {
-         /* Original format string will have newline so don't add one here */
-         log_msg = "Error \"" + std::string(fmterr.what()) + "\" while formatting log message: " + fmt;
-     }
-     std::cout << log_msg << std::endl;
-}
-
 std::string compose_block_file_path(std::string db_path, uint32_t index)
 {
    std::string fname = strprintf("%s%05u.dat", "blk", index);
@@ -43,8 +53,9 @@ std::string compose_block_file_path(std::string db_path, uint32_t index)
  *
  *  Will automatically close the file when it goes out of scope if not null.
  *  If you need to close the file early, use file.fclose() instead of fclose(file).
+ *  The buffer can be reused for the next file with open().
  */
-class buffered_file_t
+class buffered_file_t: public deserializer_t<buffered_file_t>
 {
 private:
     FILE *src;            //!< source file
@@ -53,6 +64,9 @@ private:
     uint64_t nReadLimit;  //!< up to which position we're allowed to read
     uint64_t nRewind;     //!< how many bytes we guarantee to rewind
     std::vector<char> vchBuf; //!< the buffer
+    inscription_scanner_t* scanner = nullptr; //!< witness items are scanned in place if set
+    bool keep_witness = true;
+    std::vector<unsigned char> scratch; //!< witness items that wrap around the end of the buffer
 
 protected:
     //! read data from the source to fill the buffer
@@ -64,7 +78,12 @@ protected:
             readNow = nAvail;
         if (readNow == 0)
             return false;
-        size_t nBytes = fread((void*)&vchBuf[pos], 1, readNow, src);
+        size_t nBytes;
+        {
+            stage_timer_t timer(STAT_TIMER_READ);
+            nBytes = fread((void*)&vchBuf[pos], 1, readNow, src);
+        }
+        stat_add(STAT_BYTES_READ, nBytes);
         if (nBytes == 0) {
             throw std::ios_base::failure(feof(src) ? "CBufferedFile::Fill: end of file" : "CBufferedFile::Fill: fread failed");
         }
@@ -81,6 +100,16 @@ public:
         src = fileIn;
     }
 
+    //! close the current file and start reading from fileIn, keeping the buffer
+    void open(FILE *fileIn)
+    {
+        fclose();
+        src = fileIn;
+        nSrcPos = 0;
+        nReadPos = 0;
+        nReadLimit = std::numeric_limits<uint64_t>::max();
+    }
+
     ~buffered_file_t()
     {
         fclose();
@@ -100,7 +129,7 @@ public:
 
     //! check whether we're at the end of the source file
     bool eof() const {
-        return nReadPos == nSrcPos && feof(src);
+        return nReadPos == nSrcPos && (!src || feof(src));
     }
 
     //! read a number of bytes
@@ -123,111 +152,54 @@ public:
         }
     }
 
-    uint8_t readdata8()
-    {
-       uint8_t obj;
-       read(&obj, 1);
-       return obj;
-    }
-
-    uint16_t readdata16()
-    {
-       uint16_t obj;
-       read((unsigned char*)&obj, 2);
-       return le16toh(obj);
+    //! bytes left before the read limit
+    uint64_t remaining() const {
+        return nReadLimit - nReadPos;
     }
 
-    uint32_t readdata32()
-    {
-       uint32_t obj;
-       read((unsigned char*)&obj, 4);
-       return le32toh(obj);
+    //! the next nSize bytes in place, or nullptr if they wrap around the end of the buffer
+    const unsigned char* view(size_t nSize) {
+        if (nSize + nReadPos > nReadLimit)
+            throw std::ios_base::failure("Read attempted past buffer limit");
+        size_t pos = nReadPos % vchBuf.size();
+        if (pos + nSize > vchBuf.size())
+            return nullptr;
+        while (nSrcPos < nReadPos + nSize) {
+            if (!Fill())
+                return nullptr;
+        }
+        nReadPos += nSize;
+        return reinterpret_cast<const unsigned char*>(&vchBuf[pos]);
     }
 
-    uint64_t readdata64()
-    {
-       uint64_t obj;
-       read((unsigned char*)&obj, 8);
-       return le64toh(obj);
+    //! pass the witness items to s if not null, keep says whether their bytes are needed
+    void set_witness_handling(inscription_scanner_t* s, bool keep) {
+        scanner = s;
+        keep_witness = keep;
     }
 
-    uint64_t read_compact_int()
-    {
-        uint8_t ci_size = readdata8();
-        uint64_t res = 0;
-        if (ci_size < 253)
-        {
-            res = ci_size;
-        }
-        else if (ci_size == 253)
-        {
-            res = readdata16();
-            if (res < 253)
-                throw std::runtime_error("non-canonical compact int");
-        }
-        else if (ci_size == 254)
-        {
-            res = readdata32();
-            if (res < 0x10000u)
-                throw std::runtime_error("non-canonical compact int");
+    /** Unless their bytes are kept the witness items are read in place, passed
+     *  to the scanner if there is one and dropped. Stacks keep their item
+     *  count, so has_witness() holds, but no witness data is copied. */
+    template<typename A1, typename A2>
+    void unserialize_witness(std::vector<std::vector<unsigned char, A1>, A2>& stack) {
+        if (!scanner && keep_witness) {
+            deserializer_t::unserialize_witness(stack);
+            return;
         }
-        else
-        {
-            res = readdata64();
-            if (res < 0x100000000ULL)
-                throw std::runtime_error("non-canonical compact int");
+        // every item takes at least its size byte
+        stack.resize(check_count(read_compact_int(), 1));
+        for (auto& item: stack) {
+            byte_span_t data = read_span(read_compact_int(), scratch);
+            if (scanner)
+                scanner->scan(data);
+            if (keep_witness)
+                item.assign(data.begin(), data.end());
+            else
+                item.clear();
         }
-        if (res > (uint64_t)MAX_SIZE)
-            throw std::runtime_error("compact int is too large");
-        return res;
-    }
-
-    void unserialize(unsigned char& val)
-    {
-       val = readdata8();
-    }
-
-    void unserialize(uint32_t& val)
-    {
-       val = readdata32();
-    }
-
-    void unserialize(uint64_t& val)
-    {
-       val = readdata64();
-    }
-
-    template<typename T, typename A>
-    void unserialize(std::vector<T, A>& v)
-    {
-       v.clear();
-       uint64_t v_size = read_compact_int();
-       v.resize(v_size);
-       for (uint64_t i = 0; i < v_size; i++)
-           v[i].unserialize(*this);
-    }
-
-    void unserialize(std::vector<unsigned char>& v)
-    {
-       v.clear();
-       uint64_t v_size = read_compact_int();
-       v.resize(v_size);
-       for (uint64_t i = 0; i < v_size; i++)
-           unserialize(v[i]);
-    }
-
-    void unserialize(std::vector<std::vector<unsigned char> >& v)
-    {
-       v.clear();
-       uint64_t v_size = read_compact_int();
-       v.resize(v_size);
-       for (uint64_t i = 0; i < v_size; i++)
-           unserialize(v[i]);
-    }
-
-    void unserialize(uint256_t& val)
-    {
-       read(val.data(), val.size());
+        if (scanner)
+            scanner->end_stack();
     }
 
     //! return the current reading position
@@ -273,13 +245,6 @@ public:
         return true;
     }
 
-    template<typename T>
-    buffered_file_t& operator>>(T&& obj) {
-        // Unserialize from this stream
-        obj.unserialize(*this);
-        return (*this);
-    }
-
     //! search for a given byte in the stream, and remain positioned on it
     void FindByte(char ch) {
         while (true) {
@@ -292,11 +257,515 @@ public:
     }
 };
 
-void ParseBlockFile(FILE* f, int& nLoaded, FILE* addrout)
+/** Appends the address of a destination and a newline to the output buffer */
+template<typename P>
+struct address_encoder_t
+{
+   std::string& out_;
+
+   void operator()(const no_destination_t&) {}
+
+   template<typename D>
+   void operator()(const D& dest)
+   {
+      out_ += encode_destination<P>(dest);
+      out_ += '\n';
+   }
+};
+
+/** Input that revealed the address of the output it spends */
+struct spend_t
+{
+   uint32_t tx_index;
+   uint32_t vin;
+   txnouttype type;
+   tx_destination_t dest;
+};
+
+/** Key of a bare multisig output, written as the P2PKH address of the key */
+struct multisig_key_t
+{
+   uint32_t tx_index;
+   uint32_t vout;
+   uint8_t required;
+   uint8_t total;
+   tx_destination_t dest;
+};
+
+/** Null data output whose payload is written, protocol is an id of null_data_protocols_t */
+struct null_data_t
+{
+   uint32_t tx_index;
+   uint32_t vout;
+   uint32_t protocol;
+   byte_span_t script;
+};
+
+/** Where the text of a destination comes from: a memo hit copied to memo_text,
+ *  or the encoder, after which it is memoized under script unless that is empty */
+struct address_memo_t
 {
+   txnouttype type;
+   byte_span_t script;
+   uint32_t text_offset;
+   uint32_t text_size;  //!< 0 if the address has to be encoded
+};
+
+/** State that lives across records and block files: the ring buffer and the
+ *  block object. Every record is deserialized into the same block_t, so the
+ *  containers of the previous block are reused instead of reallocated. The
+ *  block takes its memory from a pool, so elements that are dropped when a
+ *  block is smaller than the previous one come back without calling malloc.
+ *  A block goes through the stages one at a time: all its outputs are solved
+ *  into destinations, then encoded into out_buf, which is handed over to the
+ *  output writer once it is full.
+ *  In watch mode only destinations found in the watchlist are kept, with the
+ *  positions of their outputs, and they are written with block hash, txid and vout.
+ *  With spends enabled the inputs of a block are matched after its outputs, the
+ *  revealed keys and redeem scripts are hashed in one batch and the spent
+ *  addresses are written after the outputs with the spent outpoint.
+ *  The keys of bare multisig outputs are hashed in one batch as well and
+ *  written between the two, tagged with m-of-n and their output.
+ *  With protocols set the payloads of null data outputs are tagged while
+ *  solving and written in hex after the multisig keys, from spans into the
+ *  block's scripts; they have no address, so watch mode skips them.
+ *  With pools set the coinbase scriptSig is decoded once per block into
+ *  coinbase_tag, which is appended to the lines of the coinbase outputs, the
+ *  first coinbase_destinations entries of destinations.
+ *  Unless spends need them witness items are not copied into the block; with
+ *  inscriptions set they are scanned for envelopes while the block is read,
+ *  and what is found is written after the null data payloads.
+ *  Outside of watch mode the addresses of short scripts are memoized, see
+ *  address_cache_t; memos holds an entry per destination.
+ */
+struct parse_context_t
+{
+   buffered_file_t blkdat;
+   std::pmr::unsynchronized_pool_resource pool;
+   block_t block;
+   output_filter_t filter;
+   std::unique_ptr<watchlist_t> watch;
+   std::vector<tx_destination_t> destinations;
+   std::vector<std::pair<uint32_t, uint32_t>> positions; //!< tx index and vout of the watch matches
+   std::array<uint64_t, TX_TYPE_COUNT> type_counts;
+   bool spends = false;
+   std::vector<spend_t> spend_inputs;
+   std::vector<byte_span_t> spend_data;  //!< pubkey or redeem script of every spend_inputs entry
+   std::vector<uint160_t> spend_hashes;
+   std::vector<multisig_key_t> multisig_keys;
+   std::vector<byte_span_t> multisig_data;  //!< pubkey of every multisig_keys entry
+   std::vector<uint160_t> multisig_hashes;
+   std::unique_ptr<null_data_protocols_t> protocols;  //!< null data extraction is off without it
+   std::vector<null_data_t> null_data;
+   std::unique_ptr<pool_tags_t> pools;  //!< coinbase attribution is off without it
+   std::string coinbase_tag;
+   size_t coinbase_destinations = 0;
+   std::unique_ptr<inscription_scanner_t> inscriptions;  //!< inscription scan is off without it
+   uint64_t key_cache_hits = 0;    //!< key id cache counters already added to the stats
+   uint64_t key_cache_misses = 0;
+   address_cache_t address_cache;
+   std::vector<address_memo_t> memos;
+   std::string memo_text;
+   std::string out_buf;
+
+   parse_context_t() :
+      blkdat(nullptr, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8),
+      pool(std::pmr::pool_options{0, MAX_BLOCK_SERIALIZED_SIZE}),
+      block(&pool),
+      address_cache(ADDRESS_CACHE_SIZE)
+   {
+   }
+};
+
+template<typename P>
+void process_block(parse_context_t& ctx, output_writer_t& out)
+{
+   const output_filter_t& filter = ctx.filter;
+   uint64_t txs = ctx.block.txes_.size();
+   uint64_t outputs = 0;
+   uint64_t filtered = 0;
+   uint64_t inputs = 0;
+   uint64_t memo_hits = 0;
+   uint64_t memo_misses = 0;
+   uint64_t tagged = 0;
+   bool pool_block = false;
+   size_t inscriptions = 0;
+   const watchlist_t* watch = ctx.watch.get();
+   ctx.destinations.clear();
+   ctx.memos.clear();
+   ctx.memo_text.clear();
+   ctx.positions.clear();
+   ctx.spend_inputs.clear();
+   ctx.spend_data.clear();
+   ctx.multisig_keys.clear();
+   ctx.multisig_data.clear();
+   ctx.null_data.clear();
+   ctx.coinbase_destinations = 0;
+   ctx.type_counts.fill(0);
+   if (filter.accepts_block(ctx.block.time_))
+   {
+      stage_timer_t timer(STAT_TIMER_SOLVE);
+      destination_key_t key;
+      if (ctx.inscriptions)
+      {
+         ctx.inscriptions->resolve(ctx.block);
+         inscriptions = ctx.inscriptions->found.size();
+      }
+      if (ctx.pools && !ctx.block.txes_.empty() && !ctx.block.txes_[0].vin.empty())
+         ctx.coinbase_tag = ctx.pools->tag(ctx.block.txes_[0].vin[0].scriptSig, pool_block);
+      for(size_t tx_index = 0; tx_index < ctx.block.txes_.size(); tx_index++)
+      {
+         const auto& vout = ctx.block.txes_[tx_index].vout;
+         outputs += vout.size();
+         for(size_t n = 0; n < vout.size(); n++)
+         {
+            if (!filter.accepts_value(vout[n].nValue))
+            {
+               filtered++;
+               continue;
+            }
+            const auto& script = vout[n].scriptPubKey;
+            tx_destination_t& dest = ctx.destinations.emplace_back();
+            const encoded_address_t* memo = nullptr;
+            if (!watch && script.size() <= script_key_t::MAX_SCRIPT_SIZE)
+            {
+               memo = ctx.address_cache.find(script_key_t(script));
+               memo_hits += memo ? 1 : 0;
+               memo_misses += memo ? 0 : 1;
+            }
+            txnouttype type = memo ? memo->type : solver(script, dest);
+            if (type == TX_MULTISIG)
+            {
+               ctx.destinations.pop_back();
+               if (!filter.accepts_type(type))
+               {
+                  filtered++;
+                  continue;
+               }
+               unsigned int required, count;
+               byte_span_t keys[MAX_MULTISIG_KEYS];
+               match_multisig(script, required, keys, count);
+               for (unsigned int k = 0; k < count; k++)
+               {
+                  ctx.multisig_keys.push_back(multisig_key_t{static_cast<uint32_t>(tx_index), static_cast<uint32_t>(n),
+                                                             static_cast<uint8_t>(required), static_cast<uint8_t>(count), {}});
+                  ctx.multisig_data.push_back(keys[k]);
+               }
+            }
+            else if (type == TX_NULL_DATA)
+            {
+               ctx.destinations.pop_back();
+               if (!ctx.protocols || watch)
+                  continue;
+               if (!filter.accepts_type(type))
+               {
+                  filtered++;
+                  continue;
+               }
+               uint32_t protocol;
+               if (ctx.protocols->tag(script, protocol))
+               {
+                  ctx.null_data.push_back(null_data_t{static_cast<uint32_t>(tx_index), static_cast<uint32_t>(n), protocol, script});
+                  tagged += protocol != multi_pattern_matcher_t::NO_MATCH ? 1 : 0;
+               }
+            }
+            else if (!memo && std::holds_alternative<no_destination_t>(dest))
+            {
+               ctx.destinations.pop_back();
+            }
+            else if (!filter.accepts_type(type))
+            {
+               ctx.destinations.pop_back();
+               filtered++;
+            }
+            else if (watch && !(make_destination_key(dest, key) && watch->contains(key)))
+            {
+               ctx.destinations.pop_back();
+            }
+            else
+            {
+               ctx.type_counts[type]++;
+               if (watch)
+                  ctx.positions.emplace_back(static_cast<uint32_t>(tx_index), static_cast<uint32_t>(n));
+               else if (memo)
+               {
+                  ctx.memos.push_back(address_memo_t{type, byte_span_t(), static_cast<uint32_t>(ctx.memo_text.size()), memo->size});
+                  ctx.memo_text.append(memo->text, memo->size);
+               }
+               else
+               {
+                  byte_span_t memo_script = script.size() <= script_key_t::MAX_SCRIPT_SIZE ? byte_span_t(script) : byte_span_t();
+                  ctx.memos.push_back(address_memo_t{type, memo_script, 0, 0});
+               }
+            }
+         }
+         if (tx_index == 0 && ctx.pools)
+            ctx.coinbase_destinations = ctx.destinations.size();
+      }
+      if (!ctx.multisig_data.empty())
+      {
+         ctx.multisig_hashes.resize(ctx.multisig_data.size());
+         hash160_batch(ctx.multisig_data.data(), ctx.multisig_data.size(), ctx.multisig_hashes.data());
+         size_t kept = 0;
+         for(size_t i = 0; i < ctx.multisig_keys.size(); i++)
+         {
+            multisig_key_t& multisig = ctx.multisig_keys[i];
+            multisig.dest = pk_hash_tx_destination_t(ctx.multisig_hashes[i]);
+            if (watch && !(make_destination_key(multisig.dest, key) && watch->contains(key)))
+               continue;
+            ctx.multisig_keys[kept++] = multisig;
+         }
+         ctx.multisig_keys.resize(kept);
+         ctx.type_counts[TX_MULTISIG] += kept;
+      }
+      if (ctx.spends)
+      {
+         // the coinbase spends nothing
+         for(size_t tx_index = 1; tx_index < ctx.block.txes_.size(); tx_index++)
+         {
+            const auto& vin = ctx.block.txes_[tx_index].vin;
+            inputs += vin.size();
+            for(size_t n = 0; n < vin.size(); n++)
+            {
+               byte_span_t data;
+               txnouttype type = match_spending_input(vin[n].scriptSig, vin[n].scriptWitness, data);
+               if (type == TX_NONSTANDARD || !filter.accepts_type(type))
+                  continue;
+               ctx.spend_inputs.push_back(spend_t{static_cast<uint32_t>(tx_index), static_cast<uint32_t>(n), type, {}});
+               ctx.spend_data.push_back(data);
+            }
+         }
+         ctx.spend_hashes.resize(ctx.spend_data.size());
+         hash160_batch(ctx.spend_data.data(), ctx.spend_data.size(), ctx.spend_hashes.data());
+         size_t kept = 0;
+         for(size_t i = 0; i < ctx.spend_inputs.size(); i++)
+         {
+            spend_t& spend = ctx.spend_inputs[i];
+            if (spend.type == TX_PUBKEYHASH)
+               spend.dest = pk_hash_tx_destination_t(ctx.spend_hashes[i]);
+            else if (spend.type == TX_WITNESS_V0_KEYHASH)
+               spend.dest = witness_v0_key_hash_tx_destination_t(ctx.spend_hashes[i]);
+            else
+               spend.dest = script_hash_tx_destination_t(ctx.spend_hashes[i]);
+            if (watch && !(make_destination_key(spend.dest, key) && watch->contains(key)))
+               continue;
+            ctx.spend_inputs[kept++] = spend;
+         }
+         ctx.spend_inputs.resize(kept);
+      }
+   }
+   else
+   {
+      for(const auto& tx: ctx.block.txes_)
+         outputs += tx.vout.size();
+      filtered = outputs;
+   }
+   {
+      stage_timer_t timer(STAT_TIMER_ENCODE);
+      address_encoder_t<P> encoder{ctx.out_buf};
+      if (!watch)
+      {
+         encoded_address_t memo;
+         for(size_t i = 0; i < ctx.destinations.size(); i++)
+         {
+            const address_memo_t& m = ctx.memos[i];
+            if (m.text_size)
+            {
+               ctx.out_buf.append(ctx.memo_text, m.text_offset, m.text_size);
+               ctx.out_buf += '\n';
+            }
+            else
+            {
+               size_t start = ctx.out_buf.size();
+               std::visit(encoder, ctx.destinations[i]);
+               size_t size = ctx.out_buf.size() - start - 1;
+               if (!m.script.empty() && size <= encoded_address_t::MAX_SIZE)
+               {
+                  memo.type = m.type;
+                  memo.size = static_cast<uint8_t>(size);
+                  ctx.out_buf.copy(memo.text, size, start);
+                  ctx.address_cache.insert(script_key_t(m.script), memo);
+               }
+            }
+            if (i < ctx.coinbase_destinations)
+            {
+               ctx.out_buf.back() = ' ';
+               ctx.out_buf += ctx.coinbase_tag;
+               ctx.out_buf += '\n';
+            }
+         }
+      }
+      else if (!ctx.destinations.empty())
+      {
+         std::string block_hash = uint256_to_hex(ctx.block.get_hash());
+         std::string txid;
+         uint32_t txid_index = std::numeric_limits<uint32_t>::max();
+         for(size_t i = 0; i < ctx.destinations.size(); i++)
+         {
+            if (ctx.positions[i].first != txid_index)
+            {
+               txid_index = ctx.positions[i].first;
+               txid = uint256_to_hex(ctx.block.txes_[txid_index].get_hash());
+            }
+            // address, block hash, txid and vout
+            std::visit(encoder, ctx.destinations[i]);
+            ctx.out_buf.back() = ' ';
+            ctx.out_buf += block_hash;
+            ctx.out_buf += ' ';
+            ctx.out_buf += txid;
+            ctx.out_buf += ' ';
+            ctx.out_buf += std::to_string(ctx.positions[i].second);
+            if (i < ctx.coinbase_destinations)
+            {
+               ctx.out_buf += ' ';
+               ctx.out_buf += ctx.coinbase_tag;
+            }
+            ctx.out_buf += '\n';
+         }
+      }
+      if (!ctx.multisig_keys.empty())
+      {
+         std::string block_hash = watch ? uint256_to_hex(ctx.block.get_hash()) : std::string();
+         std::string txid;
+         uint32_t txid_index = std::numeric_limits<uint32_t>::max();
+         for(const multisig_key_t& multisig: ctx.multisig_keys)
+         {
+            if (multisig.tx_index != txid_index)
+            {
+               txid_index = multisig.tx_index;
+               txid = uint256_to_hex(ctx.block.txes_[txid_index].get_hash());
+            }
+            // address, multisig:m-of-n, txid:vout; in watch mode the usual
+            // address, block hash, txid and vout followed by the tag
+            std::visit(encoder, multisig.dest);
+            ctx.out_buf.back() = ' ';
+            if (watch)
+            {
+               ctx.out_buf += block_hash;
+               ctx.out_buf += ' ';
+               ctx.out_buf += txid;
+               ctx.out_buf += ' ';
+               ctx.out_buf += std::to_string(multisig.vout);
+               ctx.out_buf += ' ';
+            }
+            ctx.out_buf += "multisig:";
+            ctx.out_buf += std::to_string(multisig.required);
+            ctx.out_buf += "-of-";
+            ctx.out_buf += std::to_string(multisig.total);
+            if (!watch)
+            {
+               ctx.out_buf += ' ';
+               ctx.out_buf += txid;
+               ctx.out_buf += ':';
+               ctx.out_buf += std::to_string(multisig.vout);
+            }
+            ctx.out_buf += '\n';
+         }
+      }
+      if (!ctx.null_data.empty())
+      {
+         uint32_t txid_index = std::numeric_limits<uint32_t>::max();
+         std::string txid;
+         for(const null_data_t& data: ctx.null_data)
+         {
+            if (data.tx_index != txid_index)
+            {
+               txid_index = data.tx_index;
+               txid = uint256_to_hex(ctx.block.txes_[txid_index].get_hash());
+            }
+            // payload, nulldata:protocol, txid:vout
+            append_null_data_hex(ctx.out_buf, data.script);
+            ctx.out_buf += " nulldata";
+            if (data.protocol != multi_pattern_matcher_t::NO_MATCH)
+            {
+               ctx.out_buf += ':';
+               ctx.out_buf += ctx.protocols->names[data.protocol];
+            }
+            ctx.out_buf += ' ';
+            ctx.out_buf += txid;
+            ctx.out_buf += ':';
+            ctx.out_buf += std::to_string(data.vout);
+            ctx.out_buf += '\n';
+         }
+      }
+      for(size_t i = 0; i < inscriptions; i++)
+      {
+         const inscription_t& inscription = ctx.inscriptions->found[i];
+         // inscription:body_size, txid:input, content type
+         ctx.out_buf += "inscription:";
+         ctx.out_buf += std::to_string(inscription.body_size);
+         ctx.out_buf += ' ';
+         ctx.out_buf += uint256_to_hex(ctx.block.txes_[inscription.tx_index].get_hash());
+         ctx.out_buf += ':';
+         ctx.out_buf += std::to_string(inscription.vin);
+         ctx.out_buf += ' ';
+         if (inscription.content_type_size)
+            ctx.out_buf.append(ctx.inscriptions->text, inscription.content_type_offset, inscription.content_type_size);
+         else
+            ctx.out_buf += '-';
+         ctx.out_buf += '\n';
+      }
+      if (!ctx.spend_inputs.empty())
+      {
+         std::string block_hash = watch ? uint256_to_hex(ctx.block.get_hash()) : std::string();
+         for(const spend_t& spend: ctx.spend_inputs)
+         {
+            // address, block hash in watch mode, spent txid:vout
+            const out_point_t& prevout = ctx.block.txes_[spend.tx_index].vin[spend.vin].prevout;
+            std::visit(encoder, spend.dest);
+            ctx.out_buf.back() = ' ';
+            if (watch)
+            {
+               ctx.out_buf += block_hash;
+               ctx.out_buf += ' ';
+            }
+            ctx.out_buf += uint256_to_hex(prevout.hash);
+            ctx.out_buf += ':';
+            ctx.out_buf += std::to_string(prevout.n);
+            ctx.out_buf += '\n';
+         }
+      }
+   }
+   if (ctx.out_buf.size() >= out.buffer_size())
+      out.submit(ctx.out_buf);
+   stat_add(STAT_BLOCKS, 1);
+   stat_set(STAT_GAUGE_LAST_BLOCK_TIME, ctx.block.time_);
+   stat_add(STAT_TXS, txs);
+   stat_add(STAT_OUTPUTS, outputs);
+   stat_add(STAT_FILTERED_OUTPUTS, filtered);
+   stat_add(STAT_ADDRESSES, ctx.destinations.size() + ctx.multisig_keys.size() + ctx.spend_inputs.size());
+   stat_add(STAT_INPUTS, inputs);
+   stat_add(STAT_SPEND_ADDRESSES, ctx.spend_inputs.size());
+   stat_add(STAT_ADDRESS_CACHE_HITS, memo_hits);
+   stat_add(STAT_ADDRESS_CACHE_MISSES, memo_misses);
+   stat_add(STAT_NULL_DATA_PAYLOADS, ctx.null_data.size());
+   stat_add(STAT_NULL_DATA_TAGGED, tagged);
+   stat_add(STAT_POOL_BLOCKS, pool_block ? 1 : 0);
+   stat_add(STAT_INSCRIPTIONS, inscriptions);
+   if (parse_stats_enabled)
+   {
+      uint64_t hits, misses;
+      get_pub_key_cache_stats(hits, misses);
+      stat_add(STAT_KEY_CACHE_HITS, hits - ctx.key_cache_hits);
+      stat_add(STAT_KEY_CACHE_MISSES, misses - ctx.key_cache_misses);
+      ctx.key_cache_hits = hits;
+      ctx.key_cache_misses = misses;
+   }
+   for (unsigned int i = 0; i < TX_TYPE_COUNT; i++)
+      if (ctx.type_counts[i])
+         stat_add_addresses(static_cast<txnouttype>(i), ctx.type_counts[i]);
+}
+
+template<typename P>
+void ParseBlockFile(parse_context_t& ctx, FILE* f, progress_reporter_t& progress, output_writer_t& out)
+{
+   buffered_file_t& blkdat = ctx.blkdat;
+   block_t& block = ctx.block;
+   // end of the last parsed record, everything between it and the next one is skipped
+   uint64_t parsed_pos = 0;
    try {
-       // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
-       buffered_file_t blkdat(f, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8);
+       // This takes over fileIn and calls fclose() on it when the next file is opened
+       blkdat.open(f);
        uint64_t nRewind = blkdat.GetPos();
        while (!blkdat.eof()) {
            blkdat.SetPos(nRewind);
@@ -306,10 +775,10 @@ void ParseBlockFile(FILE* f, int& nLoaded, FILE* addrout)
            try {
                // locate a header
                std::array<unsigned char, MESSAGE_START_SIZE> buf;
-               blkdat.FindByte(message_start()[0]);
+               blkdat.FindByte(static_cast<char>(P::message_start[0]));
                nRewind = blkdat.GetPos()+1;
                blkdat.read(buf.data(), MESSAGE_START_SIZE);
-               if (memcmp(buf.data(), message_start(), MESSAGE_START_SIZE))
+               if (memcmp(buf.data(), P::message_start, MESSAGE_START_SIZE))
                    continue;
                // read size
                blkdat.read((unsigned char*)&nSize,  sizeof(nSize));
@@ -324,64 +793,331 @@ void ParseBlockFile(FILE* f, int& nLoaded, FILE* addrout)
                uint64_t nBlockPos = blkdat.GetPos();
                blkdat.SetLimit(nBlockPos + nSize);
                blkdat.SetPos(nBlockPos);
-               block_t block;
-               blkdat >> block;
-               nRewind = blkdat.GetPos();
-
-               for(const auto& tx: block.txes_)
+               stat_add(STAT_RECORDS, 1);
                {
-                  for(const auto& out: tx.vout)
-                  {
-                     std::vector<std::string> addrs = out.addresses();
-                     for(const auto& addr: addrs)
-                     {
-                        fwrite(addr.c_str(), 1, addr.size(), addrout);
-                        fwrite("\n", 1, 1, addrout);
-                     }
-                  }
+                  stage_timer_t timer(STAT_TIMER_DESERIALIZE, STAT_TIMER_READ);
+                  if (ctx.inscriptions)
+                     ctx.inscriptions->reset();
+                  blkdat >> block;
                }
-               if(nLoaded % 100 == 1)
-                  log_printf("Block %i is read", nLoaded++);
+               nRewind = blkdat.GetPos();
+
+               uint64_t record_pos = nBlockPos - MESSAGE_START_SIZE - sizeof(nSize);
+               if (record_pos > parsed_pos)
+                  stat_add(STAT_SKIPPED_BYTES, record_pos - parsed_pos);
+               parsed_pos = nRewind;
+
+               process_block<P>(ctx, out);
+               std::string line;
+               if (progress.due(line))
+                  log_printf(LOG_INFO, "%s", line);
            } catch (const std::exception& e) {
-               log_printf("%s: Deserialize or I/O error - %s", __func__, e.what());
+               log_printf(LOG_WARNING, "%s: Deserialize or I/O error - %s", __func__, e.what());
            }
        }
    } catch (const std::runtime_error& e) {
-       log_printf("System error: %s", e.what());
+       log_printf(LOG_ERROR, "System error: %s", e.what());
+   }
+   if (blkdat.GetPos() > parsed_pos)
+      stat_add(STAT_SKIPPED_BYTES, blkdat.GetPos() - parsed_pos);
+   blkdat.fclose();
+}
+
+/** Parses the blocks [begin, end) of blocks, which are in file and offset
+ *  order, so the reads only go forward in each file and the blocks between
+ *  the selected ones are skipped by seeking. */
+template<typename P>
+void ParseIndexedBlocks(parse_context_t& ctx, const std::string& db_path, const std::vector<const block_index_entry_t*>& blocks,
+                        size_t begin, size_t end, progress_reporter_t& progress, output_writer_t& out)
+{
+   buffered_file_t& blkdat = ctx.blkdat;
+   uint32_t nFile = std::numeric_limits<uint32_t>::max();
+   for (size_t i = begin; i < end; i++) {
+       const block_index_entry_t* entry = blocks[i];
+       if (entry->file != nFile) {
+           std::string block_file = compose_block_file_path(db_path, entry->file);
+           FILE* file = fopen(block_file.c_str(), "rb");
+           if (!file) {
+               log_printf(LOG_ERROR, "Error: Unable to open file %s", block_file);
+               break;
+           }
+           // This takes over file and calls fclose() on it when the next file is opened
+           blkdat.open(file);
+           nFile = entry->file;
+           log_printf(LOG_INFO, "Processing block file blk%05u.dat...", nFile);
+           stat_set(STAT_GAUGE_BLK_FILE, nFile);
+       }
+       try {
+           // read from the buffer if the block is in it already, seek otherwise
+           blkdat.SetLimit();
+           if (!blkdat.SetPos(entry->offset) && !blkdat.Seek(entry->offset))
+               throw std::ios_base::failure("seek failed");
+           blkdat.SetLimit(entry->offset + entry->size);
+           stat_add(STAT_RECORDS, 1);
+           {
+              stage_timer_t timer(STAT_TIMER_DESERIALIZE, STAT_TIMER_READ);
+              if (ctx.inscriptions)
+                 ctx.inscriptions->reset();
+              blkdat >> ctx.block;
+           }
+           process_block<P>(ctx, out);
+           std::string line;
+           if (progress.due(line))
+              log_printf(LOG_INFO, "%s", line);
+       } catch (const std::exception& e) {
+           log_printf(LOG_WARNING, "%s: Deserialize or I/O error at height %u - %s", __func__, entry->height, e.what());
+       }
+   }
+   blkdat.fclose();
+}
+
+/** Loads the block index from path and brings it up to date with a header
+ *  scan of the blk files that changed since it was saved, or builds it from
+ *  all of them if it is missing. A file that is not a valid index is left
+ *  alone. */
+template<typename P>
+bool open_block_index(const std::string& path, const std::string& db_path, const std::vector<blk_file_state_t>& files,
+                      block_index_t& index)
+{
+   struct stat st;
+   if (stat(path.c_str(), &st) == 0) {
+      // whatever else is there is not overwritten
+      try {
+         index.load(path);
+      } catch (const std::exception& e) {
+         log_printf(LOG_ERROR, "Error: %s, remove it to rebuild the index", e.what());
+         return false;
+      }
+   }
+   std::vector<uint32_t> changed = index.changed_files(files);
+   if (changed.empty() && index.file_count() == files.size()) {
+      log_printf(LOG_INFO, "Loaded the index of %u blocks from %s", index.size(), path);
+      return true;
+   }
+   if (index.file_count())
+      log_printf(LOG_INFO, "Updating block index %s, scanning %u of %u blk files", path, changed.size(), files.size());
+   else
+      log_printf(LOG_INFO, "Building block index %s from %u blk files", path, files.size());
+   std::vector<std::string> paths;
+   for (uint32_t i: changed)
+      paths.push_back(compose_block_file_path(db_path, i));
+   try {
+      uint64_t skipped = 0;
+      std::vector<block_location_t> blocks = scan_block_files(paths, P::message_start, skipped);
+      // scan_block_files numbers the files by their position in paths
+      for (block_location_t& b: blocks)
+         b.file = changed[b.file];
+      index.update(blocks, files);
+      index.save(path);
+      log_printf(LOG_INFO, "Indexed %u blocks of the best chain, %u block records scanned", index.size(), blocks.size());
+   } catch (const std::exception& e) {
+      log_printf(LOG_ERROR, "Error: %s", e.what());
+      return false;
    }
+   return true;
+}
+
+/** Header-only scan of the blk files: writes "hash prev_hash time bits file offset size"
+ *  lines, offset being the position of the block data past its magic and size */
+template<typename P>
+bool ScanBlockHeaders(const std::string& db_path, uint32_t file_count, output_writer_t& out, std::string& out_buf)
+{
+   static const char hexmap[16] = { '0', '1', '2', '3', '4', '5', '6', '7',
+                                    '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
+   std::vector<std::string> paths;
+   for (uint32_t i = 0; i < file_count; i++)
+      paths.push_back(compose_block_file_path(db_path, i));
+   auto start = std::chrono::steady_clock::now();
+   uint64_t skipped = 0;
+   std::vector<block_location_t> blocks;
+   try {
+      blocks = scan_block_files(paths, P::message_start, skipped);
+   } catch (const std::exception& e) {
+      log_printf(LOG_ERROR, "Error: %s", e.what());
+      return false;
+   }
+   double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+   stat_add(STAT_RECORDS, blocks.size());
+   stat_add(STAT_SKIPPED_BYTES, skipped);
+
+   for (const block_location_t& block: blocks) {
+      out_buf += uint256_to_hex(block.hash);
+      out_buf += ' ';
+      out_buf += uint256_to_hex(block.prev);
+      out_buf += ' ';
+      out_buf += std::to_string(block.time);
+      out_buf += ' ';
+      for (int shift = 28; shift >= 0; shift -= 4)
+         out_buf += hexmap[(block.bits >> shift) & 15];
+      out_buf += ' ';
+      out_buf += std::to_string(block.file);
+      out_buf += ' ';
+      out_buf += std::to_string(block.offset);
+      out_buf += ' ';
+      out_buf += std::to_string(block.size);
+      out_buf += '\n';
+      if (out_buf.size() >= out.buffer_size())
+         out.submit(out_buf);
+   }
+   log_printf(LOG_INFO, "Indexed %u blocks of %u files in %.2fs, %u bytes outside of block records", blocks.size(),
+              file_count, elapsed, skipped);
+   return true;
+}
+
+/** Decodes the watched addresses, one per line, into the watchlist */
+template<typename P>
+bool load_watchlist(const std::string& path, watchlist_t& watch)
+{
+   std::ifstream in(path, std::ios::binary);
+   if (!in) {
+      log_printf(LOG_ERROR, "Error: Unable to open watch file %s", path);
+      return false;
+   }
+   std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+   std::vector<std::string_view> addresses;
+   std::string_view rest(text);
+   while (!rest.empty()) {
+      size_t eol = rest.find('\n');
+      std::string_view line = rest.substr(0, eol);
+      rest.remove_prefix(eol == std::string_view::npos ? rest.size() : eol + 1);
+      size_t begin = line.find_first_not_of(" \t\r");
+      if (begin == std::string_view::npos || line[begin] == '#')
+         continue;
+      size_t end = line.find_first_of(" \t\r", begin);
+      addresses.push_back(line.substr(begin, end == std::string_view::npos ? std::string_view::npos : end - begin));
+   }
+   std::vector<destination_key_t> keys;
+   std::vector<unsigned char> valid;
+   size_t found = decode_destination_keys<P>(addresses, keys, valid);
+   size_t invalid = addresses.size() - found;
+   if (invalid) {
+      size_t pos = 0;
+      for (size_t i = 0; i < addresses.size(); i++) {
+         if (valid[i])
+            keys[pos++] = keys[i];
+         else
+            log_printf(LOG_WARNING, "Invalid watched address %s", std::string(addresses[i]));
+      }
+      keys.resize(pos);
+   }
+   watch.build(std::move(keys));
+   log_printf(LOG_INFO, "Watching %u addresses, %u invalid lines skipped", watch.size(), invalid);
+   return true;
 }
 
 void print_usage()
 {
    std::cout << "Usage:" << std::endl;
-   std::cout << "addr_parser [-m|-t|-r] [-p db_path] [-o output_file]" << std::endl;
+   std::cout << "addr_parser [-m|-t|-r|-s] [-p db_path] [-o output_file] [-i report_interval] [-M metrics_file] [-l log_level]" << std::endl;
+   std::cout << "            [-T types] [-a min_value] [-A max_value] [-b min_time] [-e max_time] [-w watch_file] [-W watch_index] [-I]" << std::endl;
+   std::cout << "            [-N] [-P protocol_file] [-C] [-K pool_file] [-E] [-H]" << std::endl;
+   std::cout << "            [-X index_file] [-R min_height:max_height] [-j part/parts]" << std::endl;
    std::cout << "where" << std::endl;
-   std::cout << "-m - parse BTC mainnet data, default option" << std::endl;
-   std::cout << "-t - parse BTC testnet data" << std::endl;
-   std::cout << "-r - parse BTC regtest data" << std::endl;
-   std::cout << "db_path - path to the directory with block files (e.g. ${HOME}/.bitcoin/blocks),  default value is current directory" << std::endl;
-   std::cout << "output_file - file to write parsed addresses, default value addresses.txt" << std::endl;
+   std::cout << "-m, --mainnet - parse BTC mainnet data, default option" << std::endl;
+   std::cout << "-t, --testnet - parse BTC testnet data" << std::endl;
+   std::cout << "-r, --regtest - parse BTC regtest data" << std::endl;
+   std::cout << "-s, --signet - parse BTC signet data" << std::endl;
+   std::cout << "-p, --path db_path - path to the directory with block files (e.g. ${HOME}/.bitcoin/blocks),  default value is current directory" << std::endl;
+   std::cout << "-o, --output output_file - file to write parsed addresses, default value addresses.txt" << std::endl;
+   std::cout << "-i, --interval report_interval - seconds between progress reports, default value 10, 0 disables them" << std::endl;
+   std::cout << "-M, --metrics metrics_file - file rewritten every 5 seconds with metrics in Prometheus text format" << std::endl;
+   std::cout << "-l, --log-level log_level - debug, info, warning or error, default value info" << std::endl;
+   std::cout << "-T, --types types - comma separated output types to write, e.g. witness_v0_keyhash,witness_v0_scripthash," << std::endl;
+   std::cout << "        each one of pubkey, pubkeyhash, scripthash, multisig, witness_v0_keyhash, witness_v0_scripthash," << std::endl;
+   std::cout << "        witness_v1_taproot, witness_unknown, nulldata (with -N)" << std::endl;
+   std::cout << "-a, --min-value min_value, -A, --max-value max_value - range of the output value in satoshis" << std::endl;
+   std::cout << "-b, --min-time min_time, -e, --max-time max_time - range of the block time as a unix timestamp" << std::endl;
+   std::cout << "-w, --watch watch_file - only write outputs paying to the addresses in watch_file (one per line)" << std::endl;
+   std::cout << "        as \"address block_hash txid vout\" lines" << std::endl;
+   std::cout << "-W, --watch-index watch_index - prebuilt watchlist: written after decoding watch_file when -w is given," << std::endl;
+   std::cout << "        memory mapped instead of decoding a watch file otherwise" << std::endl;
+   std::cout << "-I, --inputs - also write the addresses spent by P2PKH, P2WPKH and nested segwit inputs" << std::endl;
+   std::cout << "        as \"address spent_txid:spent_vout\" lines (\"address block_hash spent_txid:spent_vout\" with -w)" << std::endl;
+   std::cout << "-N, --null-data - also write the payloads of OP_RETURN outputs as \"hex_payload nulldata:protocol txid:vout\" lines," << std::endl;
+   std::cout << "        the protocol is the one whose marker the payload starts with, left out if none matches" << std::endl;
+   std::cout << "-P, --protocols protocol_file - \"name hex_marker\" lines replacing the built-in protocol markers, implies -N" << std::endl;
+   std::cout << "-C, --coinbase - tag the addresses of coinbase outputs with \"coinbase:height:pool\", the BIP34 height and" << std::endl;
+   std::cout << "        the pool whose tag the coinbase scriptSig contains, left out if none matches" << std::endl;
+   std::cout << "-K, --pool-tags pool_file - \"name tag text\" lines replacing the built-in pool tags, implies -C" << std::endl;
+   std::cout << "-E, --inscriptions - also write the inscription envelopes found in witness data" << std::endl;
+   std::cout << "        as \"inscription:body_size txid:input content_type\" lines, ignored with -w and -W" << std::endl;
+   std::cout << "-H, --headers - only read the block headers and write \"hash prev_hash time bits file offset size\" lines" << std::endl;
+   std::cout << "        locating every block record, all other output options are ignored" << std::endl;
+   std::cout << "-X, --block-index index_file - only parse the blocks of the best chain, found through index_file," << std::endl;
+   std::cout << "        which is built with a header scan if missing, and updated by scanning the blk files changed since" << std::endl;
+   std::cout << "-R, --heights min_height:max_height - only parse the blocks of this height range, either end may be left out, needs -X" << std::endl;
+   std::cout << "-j, --part part/parts - split the blocks to parse, in file order, into parts of about the same size in bytes and" << std::endl;
+   std::cout << "        only parse one of them, numbered from 1, to share the work among processes, needs -X" << std::endl;
 }
 
 int main(int argc, char* argv[])
 {
    std::string db_path;
    std::string out_file = "addresses.txt";
-   char c;
-   bool option_found = false;
+   network_t network = network_t::mainnet;
+   long report_interval = 10;
+   std::string metrics_file;
+   output_filter_t filter;
+   std::string watch_file;
+   std::string watch_index;
+   bool spends = false;
+   bool null_data = false;
+   std::string protocol_file;
+   bool coinbase = false;
+   std::string pool_file;
+   bool inscriptions = false;
+   bool headers = false;
+   std::string index_file;
+   uint64_t min_height = 0;
+   uint64_t max_height = std::numeric_limits<uint64_t>::max();
+   unsigned long part = 1;
+   unsigned long parts = 1;
+   int c;
 
-   while ((c = getopt(argc, argv, "mtrp:o:?")) != -1)
+   static const struct option long_options[] = {
+      {"mainnet", no_argument, nullptr, 'm'},
+      {"testnet", no_argument, nullptr, 't'},
+      {"regtest", no_argument, nullptr, 'r'},
+      {"signet", no_argument, nullptr, 's'},
+      {"path", required_argument, nullptr, 'p'},
+      {"output", required_argument, nullptr, 'o'},
+      {"interval", required_argument, nullptr, 'i'},
+      {"metrics", required_argument, nullptr, 'M'},
+      {"log-level", required_argument, nullptr, 'l'},
+      {"types", required_argument, nullptr, 'T'},
+      {"min-value", required_argument, nullptr, 'a'},
+      {"max-value", required_argument, nullptr, 'A'},
+      {"min-time", required_argument, nullptr, 'b'},
+      {"max-time", required_argument, nullptr, 'e'},
+      {"watch", required_argument, nullptr, 'w'},
+      {"watch-index", required_argument, nullptr, 'W'},
+      {"inputs", no_argument, nullptr, 'I'},
+      {"null-data", no_argument, nullptr, 'N'},
+      {"protocols", required_argument, nullptr, 'P'},
+      {"coinbase", no_argument, nullptr, 'C'},
+      {"pool-tags", required_argument, nullptr, 'K'},
+      {"inscriptions", no_argument, nullptr, 'E'},
+      {"headers", no_argument, nullptr, 'H'},
+      {"block-index", required_argument, nullptr, 'X'},
+      {"heights", required_argument, nullptr, 'R'},
+      {"part", required_argument, nullptr, 'j'},
+      {nullptr, 0, nullptr, 0}
+   };
+   while ((c = getopt_long(argc, argv, "mtrsp:o:i:M:l:T:a:A:b:e:w:W:INP:CK:EHX:R:j:?", long_options, nullptr)) != -1)
    {
      switch (c)
      {
          case 'm':
-            btc_utils::g_network = btc_utils::network_t::mainnet;
+            network = network_t::mainnet;
             break;
          case 't':
-            btc_utils::g_network = btc_utils::network_t::testnet;
+            network = network_t::testnet;
             break;
          case 'r':
-            btc_utils::g_network = btc_utils::network_t::regtest;
+            network = network_t::regtest;
+            break;
+         case 's':
+            network = network_t::signet;
             break;
          case 'p':
             if (!optarg)
@@ -401,6 +1137,106 @@ int main(int argc, char* argv[])
            }
             out_file = optarg;
             break;
+         case 'i':
+            report_interval = strtol(optarg, nullptr, 10);
+            if (report_interval < 0)
+            {
+               print_usage();
+               return 1;
+            }
+            break;
+         case 'l':
+         {
+            log_level_t level;
+            if (!parse_log_level(optarg, level))
+            {
+               print_usage();
+               return 1;
+            }
+            g_logger.set_level(level);
+            break;
+         }
+         case 'T':
+            if (!filter.parse_types(optarg))
+            {
+               std::cout << "Invalid output types " << optarg << std::endl;
+               print_usage();
+               return 1;
+            }
+            break;
+         case 'a':
+            filter.min_value = strtoull(optarg, nullptr, 10);
+            break;
+         case 'A':
+            filter.max_value = strtoull(optarg, nullptr, 10);
+            break;
+         case 'b':
+            filter.min_time = static_cast<uint32_t>(strtoul(optarg, nullptr, 10));
+            break;
+         case 'e':
+            filter.max_time = static_cast<uint32_t>(strtoul(optarg, nullptr, 10));
+            break;
+         case 'M':
+            metrics_file = optarg;
+            break;
+         case 'w':
+            watch_file = optarg;
+            break;
+         case 'W':
+            watch_index = optarg;
+            break;
+         case 'I':
+            spends = true;
+            break;
+         case 'N':
+            null_data = true;
+            break;
+         case 'P':
+            null_data = true;
+            protocol_file = optarg;
+            break;
+         case 'C':
+            coinbase = true;
+            break;
+         case 'K':
+            coinbase = true;
+            pool_file = optarg;
+            break;
+         case 'E':
+            inscriptions = true;
+            break;
+         case 'H':
+            headers = true;
+            break;
+         case 'X':
+            index_file = optarg;
+            break;
+         case 'R':
+         {
+            const char* sep = strchr(optarg, ':');
+            if (!sep)
+            {
+               print_usage();
+               return 1;
+            }
+            if (sep != optarg)
+               min_height = strtoull(optarg, nullptr, 10);
+            if (sep[1])
+               max_height = strtoull(sep + 1, nullptr, 10);
+            break;
+         }
+         case 'j':
+         {
+            char* sep = nullptr;
+            part = strtoul(optarg, &sep, 10);
+            parts = *sep == '/' ? strtoul(sep + 1, nullptr, 10) : 0;
+            if (part < 1 || part > parts)
+            {
+               print_usage();
+               return 1;
+            }
+            break;
+         }
          case '?':
             print_usage();
             return 1;
@@ -409,32 +1245,193 @@ int main(int argc, char* argv[])
             return 1;
       }
    }
-   if (optind < argc)
+   if (optind < argc || (index_file.empty() && (min_height || max_height != std::numeric_limits<uint64_t>::max() || parts > 1)))
    {
       print_usage();
       return 1;
    }
+   g_logger.start();
+
+   // the blk files are numbered without gaps, their total size gives the ETA
+   uint64_t total_bytes = 0;
+   uint32_t file_count = 0;
+   std::vector<blk_file_state_t> blk_files;
+   for (; ; file_count++) {
+       struct stat st;
+       if (stat(compose_block_file_path(db_path, file_count).c_str(), &st) != 0)
+           break;
+       total_bytes += static_cast<uint64_t>(st.st_size);
+       blk_files.push_back({static_cast<uint64_t>(st.st_size),
+                            static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec});
+   }
+   progress_reporter_t progress(std::chrono::seconds(report_interval), total_bytes);
+   std::unique_ptr<metrics_exporter_t> metrics;
+   if (!metrics_file.empty())
+       metrics.reset(new metrics_exporter_t(metrics_file, std::chrono::seconds(5)));
 
    unsigned int nFile = 0;
-   int blocks = 0;
-   FILE* out = fopen(out_file.c_str(), "w");
-   if (!out) {
-       log_printf("Error: Unable to open file %s\n", out_file);
+   std::unique_ptr<parse_context_t> ctx(new parse_context_t());
+   int out_fd = open(out_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   if (out_fd < 0) {
+       log_printf(LOG_ERROR, "Error: Unable to open file %s", out_file);
        return 1;
    }
-   while (true) {
-       std::string block_file = compose_block_file_path(db_path, nFile);
-       FILE* file = fopen(block_file.c_str(), "rb");
-       if (!file) {
-           log_printf("Error: Unable to open file %s\n", block_file.c_str());
-           break;
+   output_writer_t out(out_fd);
+   ctx->out_buf = out.acquire();
+   if (headers) {
+       bool scanned = visit_chain_params(network, [&](auto params) {
+          return ScanBlockHeaders<decltype(params)>(db_path, file_count, out, ctx->out_buf);
+       });
+       try {
+           out.submit(ctx->out_buf);
+           out.close();
+       } catch (const std::exception& e) {
+           log_printf(LOG_ERROR, "Error: %s", e.what());
+           scanned = false;
+       }
+       g_logger.stop();
+       return scanned ? 0 : 1;
+   }
+   ctx->filter = filter;
+   ctx->spends = spends;
+   // watch mode writes no inscription lines, so the witness items are not scanned at all
+   if (inscriptions && (!watch_file.empty() || !watch_index.empty())) {
+       log_printf(LOG_WARNING, "Inscriptions are not written in watch mode, --inscriptions is ignored");
+       inscriptions = false;
+   }
+   if (inscriptions)
+       ctx->inscriptions.reset(new inscription_scanner_t());
+   // only spends look at the witness items
+   ctx->blkdat.set_witness_handling(ctx->inscriptions.get(), spends);
+   if (null_data) {
+       ctx->protocols.reset(new null_data_protocols_t());
+       if (!protocol_file.empty()) {
+           try {
+               ctx->protocols->load(protocol_file);
+           } catch (const std::exception& e) {
+               log_printf(LOG_ERROR, "Error: %s", e.what());
+               return 1;
+           }
+       }
+       log_printf(LOG_DEBUG, "%u null data protocols, %u matcher states", ctx->protocols->names.size(),
+                  ctx->protocols->matcher.state_count());
+   }
+   if (coinbase) {
+       ctx->pools.reset(new pool_tags_t());
+       if (!pool_file.empty()) {
+           try {
+               ctx->pools->load(pool_file);
+           } catch (const std::exception& e) {
+               log_printf(LOG_ERROR, "Error: %s", e.what());
+               return 1;
+           }
+       }
+       log_printf(LOG_DEBUG, "%u pools, %u matcher states", ctx->pools->names.size(), ctx->pools->matcher.state_count());
+   }
+   if (!watch_file.empty()) {
+       ctx->watch.reset(new watchlist_t());
+       bool loaded = visit_chain_params(network, [&](auto params) {
+          return load_watchlist<decltype(params)>(watch_file, *ctx->watch);
+       });
+       if (!loaded)
+           return 1;
+       if (!watch_index.empty()) {
+           try {
+               ctx->watch->save(watch_index);
+           } catch (const std::exception& e) {
+               log_printf(LOG_ERROR, "Error: %s", e.what());
+               return 1;
+           }
+       }
+   }
+   else if (!watch_index.empty()) {
+       ctx->watch.reset(new watchlist_t());
+       try {
+           ctx->watch->load(watch_index);
+       } catch (const std::exception& e) {
+           log_printf(LOG_ERROR, "Error: %s", e.what());
+           return 1;
+       }
+       log_printf(LOG_INFO, "Watching %u addresses from %s", ctx->watch->size(), watch_index);
+   }
+   std::unique_ptr<block_index_t> index;
+   if (!index_file.empty()) {
+       index.reset(new block_index_t());
+       bool opened = visit_chain_params(network, [&](auto params) {
+          return open_block_index<decltype(params)>(index_file, db_path, blk_files, *index);
+       });
+       if (!opened)
+           return 1;
+   }
+   if (index) {
+       size_t begin = static_cast<size_t>(std::min<uint64_t>(min_height, index->size()));
+       size_t end = max_height < index->size() ? static_cast<size_t>(max_height) + 1 : index->size();
+       end = std::max(begin, end);
+       // parts are cut in reading order, so each one reads its files sequentially
+       std::vector<const block_index_entry_t*> blocks = index->locate(begin, end);
+       size_t part_begin = split_by_size(blocks, static_cast<unsigned int>(parts), static_cast<unsigned int>(part - 1));
+       size_t part_end = split_by_size(blocks, static_cast<unsigned int>(parts), static_cast<unsigned int>(part));
+       uint64_t part_bytes = 0;
+       for (size_t i = part_begin; i < part_end; i++)
+           part_bytes += blocks[i]->size;
+       progress.set_total_bytes(part_bytes);
+       log_printf(LOG_INFO, "Parsing %u of the %u blocks of heights %u to %u, %u bytes", part_end - part_begin,
+                  blocks.size(), begin, end - 1, part_bytes);
+       visit_chain_params(network, [&](auto params) {
+          ParseIndexedBlocks<decltype(params)>(*ctx, db_path, blocks, part_begin, part_end, progress, out);
+       });
+   }
+   else {
+       while (true) {
+           std::string block_file = compose_block_file_path(db_path, nFile);
+           FILE* file = fopen(block_file.c_str(), "rb");
+           if (!file) {
+               if (nFile)
+                   log_printf(LOG_INFO, "No more block files after blk%05u.dat", nFile - 1);
+               else
+                   log_printf(LOG_ERROR, "Error: Unable to open file %s", block_file);
+               break;
+           }
+           log_printf(LOG_INFO, "Processing block file blk%05u.dat...", nFile);
+           stat_set(STAT_GAUGE_BLK_FILE, nFile);
+           visit_chain_params(network, [&](auto params) {
+              ParseBlockFile<decltype(params)>(*ctx, file, progress, out);
+           });
+           nFile++;
        }
-       log_printf("Processing block file blk%05u.dat...", nFile);
-       ParseBlockFile(file, blocks, out);
-       nFile++;
-       fflush(out);
    }
-   fclose(out);
-   log_printf("Processing finished");
-   return 0;
+   int ret = 0;
+   try {
+       out.submit(ctx->out_buf);
+       out.close();
+   } catch (const std::exception& e) {
+       log_printf(LOG_ERROR, "Error: %s", e.what());
+       ret = 1;
+   }
+   metrics.reset();
+   if (parse_stats_enabled) {
+       log_printf(LOG_INFO, "%s", progress.progress());
+       log_printf(LOG_INFO, "%s", progress_reporter_t::summary());
+       for (const std::string& line: progress_reporter_t::type_summary())
+           log_printf(LOG_INFO, "%s", line);
+       if (spends)
+           log_printf(LOG_INFO, "%u inputs, %u spend addresses", stat_get(STAT_INPUTS), stat_get(STAT_SPEND_ADDRESSES));
+       if (null_data)
+           log_printf(LOG_INFO, "%u null data payloads, %u tagged", stat_get(STAT_NULL_DATA_PAYLOADS), stat_get(STAT_NULL_DATA_TAGGED));
+       if (coinbase)
+           log_printf(LOG_INFO, "%u of %u blocks attributed to a pool", stat_get(STAT_POOL_BLOCKS), stat_get(STAT_BLOCKS));
+       if (inscriptions)
+           log_printf(LOG_INFO, "%u inscriptions", stat_get(STAT_INSCRIPTIONS));
+       uint64_t key_lookups = stat_get(STAT_KEY_CACHE_HITS) + stat_get(STAT_KEY_CACHE_MISSES);
+       if (key_lookups)
+           log_printf(LOG_INFO, "key id cache: %u hits, %u misses, %.1f%% hit rate", stat_get(STAT_KEY_CACHE_HITS),
+                      stat_get(STAT_KEY_CACHE_MISSES), 100.0 * static_cast<double>(stat_get(STAT_KEY_CACHE_HITS)) / static_cast<double>(key_lookups));
+       uint64_t memo_lookups = stat_get(STAT_ADDRESS_CACHE_HITS) + stat_get(STAT_ADDRESS_CACHE_MISSES);
+       if (memo_lookups)
+           log_printf(LOG_INFO, "address cache: %u hits, %u misses, %.1f%% hit rate", stat_get(STAT_ADDRESS_CACHE_HITS),
+                      stat_get(STAT_ADDRESS_CACHE_MISSES), 100.0 * static_cast<double>(stat_get(STAT_ADDRESS_CACHE_HITS)) / static_cast<double>(memo_lookups));
+   }
+   log_printf(LOG_INFO, "Processing finished");
+   g_logger.stop();
+   return ret;
 }
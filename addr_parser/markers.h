@@ -0,0 +1,75 @@
+// Copyright (c) 2020 gladcow
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef ADDR_PARSER_MARKERS_H__
+#define ADDR_PARSER_MARKERS_H__
+
+#include <pattern_matcher.h>
+
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+/** Named byte markers compiled into one automaton, several markers may share
+ *  a name. The id the matcher reports for a marker indexes names. */
+struct marker_dictionary_t
+{
+   typedef std::pair<std::string, std::vector<unsigned char>> marker_t;
+
+   std::vector<std::string> names;
+   btc_utils::multi_pattern_matcher_t matcher;
+
+   void build(const std::vector<marker_t>& markers)
+   {
+      names.clear();
+      std::vector<btc_utils::multi_pattern_matcher_t::pattern_t> patterns;
+      for (const marker_t& m: markers)
+         patterns.push_back({m.second, add_name(m.first)});
+      matcher.build(patterns);
+   }
+
+   /** Build from the "name marker" lines of path, skipping empty lines and
+    *  # comments. parse turns the rest of a line into the marker bytes and
+    *  returns them empty if it is invalid. Throws std::runtime_error on a
+    *  bad line. */
+   template<typename F>
+   void load(const std::string& path, F&& parse)
+   {
+      std::ifstream in(path);
+      if (!in)
+         throw std::runtime_error("unable to open " + path);
+      std::vector<marker_t> markers;
+      std::string line;
+      for (unsigned int n = 1; std::getline(in, line); n++)
+      {
+         size_t begin = line.find_first_not_of(" \t\r");
+         if (begin == std::string::npos || line[begin] == '#')
+            continue;
+         size_t name_end = line.find_first_of(" \t", begin);
+         size_t marker_begin = name_end == std::string::npos ? std::string::npos : line.find_first_not_of(" \t", name_end);
+         std::vector<unsigned char> bytes;
+         if (marker_begin != std::string::npos)
+            bytes = parse(line.substr(marker_begin, line.find_last_not_of(" \t\r") + 1 - marker_begin));
+         if (bytes.empty())
+            throw std::runtime_error(path + ":" + std::to_string(n) + ": expected \"name marker\"");
+         markers.emplace_back(line.substr(begin, name_end - begin), std::move(bytes));
+      }
+      build(markers);
+   }
+
+private:
+   uint32_t add_name(const std::string& name)
+   {
+      for (size_t i = 0; i < names.size(); i++)
+         if (names[i] == name)
+            return static_cast<uint32_t>(i);
+      names.push_back(name);
+      return static_cast<uint32_t>(names.size() - 1);
+   }
+};
+
+#endif // ADDR_PARSER_MARKERS_H__
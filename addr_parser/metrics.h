@@ -0,0 +1,166 @@
+// Copyright (c) 2020 gladcow
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef ADDR_PARSER_METRICS_H__
+#define ADDR_PARSER_METRICS_H__
+
+#include "stats.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+struct metric_info_t
+{
+   const char* name;
+   const char* help;
+};
+
+static const metric_info_t counter_metrics[STAT_COUNTER_COUNT] = {
+   {"addr_parser_read_bytes_total", "Bytes read from blk files"},
+   {"addr_parser_records_total", "Records with a valid message start and size"},
+   {"addr_parser_skipped_bytes_total", "Bytes outside of successfully parsed records"},
+   {"addr_parser_blocks_total", "Parsed blocks"},
+   {"addr_parser_transactions_total", "Parsed transactions"},
+   {"addr_parser_outputs_total", "Parsed transaction outputs"},
+   {"addr_parser_filtered_outputs_total", "Outputs rejected by the filters"},
+   {"addr_parser_addresses_total", "Addresses written"},
+   {"addr_parser_inputs_total", "Inputs matched against the standard spends"},
+   {"addr_parser_spend_addresses_total", "Addresses of spent outputs found in inputs"},
+   {"addr_parser_key_cache_hits_total", "Public key hash160 lookups served by the key id cache"},
+   {"addr_parser_key_cache_misses_total", "Public key hash160 lookups that were computed"},
+   {"addr_parser_address_cache_hits_total", "Output scripts whose address was taken from the address memo"},
+   {"addr_parser_address_cache_misses_total", "Output scripts of memoizable size that were solved and encoded"},
+   {"addr_parser_null_data_payloads_total", "OP_RETURN payloads written"},
+   {"addr_parser_null_data_tagged_total", "OP_RETURN payloads that start with a protocol marker"},
+   {"addr_parser_pool_blocks_total", "Blocks whose coinbase scriptSig carries a known pool tag"},
+   {"addr_parser_inscriptions_total", "Inscription envelopes found in witness items"},
+};
+
+static const metric_info_t gauge_metrics[STAT_GAUGE_COUNT] = {
+   {"addr_parser_blk_file_index", "Index of the blk file being parsed"},
+   {"addr_parser_last_block_time_seconds", "Header time of the last parsed block"},
+   {"addr_parser_write_queue_depth", "Output buffers waiting for the writer thread"},
+};
+
+//! resident set size of this process from /proc/self/statm, 0 if unavailable
+inline uint64_t resident_memory_bytes()
+{
+   FILE* f = fopen("/proc/self/statm", "r");
+   if (!f)
+      return 0;
+   unsigned long long size = 0, resident = 0;
+   int n = fscanf(f, "%llu %llu", &size, &resident);
+   fclose(f);
+   if (n != 2)
+      return 0;
+   return static_cast<uint64_t>(resident) * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+}
+
+/** Current metrics in the Prometheus text exposition format */
+inline std::string format_metrics()
+{
+   std::string res;
+   for (int i = 0; i < STAT_COUNTER_COUNT; i++)
+   {
+      const metric_info_t& m = counter_metrics[i];
+      res += strprintf("# HELP %s %s\n# TYPE %s counter\n%s %u\n", m.name, m.help, m.name, m.name,
+                       stat_get(static_cast<stat_counter_t>(i)));
+   }
+   res += "# HELP addr_parser_type_addresses_total Addresses written per output type\n"
+          "# TYPE addr_parser_type_addresses_total counter\n";
+   for (unsigned int i = 0; i < btc_utils::TX_TYPE_COUNT; i++)
+   {
+      btc_utils::txnouttype type = static_cast<btc_utils::txnouttype>(i);
+      res += strprintf("addr_parser_type_addresses_total{type=\"%s\"} %u\n",
+                       btc_utils::get_txn_output_type(type), stat_addresses_get(type));
+   }
+   res += "# HELP addr_parser_stage_seconds_total Time spent in each parse stage\n"
+          "# TYPE addr_parser_stage_seconds_total counter\n";
+   for (int i = 0; i < STAT_TIMER_COUNT; i++)
+   {
+      res += strprintf("addr_parser_stage_seconds_total{stage=\"%s\"} %.6f\n", stat_timer_names[i],
+                       static_cast<double>(stat_timer_get(static_cast<stat_timer_t>(i))) / 1e9);
+   }
+   for (int i = 0; i < STAT_GAUGE_COUNT; i++)
+   {
+      const metric_info_t& m = gauge_metrics[i];
+      res += strprintf("# HELP %s %s\n# TYPE %s gauge\n%s %u\n", m.name, m.help, m.name, m.name,
+                       stat_gauge_get(static_cast<stat_gauge_t>(i)));
+   }
+   res += strprintf("# HELP addr_parser_resident_memory_bytes Resident set size\n"
+                    "# TYPE addr_parser_resident_memory_bytes gauge\n"
+                    "addr_parser_resident_memory_bytes %u\n", resident_memory_bytes());
+   return res;
+}
+
+/** Background thread that rewrites the metrics file at a fixed interval.
+ *  The file is written next to the target and renamed over it, so a scraper
+ *  never sees a partially written file.
+ */
+class metrics_exporter_t
+{
+private:
+   std::string path_;
+   std::chrono::seconds interval_;
+   std::mutex mutex_;
+   std::condition_variable cv_;
+   bool stop_;
+   std::thread thread_;
+
+   void run()
+   {
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (!stop_)
+      {
+         lock.unlock();
+         write();
+         lock.lock();
+         cv_.wait_for(lock, interval_, [this] { return stop_; });
+      }
+   }
+
+public:
+   metrics_exporter_t(const std::string& path, std::chrono::seconds interval) :
+      path_(path), interval_(interval), stop_(false), thread_(&metrics_exporter_t::run, this) {}
+
+   //! stops the thread and writes the final values
+   ~metrics_exporter_t()
+   {
+      {
+         std::lock_guard<std::mutex> lock(mutex_);
+         stop_ = true;
+      }
+      cv_.notify_one();
+      thread_.join();
+      write();
+   }
+
+   metrics_exporter_t(const metrics_exporter_t&) = delete;
+   metrics_exporter_t& operator=(const metrics_exporter_t&) = delete;
+
+   //! returns false if the file could not be written
+   bool write() const
+   {
+      std::string data = format_metrics();
+      std::string tmp = path_ + ".tmp";
+      FILE* f = fopen(tmp.c_str(), "w");
+      if (!f)
+         return false;
+      bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+      ok = fclose(f) == 0 && ok;
+      if (!ok || rename(tmp.c_str(), path_.c_str()) != 0)
+      {
+         remove(tmp.c_str());
+         return false;
+      }
+      return true;
+   }
+};
+
+#endif // ADDR_PARSER_METRICS_H__
@@ -0,0 +1,101 @@
+// Copyright (c) 2020 gladcow
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef ADDR_PARSER_NULL_DATA_H__
+#define ADDR_PARSER_NULL_DATA_H__
+
+#include <crypto.h>
+#include <pattern_matcher.h>
+#include <script.h>
+#include <span.h>
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "markers.h"
+
+/** Built-in protocol markers, the bytes a null data payload starts with.
+ *  Runes tag their payload with OP_13, which is its first element. */
+static const struct
+{
+   const char* name;
+   const char* marker;
+} default_null_data_markers[] = {
+   {"witness_commitment", "aa21a9ed"},
+   {"omni", "6f6d6e69"},
+   {"runes", "5d"},
+   {"stacks", "5832"},
+   {"blockstack", "6964"},
+   {"eternity_wall", "455720"},
+   {"docproof", "444f4350524f4f46"},
+   {"openassets", "4f410100"},
+   {"factom", "466163746f6d2121"},
+   {"ascribe", "4153435249424553504f4f4c"},
+   {"rsk", "52534b424c4f434b3a"},
+   {"coredao", "434f5245"},
+};
+
+/** Tags null data payloads with the protocol whose marker they start with.
+ *  The markers are compiled into one automaton, so the cost of tagging a
+ *  payload is the length of the marker it matches, whatever their number.
+ */
+struct null_data_protocols_t : marker_dictionary_t
+{
+   null_data_protocols_t()
+   {
+      std::vector<marker_t> markers;
+      for (const auto& m: default_null_data_markers)
+         markers.emplace_back(m.name, btc_utils::from_hex(m.marker));
+      build(markers);
+   }
+
+   /** Replace the markers with the "name hex_marker" lines of path */
+   void load(const std::string& path)
+   {
+      marker_dictionary_t::load(path, [](const std::string& marker) {
+         try {
+            return btc_utils::from_hex(marker);
+         } catch (const std::exception&) {
+            return std::vector<unsigned char>();
+         }
+      });
+   }
+
+   /** Protocol id of the payload of a null data script, NO_MATCH if it has no
+    *  known marker. Returns false if the payload is empty or the script is
+    *  not OP_RETURN followed by pushes only. */
+   bool tag(btc_utils::byte_span_t script, uint32_t& protocol) const
+   {
+      btc_utils::multi_pattern_matcher_t::prefix_state_t st;
+      size_t pos = 1, size = 0;
+      btc_utils::byte_span_t element;
+      while (btc_utils::next_null_data_element(script, pos, element))
+      {
+         size += element.size();
+         matcher.match_prefix(st, element);
+      }
+      protocol = st.match;
+      return pos == script.size() && size;
+   }
+};
+
+/** Appends the payload of a null data script in hex, straight from the script bytes */
+inline void append_null_data_hex(std::string& out, btc_utils::byte_span_t script)
+{
+   static const char hexmap[16] = { '0', '1', '2', '3', '4', '5', '6', '7',
+                                    '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
+   size_t pos = 1;
+   btc_utils::byte_span_t element;
+   while (btc_utils::next_null_data_element(script, pos, element))
+   {
+      for (unsigned char c: element)
+      {
+         out += hexmap[c >> 4];
+         out += hexmap[c & 15];
+      }
+   }
+}
+
+#endif // ADDR_PARSER_NULL_DATA_H__
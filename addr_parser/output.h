@@ -0,0 +1,157 @@
+// Copyright (c) 2020 gladcow
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef ADDR_PARSER_OUTPUT_H__
+#define ADDR_PARSER_OUTPUT_H__
+
+#include "stats.h"
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+/** Output subsystem: parse threads append to their own large buffers and
+ *  hand full ones over with submit(); a dedicated thread writes them with
+ *  write(2). The queue is bounded, a producer waits when the writer is
+ *  behind. Written buffers are recycled with their capacity.
+ */
+class output_writer_t
+{
+private:
+   int fd_;
+   size_t buffer_size_;
+   size_t max_queued_;
+   std::mutex mutex_;
+   std::condition_variable not_empty_;
+   std::condition_variable not_full_;
+   std::deque<std::string> queue_;
+   std::vector<std::string> free_;
+   bool closing_;
+   int error_;       //!< errno of the first failed write
+   std::thread thread_;
+
+   bool write_all(const std::string& buf)
+   {
+      stage_timer_t timer(STAT_TIMER_WRITE);
+      const char* p = buf.data();
+      size_t left = buf.size();
+      while (left > 0)
+      {
+         ssize_t n = ::write(fd_, p, left);
+         if (n < 0)
+         {
+            if (errno == EINTR)
+               continue;
+            return false;
+         }
+         p += n;
+         left -= static_cast<size_t>(n);
+      }
+      return true;
+   }
+
+   void run()
+   {
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (true)
+      {
+         not_empty_.wait(lock, [this] { return !queue_.empty() || closing_; });
+         if (queue_.empty())
+            break;
+         std::string buf = std::move(queue_.front());
+         queue_.pop_front();
+         stat_set(STAT_GAUGE_WRITE_QUEUE_DEPTH, queue_.size());
+         not_full_.notify_one();
+         // after a failure the data is dropped, close() reports the error
+         bool failed = error_ != 0;
+         lock.unlock();
+         if (!failed && !write_all(buf))
+            failed = true;
+         int err = errno;
+         buf.clear();
+         lock.lock();
+         if (failed && !error_)
+            error_ = err;
+         free_.push_back(std::move(buf));
+      }
+   }
+
+public:
+   //! takes over fd and closes it in close()
+   output_writer_t(int fd, size_t buffer_size = 4 << 20, size_t max_queued = 8) :
+      fd_(fd), buffer_size_(buffer_size), max_queued_(max_queued), closing_(false), error_(0),
+      thread_(&output_writer_t::run, this) {}
+
+   ~output_writer_t()
+   {
+      try {
+         close();
+      } catch (const std::exception&) {
+      }
+   }
+
+   output_writer_t(const output_writer_t&) = delete;
+   output_writer_t& operator=(const output_writer_t&) = delete;
+
+   //! size at which a producer buffer should be submitted
+   size_t buffer_size() const { return buffer_size_; }
+
+   //! empty buffer to append to
+   std::string acquire()
+   {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (free_.empty())
+      {
+         std::string buf;
+         buf.reserve(buffer_size_ + buffer_size_ / 4);
+         return buf;
+      }
+      std::string buf = std::move(free_.back());
+      free_.pop_back();
+      return buf;
+   }
+
+   //! queues the contents of buf for writing and replaces it with an empty buffer
+   void submit(std::string& buf)
+   {
+      if (buf.empty())
+         return;
+      std::string next = acquire();
+      {
+         std::unique_lock<std::mutex> lock(mutex_);
+         not_full_.wait(lock, [this] { return queue_.size() < max_queued_; });
+         queue_.push_back(std::move(buf));
+         stat_set(STAT_GAUGE_WRITE_QUEUE_DEPTH, queue_.size());
+      }
+      not_empty_.notify_one();
+      buf = std::move(next);
+   }
+
+   //! waits until everything is written and closes the file, throws if a write failed
+   void close()
+   {
+      if (thread_.joinable())
+      {
+         {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closing_ = true;
+         }
+         not_empty_.notify_one();
+         thread_.join();
+         if (::close(fd_) != 0 && !error_)
+            error_ = errno;
+      }
+      if (error_)
+         throw std::runtime_error(std::string("Output write failed: ") + strerror(error_));
+   }
+};
+
+#endif // ADDR_PARSER_OUTPUT_H__
@@ -0,0 +1,250 @@
+// Copyright (c) 2020 gladcow
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef ADDR_PARSER_STATS_H__
+#define ADDR_PARSER_STATS_H__
+
+#include <script.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "tinyformat.h"
+
+/** Per-stage counters and timers of the parser.
+ *  They are compiled in when ENABLE_PARSE_STATS is defined (the ADDR_PARSER_STATS
+ *  cmake option), otherwise every update is an empty inline function.
+ *  Counters are relaxed atomics so they can be read from other threads; the
+ *  parse loop accumulates per block and publishes once per block.
+ */
+#ifdef ENABLE_PARSE_STATS
+static constexpr bool parse_stats_enabled = true;
+#else
+static constexpr bool parse_stats_enabled = false;
+#endif
+
+enum stat_counter_t
+{
+   STAT_BYTES_READ,     //!< bytes read from blk files
+   STAT_RECORDS,        //!< records with a valid message start and size
+   STAT_SKIPPED_BYTES,  //!< bytes outside of successfully parsed records
+   STAT_BLOCKS,
+   STAT_TXS,
+   STAT_OUTPUTS,
+   STAT_FILTERED_OUTPUTS, //!< outputs rejected by the value, type or block time filters
+   STAT_ADDRESSES,
+   STAT_INPUTS,           //!< inputs matched against the standard spends
+   STAT_SPEND_ADDRESSES,  //!< addresses of spent outputs found in inputs
+   STAT_KEY_CACHE_HITS,   //!< public key hash160 lookups served by the key id cache
+   STAT_KEY_CACHE_MISSES,
+   STAT_ADDRESS_CACHE_HITS, //!< short output scripts whose address was memoized
+   STAT_ADDRESS_CACHE_MISSES,
+   STAT_NULL_DATA_PAYLOADS, //!< OP_RETURN payloads written
+   STAT_NULL_DATA_TAGGED,   //!< payloads that start with a protocol marker
+   STAT_POOL_BLOCKS,        //!< blocks whose coinbase scriptSig carries a known pool tag
+   STAT_INSCRIPTIONS,       //!< inscription envelopes found in witness items
+   STAT_COUNTER_COUNT
+};
+
+enum stat_timer_t
+{
+   STAT_TIMER_READ,         //!< fread of blk file data
+   STAT_TIMER_DESERIALIZE,  //!< block deserialization, without read
+   STAT_TIMER_SOLVE,        //!< script solving
+   STAT_TIMER_ENCODE,       //!< address encoding
+   STAT_TIMER_WRITE,        //!< write(2) calls of the output writer thread
+   STAT_TIMER_COUNT
+};
+
+enum stat_gauge_t
+{
+   STAT_GAUGE_BLK_FILE,         //!< index of the blk file being parsed
+   STAT_GAUGE_LAST_BLOCK_TIME,  //!< header time of the last parsed block
+   STAT_GAUGE_WRITE_QUEUE_DEPTH, //!< output buffers waiting for the writer thread
+   STAT_GAUGE_COUNT
+};
+
+static const char* stat_timer_names[STAT_TIMER_COUNT] = {
+   "read", "deserialize", "solve", "encode", "write"
+};
+
+struct parse_stats_t
+{
+   std::atomic<uint64_t> counters[STAT_COUNTER_COUNT] = {};
+   std::atomic<uint64_t> addresses[btc_utils::TX_TYPE_COUNT] = {};
+   std::atomic<uint64_t> timer_ns[STAT_TIMER_COUNT] = {};
+   std::atomic<uint64_t> gauges[STAT_GAUGE_COUNT] = {};
+};
+
+inline parse_stats_t g_parse_stats;
+
+inline void stat_add(stat_counter_t counter, uint64_t n)
+{
+   if constexpr (parse_stats_enabled)
+      g_parse_stats.counters[counter].fetch_add(n, std::memory_order_relaxed);
+}
+
+inline void stat_add_addresses(btc_utils::txnouttype type, uint64_t n)
+{
+   if constexpr (parse_stats_enabled)
+      g_parse_stats.addresses[type].fetch_add(n, std::memory_order_relaxed);
+}
+
+inline void stat_set(stat_gauge_t gauge, uint64_t value)
+{
+   if constexpr (parse_stats_enabled)
+      g_parse_stats.gauges[gauge].store(value, std::memory_order_relaxed);
+}
+
+inline uint64_t stat_get(stat_counter_t counter)
+{
+   return g_parse_stats.counters[counter].load(std::memory_order_relaxed);
+}
+
+inline uint64_t stat_timer_get(stat_timer_t timer)
+{
+   return g_parse_stats.timer_ns[timer].load(std::memory_order_relaxed);
+}
+
+inline uint64_t stat_gauge_get(stat_gauge_t gauge)
+{
+   return g_parse_stats.gauges[gauge].load(std::memory_order_relaxed);
+}
+
+inline uint64_t stat_addresses_get(btc_utils::txnouttype type)
+{
+   return g_parse_stats.addresses[type].load(std::memory_order_relaxed);
+}
+
+/** Adds the wall time of its scope to a stage timer. Time that another stage
+ *  spent inside the scope on the same thread (read inside deserialize) can be
+ *  excluded by passing that stage as the second argument.
+ */
+class stage_timer_t
+{
+private:
+   typedef std::chrono::steady_clock clock_t;
+
+   stat_timer_t timer_;
+   stat_timer_t excluded_;
+   clock_t::time_point start_;
+   uint64_t excluded_start_;
+
+public:
+   explicit stage_timer_t(stat_timer_t timer, stat_timer_t excluded = STAT_TIMER_COUNT) :
+      timer_(timer), excluded_(excluded), excluded_start_(0)
+   {
+      if constexpr (parse_stats_enabled)
+      {
+         if (excluded_ != STAT_TIMER_COUNT)
+            excluded_start_ = stat_timer_get(excluded_);
+         start_ = clock_t::now();
+      }
+   }
+
+   ~stage_timer_t()
+   {
+      if constexpr (parse_stats_enabled)
+      {
+         auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock_t::now() - start_).count();
+         uint64_t ns = static_cast<uint64_t>(elapsed);
+         if (excluded_ != STAT_TIMER_COUNT)
+         {
+            uint64_t excluded = stat_timer_get(excluded_) - excluded_start_;
+            ns = ns > excluded ? ns - excluded : 0;
+         }
+         g_parse_stats.timer_ns[timer_].fetch_add(ns, std::memory_order_relaxed);
+      }
+   }
+
+   stage_timer_t(const stage_timer_t&) = delete;
+   stage_timer_t& operator=(const stage_timer_t&) = delete;
+};
+
+/** Formats progress lines at a fixed interval: totals, rates since the start
+ *  and the ETA extrapolated from the blk bytes that are still to be read.
+ */
+class progress_reporter_t
+{
+private:
+   typedef std::chrono::steady_clock clock_t;
+
+   std::chrono::seconds interval_;
+   uint64_t total_bytes_;
+   clock_t::time_point start_;
+   clock_t::time_point next_;
+
+public:
+   //! interval of zero disables periodic reports
+   progress_reporter_t(std::chrono::seconds interval, uint64_t total_bytes) :
+      interval_(interval), total_bytes_(total_bytes), start_(clock_t::now()), next_(start_ + interval) {}
+
+   //! bytes left to read at the start, when only some of the blk file bytes are parsed
+   void set_total_bytes(uint64_t total_bytes) { total_bytes_ = total_bytes; }
+
+   //! returns true and fills line when the next report is due
+   bool due(std::string& line)
+   {
+      if (!parse_stats_enabled || interval_.count() == 0)
+         return false;
+      clock_t::time_point now = clock_t::now();
+      if (now < next_)
+         return false;
+      next_ = now + interval_;
+      line = progress(now);
+      return true;
+   }
+
+   std::string progress(clock_t::time_point now = clock_t::now()) const
+   {
+      double elapsed = std::chrono::duration<double>(now - start_).count();
+      if (elapsed <= 0)
+         elapsed = 1e-9;
+      uint64_t bytes = stat_get(STAT_BYTES_READ);
+      uint64_t blocks = stat_get(STAT_BLOCKS);
+      uint64_t addresses = stat_get(STAT_ADDRESSES);
+      double bytes_per_sec = static_cast<double>(bytes) / elapsed;
+      std::string eta = "unknown";
+      if (bytes_per_sec > 0 && total_bytes_ >= bytes)
+      {
+         uint64_t left = static_cast<uint64_t>(static_cast<double>(total_bytes_ - bytes) / bytes_per_sec);
+         eta = strprintf("%02u:%02u:%02u", left / 3600, left / 60 % 60, left % 60);
+      }
+      std::string line = strprintf("%u blocks, %u txs, %u addresses, %.1f MB/s, %.1f blocks/s, %.0f addresses/s, ETA %s",
+                                   blocks, stat_get(STAT_TXS), addresses, bytes_per_sec / 1e6,
+                                   static_cast<double>(blocks) / elapsed, static_cast<double>(addresses) / elapsed, eta);
+      return line;
+   }
+
+   //! per-stage times
+   static std::string summary()
+   {
+      std::string line = strprintf("records %u, skipped %u bytes;", stat_get(STAT_RECORDS), stat_get(STAT_SKIPPED_BYTES));
+      for (int i = 0; i < STAT_TIMER_COUNT; i++)
+         line += strprintf(" %s %.3fs", stat_timer_names[i],
+                           static_cast<double>(stat_timer_get(static_cast<stat_timer_t>(i))) / 1e9);
+      return line;
+   }
+
+   //! per-type address counts, wrapped into lines short enough for a log message
+   static std::vector<std::string> type_summary()
+   {
+      std::vector<std::string> lines(1, "addresses:");
+      for (unsigned int i = 0; i < btc_utils::TX_TYPE_COUNT; i++)
+      {
+         uint64_t n = stat_addresses_get(static_cast<btc_utils::txnouttype>(i));
+         if (!n)
+            continue;
+         std::string item = strprintf(" %s %u", btc_utils::get_txn_output_type(static_cast<btc_utils::txnouttype>(i)), n);
+         if (lines.back().size() + item.size() > 200)
+            lines.push_back("addresses:");
+         lines.back() += item;
+      }
+      return lines;
+   }
+};
+
+#endif // ADDR_PARSER_STATS_H__
@@ -0,0 +1,697 @@
+// Copyright (c) 2020 gladcow
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Writes synthetic blkNNNNN.dat files framed the same way bitcoind stores
+// blocks on disk: message start, 32-bit little endian size, serialized block.
+// The blocks are chained, have correct merkle roots and contain a
+// configurable mix of output script types, so the parser can be benchmarked
+// and regression-tested without a full node.
+
+#include <block.h>
+#include <chainparams.h>
+#include <crypto.h>
+#include <script.h>
+#include <serialize.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace btc_utils;
+
+/** Output script types the generator can produce */
+enum gen_script_t
+{
+   GEN_P2PK,
+   GEN_P2PKH,
+   GEN_P2SH,
+   GEN_P2WPKH,
+   GEN_P2WSH,
+   GEN_P2TR,
+   GEN_WITNESS_UNKNOWN,
+   GEN_MULTISIG,
+   GEN_OP_RETURN,
+   GEN_SCRIPT_COUNT
+};
+
+static const char* gen_script_names[GEN_SCRIPT_COUNT] = {
+   "p2pk", "p2pkh", "p2sh", "p2wpkh", "p2wsh", "p2tr", "unknown", "multisig", "opreturn"
+};
+
+struct gen_options_t
+{
+   network_t network = network_t::regtest;
+   std::string out_dir = ".";
+   uint32_t blocks = 1000;
+   uint32_t txs_per_block = 100;
+   double segwit_ratio = 0.5;
+   std::array<double, GEN_SCRIPT_COUNT> mix = {{1, 4, 2, 4, 1, 2, 1, 1, 1}};
+   uint64_t max_file_size = 128 * 1024 * 1024;
+   double corrupt_ratio = 0;
+   double padding_ratio = 0;
+   double duplicate_ratio = 0;
+   double reuse_ratio = 0;
+   double inscription_ratio = 0;
+   uint64_t seed = 1;
+};
+
+struct gen_stats_t
+{
+   uint64_t blocks = 0;
+   uint64_t txs = 0;
+   uint64_t corrupted = 0;
+   uint64_t duplicates = 0;
+   uint64_t padding_bytes = 0;
+   uint64_t reused = 0;
+   uint64_t inscriptions = 0;
+   std::array<uint64_t, GEN_SCRIPT_COUNT> outputs = {};
+   uint64_t intact_outputs = 0;  //!< outputs of the records written undamaged, once per copy
+};
+
+class generator_t
+{
+private:
+   const gen_options_t& opts_;
+   std::mt19937_64 rng_;
+   std::discrete_distribution<int> mix_;
+   gen_stats_t stats_;
+   uint64_t block_outputs_ = 0;  //!< outputs of the last block made
+   //! scripts of busy services that outputs are paid to again, with their types
+   std::vector<std::pair<gen_script_t, std::vector<unsigned char>>> hot_;
+
+   static const size_t HOT_SCRIPT_COUNT = 1000;
+
+   std::vector<unsigned char> bytes(size_t n)
+   {
+      std::vector<unsigned char> res(n);
+      for (auto& c: res)
+         c = static_cast<unsigned char>(rng_());
+      return res;
+   }
+
+   bool chance(double ratio)
+   {
+      return std::uniform_real_distribution<double>(0, 1)(rng_) < ratio;
+   }
+
+   std::vector<unsigned char> pubkey(bool compressed)
+   {
+      std::vector<unsigned char> res = bytes(compressed ? 33 : 65);
+      res[0] = compressed ? static_cast<unsigned char>(2 + rng_() % 2) : 4;
+      return res;
+   }
+
+   //! random bytes shaped like a DER signature with SIGHASH_ALL
+   std::vector<unsigned char> signature()
+   {
+      std::vector<unsigned char> res = bytes(71);
+      res[0] = 0x30;
+      res[1] = static_cast<unsigned char>(res.size() - 3);
+      res.back() = 0x01;
+      return res;
+   }
+
+   static void append(std::vector<unsigned char>& v, std::initializer_list<unsigned char> data)
+   {
+      v.insert(v.end(), data);
+   }
+
+   static void append(std::vector<unsigned char>& v, const std::vector<unsigned char>& data)
+   {
+      v.insert(v.end(), data.begin(), data.end());
+   }
+
+   std::vector<unsigned char> make_script(gen_script_t type)
+   {
+      std::vector<unsigned char> s;
+      switch (type)
+      {
+         case GEN_P2PK:
+         {
+            std::vector<unsigned char> key = pubkey(chance(0.5));
+            append(s, {static_cast<unsigned char>(key.size())});
+            append(s, key);
+            append(s, {0xac});
+            break;
+         }
+         case GEN_P2PKH:
+            append(s, {0x76, 0xa9, 0x14});
+            append(s, bytes(20));
+            append(s, {0x88, 0xac});
+            break;
+         case GEN_P2SH:
+            append(s, {0xa9, 0x14});
+            append(s, bytes(20));
+            append(s, {0x87});
+            break;
+         case GEN_P2WPKH:
+            append(s, {0x00, 0x14});
+            append(s, bytes(20));
+            break;
+         case GEN_P2WSH:
+            append(s, {0x00, 0x20});
+            append(s, bytes(32));
+            break;
+         case GEN_P2TR:
+            append(s, {0x51, 0x20});
+            append(s, bytes(32));
+            break;
+         case GEN_WITNESS_UNKNOWN:
+         {
+            // any version and length but the taproot one
+            unsigned char version = static_cast<unsigned char>(1 + rng_() % 16);
+            size_t length = 2 + rng_() % 39;
+            if (version == 1 && length == 32)
+               length = 33;
+            append(s, {static_cast<unsigned char>(0x50 + version), static_cast<unsigned char>(length)});
+            append(s, bytes(length));
+            break;
+         }
+         case GEN_MULTISIG:
+         {
+            // bare m-of-n, 1-of-3 like the data carrying outputs of 2014-2015 most often
+            unsigned int n = chance(0.5) ? 3 : 1 + static_cast<unsigned int>(rng_() % 3);
+            unsigned int m = n == 3 && chance(0.7) ? 1 : 1 + static_cast<unsigned int>(rng_() % n);
+            append(s, {static_cast<unsigned char>(OP_1 + m - 1)});
+            for (unsigned int i = 0; i < n; i++)
+            {
+               std::vector<unsigned char> key = pubkey(chance(0.7));
+               append(s, {static_cast<unsigned char>(key.size())});
+               append(s, key);
+            }
+            append(s, {static_cast<unsigned char>(OP_1 + n - 1), OP_CHECKMULTISIG});
+            break;
+         }
+         case GEN_OP_RETURN:
+         {
+            // half of the payloads carry a protocol marker of addr_parser -N: runes, omni, witness commitment
+            static const std::vector<unsigned char> markers[] = {{'o', 'm', 'n', 'i'}, {0xaa, 0x21, 0xa9, 0xed}};
+            append(s, {OP_RETURN});
+            bool tagged = chance(0.5);
+            if (tagged && chance(0.3))
+               append(s, {OP_13});
+            std::vector<unsigned char> data = bytes(rng_() % 81);
+            if (tagged && s.size() == 1)
+            {
+               const std::vector<unsigned char>& marker = markers[rng_() % 2];
+               data.insert(data.begin(), marker.begin(), marker.end());
+               data.resize(std::min<size_t>(data.size(), 80));
+            }
+            if (data.size() >= OP_PUSHDATA1)
+               append(s, {OP_PUSHDATA1});
+            append(s, {static_cast<unsigned char>(data.size())});
+            append(s, data);
+            break;
+         }
+         default:
+            break;
+      }
+      stats_.outputs[type]++;
+      return s;
+   }
+
+   void add_outputs(transaction_t& tx, size_t count)
+   {
+      tx.vout.resize(count);
+      for (auto& out: tx.vout)
+      {
+         out.nValue = rng_() % 2100000000000000ull;
+         if (opts_.reuse_ratio > 0 && !hot_.empty() && chance(opts_.reuse_ratio))
+         {
+            const auto& hot = hot_[rng_() % hot_.size()];
+            stats_.outputs[hot.first]++;
+            stats_.reused++;
+            out.scriptPubKey.assign(hot.second.begin(), hot.second.end());
+            continue;
+         }
+         gen_script_t type = static_cast<gen_script_t>(mix_(rng_));
+         std::vector<unsigned char> script = make_script(type);
+         out.scriptPubKey.assign(script.begin(), script.end());
+         // the set of busy services changes slowly
+         if (opts_.reuse_ratio > 0 && hot_.size() < HOT_SCRIPT_COUNT)
+            hot_.emplace_back(type, std::move(script));
+         else if (opts_.reuse_ratio > 0 && chance(0.01))
+            hot_[rng_() % hot_.size()] = std::make_pair(type, std::move(script));
+      }
+   }
+
+   transaction_t make_coinbase(uint32_t height)
+   {
+      transaction_t tx;
+      tx.nVersion = 1;
+      tx.nLockTime = 0;
+      tx.vin.resize(1);
+      tx_in_t& in = tx.vin[0];
+      in.prevout.hash.fill(0);
+      in.prevout.n = 0xffffffff;
+      in.nSequence = 0xffffffff;
+      // BIP34 height as a minimal script number, extra nonce bytes and mostly a pool tag
+      static const char* pool_tags[] = {"Foundry USA Pool #dropgold/", "/ViaBTC/Mined by x/", "/AntPool/", "F2Pool"};
+      std::vector<unsigned char> sig;
+      if (height >= 1 && height <= 16)
+         sig.push_back(static_cast<unsigned char>(OP_1 + height - 1));
+      else
+      {
+         std::vector<unsigned char> num;
+         for (uint32_t h = height; h; h >>= 8)
+            num.push_back(static_cast<unsigned char>(h));
+         if (num.empty() || (num.back() & 0x80))
+            num.push_back(0);
+         sig.push_back(static_cast<unsigned char>(num.size()));
+         append(sig, num);
+      }
+      append(sig, {8});
+      append(sig, bytes(8));
+      if (chance(0.8))
+      {
+         std::string tag = pool_tags[rng_() % 4];
+         sig.insert(sig.end(), tag.begin(), tag.end());
+      }
+      in.scriptSig.assign(sig.begin(), sig.end());
+      add_outputs(tx, 1 + rng_() % 2);
+      return tx;
+   }
+
+   std::vector<unsigned char> control_block()
+   {
+      std::vector<unsigned char> res = {0xc0};
+      append(res, bytes(32));
+      return res;
+   }
+
+   //! <key> OP_CHECKSIG OP_FALSE OP_IF "ord" 1 <content type> OP_0 <body>... OP_ENDIF
+   std::vector<unsigned char> inscription_script()
+   {
+      static const std::string content_types[] = {"text/plain;charset=utf-8", "image/png", "application/json"};
+      std::vector<unsigned char> s = {32};
+      append(s, bytes(32));
+      append(s, {OP_CHECKSIG, OP_FALSE, OP_IF, 3, 'o', 'r', 'd', 1, 1});
+      const std::string& content_type = content_types[rng_() % 3];
+      s.push_back(static_cast<unsigned char>(content_type.size()));
+      s.insert(s.end(), content_type.begin(), content_type.end());
+      s.push_back(OP_0);
+      // chunks of at most 520 bytes, the push limit
+      for (size_t body = 1 + rng_() % 2000; body; )
+      {
+         size_t chunk = std::min<size_t>(body, 520);
+         if (chunk < OP_PUSHDATA1)
+            s.push_back(static_cast<unsigned char>(chunk));
+         else if (chunk <= 0xff)
+            append(s, {OP_PUSHDATA1, static_cast<unsigned char>(chunk)});
+         else
+            append(s, {OP_PUSHDATA2, static_cast<unsigned char>(chunk), static_cast<unsigned char>(chunk >> 8)});
+         append(s, bytes(chunk));
+         body -= chunk;
+      }
+      s.push_back(OP_ENDIF);
+      return s;
+   }
+
+   transaction_t make_tx()
+   {
+      transaction_t tx;
+      bool segwit = chance(opts_.segwit_ratio);
+      tx.nVersion = segwit ? 2 : 1;
+      tx.nLockTime = 0;
+      tx.vin.resize(1 + rng_() % 3);
+      for (auto& in: tx.vin)
+      {
+         std::vector<unsigned char> h = bytes(32);
+         std::copy(h.begin(), h.end(), in.prevout.hash.begin());
+         in.prevout.n = static_cast<uint32_t>(rng_() % 4);
+         in.nSequence = 0xfffffffe;
+         std::vector<unsigned char> sig = signature();
+         std::vector<unsigned char> key = pubkey(true);
+         if (segwit && &in == &tx.vin[0] && opts_.inscription_ratio > 0 && chance(opts_.inscription_ratio))
+         {
+            // taproot script path reveal: signature, tapscript with the envelope, control block
+            std::vector<unsigned char> schnorr = bytes(64);
+            std::vector<unsigned char> control = control_block();
+            std::vector<unsigned char> script = inscription_script();
+            in.scriptWitness.emplace_back(schnorr.begin(), schnorr.end());
+            in.scriptWitness.emplace_back(script.begin(), script.end());
+            in.scriptWitness.emplace_back(control.begin(), control.end());
+            stats_.inscriptions++;
+         }
+         else if (segwit)
+         {
+            in.scriptWitness.emplace_back(sig.begin(), sig.end());
+            in.scriptWitness.emplace_back(key.begin(), key.end());
+         }
+         else
+         {
+            std::vector<unsigned char> script = {static_cast<unsigned char>(sig.size())};
+            append(script, sig);
+            append(script, {static_cast<unsigned char>(key.size())});
+            append(script, key);
+            in.scriptSig.assign(script.begin(), script.end());
+         }
+      }
+      add_outputs(tx, 1 + rng_() % 4);
+      return tx;
+   }
+
+   static uint256_t hash_sha256d(const std::vector<unsigned char>& data)
+   {
+      uint256_t h = hash_sha256(data);
+      return hash_sha256(std::vector<unsigned char>(h.begin(), h.end()));
+   }
+
+   static uint256_t merkle_root(const block_t& block)
+   {
+      std::vector<uint256_t> level;
+      for (const auto& tx: block.txes_)
+      {
+         std::vector<unsigned char> data;
+         vector_writer_t writer(data);
+         tx.serialize(writer, false);
+         level.push_back(hash_sha256d(data));
+      }
+      while (level.size() > 1)
+      {
+         if (level.size() % 2)
+            level.push_back(level.back());
+         std::vector<uint256_t> next;
+         for (size_t i = 0; i < level.size(); i += 2)
+         {
+            std::vector<unsigned char> pair(level[i].begin(), level[i].end());
+            pair.insert(pair.end(), level[i + 1].begin(), level[i + 1].end());
+            next.push_back(hash_sha256d(pair));
+         }
+         level.swap(next);
+      }
+      return level.empty() ? uint256_t() : level[0];
+   }
+
+public:
+   explicit generator_t(const gen_options_t& opts) :
+      opts_(opts), rng_(opts.seed), mix_(opts.mix.begin(), opts.mix.end()) {}
+
+   const gen_stats_t& stats() const { return stats_; }
+
+   /** Serialized block at the given height, its hash is returned in hash */
+   std::vector<unsigned char> make_block(uint32_t height, const uint256_t& prev, uint256_t& hash)
+   {
+      uint64_t outputs = std::accumulate(stats_.outputs.begin(), stats_.outputs.end(), uint64_t(0));
+      block_t block;
+      block.version_ = 0x20000000;
+      block.prev_block_hash_ = prev;
+      block.time_ = 1296688602 + height * 600;
+      block.bits_ = 0x207fffff;
+      block.nonce_ = static_cast<uint32_t>(rng_());
+      block.txes_.push_back(make_coinbase(height));
+      for (uint32_t i = 1; i < opts_.txs_per_block; i++)
+         block.txes_.push_back(make_tx());
+      block.merkle_root_ = merkle_root(block);
+      stats_.blocks++;
+      stats_.txs += block.txes_.size();
+      block_outputs_ = std::accumulate(stats_.outputs.begin(), stats_.outputs.end(), uint64_t(0)) - outputs;
+
+      std::vector<unsigned char> data;
+      vector_writer_t writer(data);
+      writer << block;
+      hash = hash_sha256d(std::vector<unsigned char>(data.begin(), data.begin() + 80));
+      return data;
+   }
+
+   /** Damage a record so that it fails to deserialize or parses as garbage */
+   void corrupt(std::vector<unsigned char>& data)
+   {
+      stats_.corrupted++;
+      size_t count = 1 + rng_() % 16;
+      for (size_t i = 0; i < count; i++)
+         data[80 + rng_() % (data.size() - 80)] ^= static_cast<unsigned char>(1 + rng_() % 255);
+   }
+
+   bool should_corrupt() { return chance(opts_.corrupt_ratio); }
+   //! counts the outputs of the last block made for each of copies undamaged records of it
+   void count_intact(unsigned int copies) { stats_.intact_outputs += block_outputs_ * copies; }
+   bool should_duplicate()
+   {
+      bool res = chance(opts_.duplicate_ratio);
+      if (res)
+         stats_.duplicates++;
+      return res;
+   }
+   size_t padding()
+   {
+      if (!chance(opts_.padding_ratio))
+         return 0;
+      size_t res = 1 + rng_() % 4096;
+      stats_.padding_bytes += res;
+      return res;
+   }
+};
+
+/** Writes records to blkNNNNN.dat files, starting a new file when the current one is full */
+class blk_writer_t
+{
+private:
+   const gen_options_t& opts_;
+   const unsigned char* magic_;
+   FILE* file_;
+   std::string path_;
+   uint32_t index_;
+   uint64_t size_;
+
+   void open_next()
+   {
+      close();
+      char name[16];
+      snprintf(name, sizeof(name), "blk%05u.dat", index_++);
+      path_ = opts_.out_dir;
+      if (!path_.empty() && path_.back() != '/')
+         path_ += '/';
+      path_ += name;
+      file_ = fopen(path_.c_str(), "wb");
+      if (!file_)
+         throw std::runtime_error("Unable to create file " + path_);
+      size_ = 0;
+   }
+
+   //! a short write, e.g. on a full disk, would leave a truncated record
+   void write(const unsigned char* data, size_t size)
+   {
+      if (fwrite(data, 1, size, file_) != size)
+         throw std::runtime_error("Unable to write to " + path_ + ": " + strerror(errno));
+   }
+
+public:
+   blk_writer_t(const gen_options_t& opts, const unsigned char* magic) :
+      opts_(opts), magic_(magic), file_(nullptr), index_(0), size_(0) {}
+
+   ~blk_writer_t()
+   {
+      if (file_)
+         fclose(file_);
+   }
+
+   // Disallow copies
+   blk_writer_t(const blk_writer_t&) = delete;
+   blk_writer_t& operator=(const blk_writer_t&) = delete;
+
+   //! throws std::runtime_error if the buffered data can't be written
+   void close()
+   {
+      if (file_) {
+         FILE* file = file_;
+         file_ = nullptr;
+         if (fclose(file) != 0)
+            throw std::runtime_error("Unable to write to " + path_ + ": " + strerror(errno));
+      }
+   }
+
+   void write_record(const std::vector<unsigned char>& block)
+   {
+      uint64_t record_size = MESSAGE_START_SIZE + 4 + block.size();
+      if (!file_ || (size_ > 0 && size_ + record_size > opts_.max_file_size))
+         open_next();
+      std::vector<unsigned char> header(magic_, magic_ + MESSAGE_START_SIZE);
+      vector_writer_t writer(header);
+      writer.writedata32(static_cast<uint32_t>(block.size()));
+      write(header.data(), header.size());
+      write(block.data(), block.size());
+      size_ += record_size;
+   }
+
+   void write_padding(size_t count)
+   {
+      if (!file_ || !count)
+         return;
+      std::vector<unsigned char> zeroes(count, 0);
+      write(zeroes.data(), zeroes.size());
+      size_ += count;
+   }
+
+   uint32_t files() const { return index_; }
+};
+
+static bool parse_mix(const std::string& spec, std::array<double, GEN_SCRIPT_COUNT>& mix)
+{
+   mix.fill(0);
+   std::stringstream ss(spec);
+   std::string item;
+   while (std::getline(ss, item, ','))
+   {
+      size_t eq = item.find('=');
+      if (eq == std::string::npos)
+         return false;
+      std::string name = item.substr(0, eq);
+      auto it = std::find_if(std::begin(gen_script_names), std::end(gen_script_names),
+                             [&name](const char* n) { return name == n; });
+      if (it == std::end(gen_script_names))
+         return false;
+      mix[static_cast<size_t>(it - std::begin(gen_script_names))] = atof(item.c_str() + eq + 1);
+   }
+   return std::any_of(mix.begin(), mix.end(), [](double w) { return w > 0; });
+}
+
+void print_usage()
+{
+   std::cout << "Usage:" << std::endl;
+   std::cout << "blk_gen [-m|-t|-r|-s] [-o out_dir] [-n blocks] [-x txs_per_block] [-w segwit_ratio] [-k mix]" << std::endl;
+   std::cout << "        [-f max_file_size] [-c corrupt_ratio] [-z padding_ratio] [-d duplicate_ratio] [-a reuse_ratio]" << std::endl;
+   std::cout << "        [-i inscription_ratio] [-S seed]" << std::endl;
+   std::cout << "where" << std::endl;
+   std::cout << "-m|-t|-r|-s - network whose message start frames the records, regtest by default" << std::endl;
+   std::cout << "out_dir - directory for the blkNNNNN.dat files, default value is current directory" << std::endl;
+   std::cout << "blocks - number of blocks, default 1000" << std::endl;
+   std::cout << "txs_per_block - transactions per block including coinbase, default 100" << std::endl;
+   std::cout << "segwit_ratio - share of transactions with witness data, default 0.5" << std::endl;
+   std::cout << "mix - output type weights, e.g. p2pk=1,p2pkh=4,p2sh=2,p2wpkh=4,p2wsh=1,p2tr=2,unknown=1,multisig=1," << std::endl;
+   std::cout << "        opreturn=1 (the default)" << std::endl;
+   std::cout << "max_file_size - maximum size of one blk file in bytes, default 134217728" << std::endl;
+   std::cout << "corrupt_ratio - share of records with damaged bytes, default 0" << std::endl;
+   std::cout << "padding_ratio - share of records followed by zero padding, default 0" << std::endl;
+   std::cout << "duplicate_ratio - share of records written twice, default 0" << std::endl;
+   std::cout << "reuse_ratio - share of outputs paid to one of 1000 busy scripts, default 0" << std::endl;
+   std::cout << "inscription_ratio - share of segwit transactions revealing an inscription, default 0" << std::endl;
+   std::cout << "seed - random seed, default 1" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+   gen_options_t opts;
+   int c;
+   while ((c = getopt(argc, argv, "mtrso:n:x:w:k:f:c:z:d:a:i:S:?")) != -1)
+   {
+      switch (c)
+      {
+         case 'm':
+            opts.network = network_t::mainnet;
+            break;
+         case 't':
+            opts.network = network_t::testnet;
+            break;
+         case 'r':
+            opts.network = network_t::regtest;
+            break;
+         case 's':
+            opts.network = network_t::signet;
+            break;
+         case 'o':
+            opts.out_dir = optarg;
+            break;
+         case 'n':
+            opts.blocks = static_cast<uint32_t>(strtoul(optarg, nullptr, 10));
+            break;
+         case 'x':
+            opts.txs_per_block = std::max<uint32_t>(1, static_cast<uint32_t>(strtoul(optarg, nullptr, 10)));
+            break;
+         case 'w':
+            opts.segwit_ratio = atof(optarg);
+            break;
+         case 'k':
+            if (!parse_mix(optarg, opts.mix))
+            {
+               std::cout << "Invalid output mix " << optarg << std::endl;
+               print_usage();
+               return 1;
+            }
+            break;
+         case 'f':
+            opts.max_file_size = strtoull(optarg, nullptr, 10);
+            break;
+         case 'c':
+            opts.corrupt_ratio = atof(optarg);
+            break;
+         case 'z':
+            opts.padding_ratio = atof(optarg);
+            break;
+         case 'd':
+            opts.duplicate_ratio = atof(optarg);
+            break;
+         case 'a':
+            opts.reuse_ratio = atof(optarg);
+            break;
+         case 'i':
+            opts.inscription_ratio = atof(optarg);
+            break;
+         case 'S':
+            opts.seed = strtoull(optarg, nullptr, 10);
+            break;
+         default:
+            print_usage();
+            return 1;
+      }
+   }
+   if (optind < argc)
+   {
+      print_usage();
+      return 1;
+   }
+
+   try {
+      generator_t gen(opts);
+      const unsigned char* magic = visit_chain_params(opts.network, [](auto params) {
+         return static_cast<const unsigned char*>(decltype(params)::message_start);
+      });
+      blk_writer_t writer(opts, magic);
+      uint256_t prev;
+      prev.fill(0);
+      for (uint32_t height = 0; height < opts.blocks; height++)
+      {
+         uint256_t hash;
+         std::vector<unsigned char> block = gen.make_block(height, prev, hash);
+         prev = hash;
+         bool duplicate = gen.should_duplicate();
+         if (gen.should_corrupt())
+            gen.corrupt(block);
+         else
+            gen.count_intact(duplicate ? 2 : 1);
+         writer.write_record(block);
+         if (duplicate)
+            writer.write_record(block);
+         writer.write_padding(gen.padding());
+      }
+      writer.close();
+
+      const gen_stats_t& stats = gen.stats();
+      std::cout << "files: " << writer.files() << std::endl;
+      std::cout << "blocks: " << stats.blocks << std::endl;
+      std::cout << "txs: " << stats.txs << std::endl;
+      std::cout << "corrupted: " << stats.corrupted << std::endl;
+      std::cout << "duplicates: " << stats.duplicates << std::endl;
+      std::cout << "padding_bytes: " << stats.padding_bytes << std::endl;
+      std::cout << "reused: " << stats.reused << std::endl;
+      std::cout << "inscriptions: " << stats.inscriptions << std::endl;
+      for (size_t i = 0; i < GEN_SCRIPT_COUNT; i++)
+         std::cout << "outputs_" << gen_script_names[i] << ": " << stats.outputs[i] << std::endl;
+      std::cout << "intact_outputs: " << stats.intact_outputs << std::endl;
+   } catch (const std::exception& e) {
+      std::cout << "Error: " << e.what() << std::endl;
+      return 1;
+   }
+   return 0;
+}
@@ -0,0 +1,52 @@
+# Generates a few damaged blk files and checks that addr_parser finds
+# the addresses of the intact blocks in them.
+file(REMOVE_RECURSE ${WORK_DIR})
+file(MAKE_DIRECTORY ${WORK_DIR})
+execute_process(COMMAND ${BLK_GEN} -r -o ${WORK_DIR} -n 200 -x 20 -f 200000
+                        -k p2pkh=1 -c 0.05 -z 0.1 -d 0.05 -S 7
+                RESULT_VARIABLE res OUTPUT_VARIABLE stats)
+if(NOT res EQUAL 0)
+    message(FATAL_ERROR "blk_gen failed")
+endif()
+execute_process(COMMAND ${ADDR_PARSER} -r -p ${WORK_DIR} -o ${WORK_DIR}/addresses.txt
+                RESULT_VARIABLE res OUTPUT_QUIET)
+if(NOT res EQUAL 0)
+    message(FATAL_ERROR "addr_parser failed")
+endif()
+file(STRINGS ${WORK_DIR}/addresses.txt addresses)
+list(LENGTH addresses count)
+# every P2PKH output of an undamaged record, duplicates included, is one
+# address line; damaged records may still parse and add a few more
+string(REGEX MATCH "intact_outputs: ([0-9]+)" match "${stats}")
+if(NOT match)
+    message(FATAL_ERROR "blk_gen printed no intact_outputs")
+endif()
+set(expected ${CMAKE_MATCH_1})
+if(count LESS expected)
+    message(FATAL_ERROR "too few addresses parsed: ${count}, expected at least ${expected}")
+endif()
+
+# Inscriptions: one in every transaction, about 29 MB in a single blk file,
+# so witness items straddle the end of addr_parser's 8 MB read buffer and
+# are copied out instead of being scanned in place.
+file(MAKE_DIRECTORY ${WORK_DIR}/inscriptions)
+execute_process(COMMAND ${BLK_GEN} -r -o ${WORK_DIR}/inscriptions -n 200 -x 100 -w 1 -i 1 -S 3
+                RESULT_VARIABLE res OUTPUT_VARIABLE stats)
+if(NOT res EQUAL 0)
+    message(FATAL_ERROR "blk_gen -i failed")
+endif()
+execute_process(COMMAND ${ADDR_PARSER} -r -E -p ${WORK_DIR}/inscriptions -o ${WORK_DIR}/inscriptions/addresses.txt
+                RESULT_VARIABLE res OUTPUT_QUIET)
+if(NOT res EQUAL 0)
+    message(FATAL_ERROR "addr_parser -E failed")
+endif()
+file(STRINGS ${WORK_DIR}/inscriptions/addresses.txt lines REGEX "^inscription:")
+list(LENGTH lines count)
+string(REGEX MATCH "inscriptions: ([0-9]+)" match "${stats}")
+if(NOT match)
+    message(FATAL_ERROR "blk_gen printed no inscriptions")
+endif()
+if(NOT count EQUAL CMAKE_MATCH_1)
+    message(FATAL_ERROR "${count} inscriptions parsed, ${CMAKE_MATCH_1} generated")
+endif()
+file(REMOVE_RECURSE ${WORK_DIR}/inscriptions)
@@ -10,57 +10,195 @@
 namespace btc_utils
 {
 
+static std::string encode_base58_hash(unsigned char prefix, const uint160_t& hash)
+{
+   std::array<unsigned char, 21> data;
+   data[0] = prefix;
+   std::copy(hash.begin(), hash.end(), data.begin() + 1);
+   return encode_base58_check(data);
+}
+
+//! bech32 for witness version 0, bech32m for the later ones (BIP 350)
+static std::string encode_witness_program(const char* hrp, unsigned int version,
+                                          const unsigned char* begin, const unsigned char* end)
+{
+   // the version and up to 40 bytes in 5-bit groups
+   std::array<uint8_t, 65> data;
+   size_t size = 0;
+   data[size++] = static_cast<uint8_t>(version);
+   ConvertBits<8, 5, true>(
+            [&data, &size](unsigned char c) { data[size++] = c; },
+            begin, end);
+   return bech32::Encode(version == 0 ? bech32::Encoding::BECH32 : bech32::Encoding::BECH32M, hrp, data.data(), size);
+}
+
+template<typename P>
 std::string encode_destination(const no_destination_t&)
 {
    return {};
 }
 
+template<typename P>
+std::string encode_destination(const pub_key_t& dest)
+{
+   return encode_base58_hash(P::base_58_pubkey_address_prefix, dest.get_id());
+}
+
+template<typename P>
 std::string encode_destination(const pk_hash_tx_destination_t& dest)
 {
-   std::vector<unsigned char> data = base_58_pubkey_address_prefix();
-   data.insert(data.end(), dest.data_.begin(), dest.data_.end());
-   return encode_base58_check(data);
+   return encode_base58_hash(P::base_58_pubkey_address_prefix, dest.data_);
 }
 
+template<typename P>
 std::string encode_destination(const script_hash_tx_destination_t& dest)
 {
-   std::vector<unsigned char> data = base_58_pubkey_address_prefix();
-   data.insert(data.end(), dest.data_.begin(), dest.data_.end());
-   return encode_base58_check(data);
+   return encode_base58_hash(P::base_58_script_address_prefix, dest.data_);
 }
 
+template<typename P>
 std::string encode_destination(const witness_v0_key_hash_tx_destination_t& dest)
 {
-   std::vector<unsigned char> data = {0};
-   data.reserve(33);
-   ConvertBits<8, 5, true>(
-            [&data](unsigned char c){ data.push_back(c); },
-            dest.data_.begin(), dest.data_.end()
-   );
-   return bech32::Encode(bech32_hrp(), data);
+   return encode_witness_program(P::bech32_hrp, 0, dest.data_.data(), dest.data_.data() + dest.data_.size());
 }
 
+template<typename P>
 std::string encode_destination(const witness_v0_script_hash_tx_destination_t& dest)
 {
-   std::vector<unsigned char> data = {0};
-   data.reserve(53);
-   ConvertBits<8, 5, true>(
-            [&data](unsigned char c) { data.push_back(c); },
-            dest.data_.begin(), dest.data_.end());
-   return bech32::Encode(bech32_hrp(), data);
+   return encode_witness_program(P::bech32_hrp, 0, dest.data_.data(), dest.data_.data() + dest.data_.size());
 }
 
+template<typename P>
+std::string encode_destination(const witness_v1_taproot_tx_destination_t& dest)
+{
+   return encode_witness_program(P::bech32_hrp, 1, dest.data_.data(), dest.data_.data() + dest.data_.size());
+}
+
+template<typename P>
 std::string encode_destination(const witness_unknown_tx_destination_t& dest)
 {
    if (dest.version_ < 1 || dest.version_ > 16 || dest.length_ < 2 || dest.length_ > 40) {
        return {};
    }
-   std::vector<unsigned char> data = {(unsigned char)dest.version_};
-   data.reserve(1 + (dest.length_ * 8 + 4) / 5);
-   ConvertBits<8, 5, true>(
-            [&data](unsigned char c) { data.push_back(c); },
-            dest.program_.data(), dest.program_.data() + dest.length_);
-   return bech32::Encode(bech32_hrp(), data);
+   return encode_witness_program(P::bech32_hrp, dest.version_, dest.program_.data(), dest.program_.data() + dest.length_);
+}
+
+template<typename P>
+tx_destination_t decode_destination(std::string_view str)
+{
+   std::array<unsigned char, 21> data;
+   if (decode_base58_check(str, data.data(), data.size())) {
+      uint160_t hash;
+      std::copy(data.begin() + 1, data.end(), hash.begin());
+      if (data[0] == P::base_58_pubkey_address_prefix)
+         return pk_hash_tx_destination_t(hash);
+      if (data[0] == P::base_58_script_address_prefix)
+         return script_hash_tx_destination_t(hash);
+      return no_destination_t();
+   }
+   unsigned int version;
+   std::array<unsigned char, 40> program;
+   size_t length;
+   if (!bech32::DecodeWitnessProgram(str, P::bech32_hrp, version, program.data(), length))
+      return no_destination_t();
+   if (version == 0) {
+      if (length == 20) {
+         uint160_t hash;
+         std::copy(program.begin(), program.begin() + 20, hash.begin());
+         return witness_v0_key_hash_tx_destination_t(hash);
+      }
+      if (length == 32) {
+         uint256_t hash;
+         std::copy(program.begin(), program.begin() + 32, hash.begin());
+         return witness_v0_script_hash_tx_destination_t(hash);
+      }
+      return no_destination_t();
+   }
+   if (version == 1 && length == 32) {
+      uint256_t key;
+      std::copy(program.begin(), program.begin() + 32, key.begin());
+      return witness_v1_taproot_tx_destination_t(key);
+   }
+   if (length < 2 || length > 40)
+      return no_destination_t();
+   witness_unknown_tx_destination_t unk;
+   unk.version_ = version;
+   unk.length_ = static_cast<unsigned int>(length);
+   std::copy(program.begin(), program.begin() + static_cast<long>(length), unk.program_.begin());
+   return unk;
+}
+
+#define INSTANTIATE_ENCODE_DESTINATION(N) \
+   template std::string encode_destination<chain_params<N>>(const no_destination_t&); \
+   template std::string encode_destination<chain_params<N>>(const pub_key_t&); \
+   template std::string encode_destination<chain_params<N>>(const pk_hash_tx_destination_t&); \
+   template std::string encode_destination<chain_params<N>>(const script_hash_tx_destination_t&); \
+   template std::string encode_destination<chain_params<N>>(const witness_v0_key_hash_tx_destination_t&); \
+   template std::string encode_destination<chain_params<N>>(const witness_v0_script_hash_tx_destination_t&); \
+   template std::string encode_destination<chain_params<N>>(const witness_v1_taproot_tx_destination_t&); \
+   template std::string encode_destination<chain_params<N>>(const witness_unknown_tx_destination_t&); \
+   template tx_destination_t decode_destination<chain_params<N>>(std::string_view);
+
+INSTANTIATE_ENCODE_DESTINATION(network_t::mainnet)
+INSTANTIATE_ENCODE_DESTINATION(network_t::testnet)
+INSTANTIATE_ENCODE_DESTINATION(network_t::regtest)
+INSTANTIATE_ENCODE_DESTINATION(network_t::signet)
+
+#undef INSTANTIATE_ENCODE_DESTINATION
+
+template<typename D>
+static std::string encode_for_current_network(const D& dest)
+{
+   return visit_chain_params(g_network, [&dest](auto params) {
+      return encode_destination<decltype(params)>(dest);
+   });
+}
+
+std::string encode_destination(const no_destination_t&)
+{
+   return {};
+}
+
+std::string encode_destination(const pub_key_t& dest)
+{
+   return encode_for_current_network(dest);
+}
+
+std::string encode_destination(const pk_hash_tx_destination_t& dest)
+{
+   return encode_for_current_network(dest);
+}
+
+std::string encode_destination(const script_hash_tx_destination_t& dest)
+{
+   return encode_for_current_network(dest);
+}
+
+std::string encode_destination(const witness_v0_key_hash_tx_destination_t& dest)
+{
+   return encode_for_current_network(dest);
+}
+
+std::string encode_destination(const witness_v0_script_hash_tx_destination_t& dest)
+{
+   return encode_for_current_network(dest);
+}
+
+std::string encode_destination(const witness_v1_taproot_tx_destination_t& dest)
+{
+   return encode_for_current_network(dest);
+}
+
+std::string encode_destination(const witness_unknown_tx_destination_t& dest)
+{
+   return encode_for_current_network(dest);
+}
+
+tx_destination_t decode_destination(std::string_view str)
+{
+   return visit_chain_params(g_network, [&str](auto params) {
+      return decode_destination<decltype(params)>(str);
+   });
 }
 
 }
@@ -0,0 +1,55 @@
+// Copyright (c) 2020 gladcow
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <arena.h>
+#include <cstdint>
+
+namespace btc_utils
+{
+
+block_arena_t::block_arena_t(size_t initial_size) :
+   current_(0), offset_(0), chunk_size_(initial_size)
+{
+}
+
+void* block_arena_t::do_allocate(size_t bytes, size_t alignment)
+{
+   while (current_ < chunks_.size())
+   {
+      chunk_t& chunk = chunks_[current_];
+      uintptr_t base = reinterpret_cast<uintptr_t>(chunk.data_.get());
+      size_t start = static_cast<size_t>(((base + offset_ + alignment - 1) & ~(alignment - 1)) - base);
+      if (start + bytes <= chunk.size_)
+      {
+         offset_ = start + bytes;
+         return chunk.data_.get() + start;
+      }
+      current_++;
+      offset_ = 0;
+   }
+   // no room left in the existing chunks, add a new one that fits the request
+   while (chunk_size_ < bytes + alignment)
+      chunk_size_ *= 2;
+   chunks_.push_back(chunk_t{std::unique_ptr<unsigned char[]>(new unsigned char[chunk_size_]), chunk_size_});
+   chunk_size_ *= 2;
+   current_ = chunks_.size() - 1;
+   offset_ = 0;
+   return do_allocate(bytes, alignment);
+}
+
+void block_arena_t::reset()
+{
+   current_ = 0;
+   offset_ = 0;
+}
+
+size_t block_arena_t::capacity() const
+{
+   size_t res = 0;
+   for (const auto& chunk: chunks_)
+      res += chunk.size_;
+   return res;
+}
+
+}
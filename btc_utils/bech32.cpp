@@ -25,10 +25,72 @@ const int8_t CHARSET_REV[128] = {
      1,  0,  3, 16, 11, 28, 12, 14,  6,  4,  2, -1, -1, -1, -1, -1
 };
 
+/** The checksum constants: bech32 for witness version 0 (BIP 173), bech32m for later ones (BIP 350) */
+const uint32_t BECH32_CONST = 1;
+const uint32_t BECH32M_CONST = 0x2bc830a3;
+
+uint32_t EncodingConstant(btc_utils::bech32::Encoding encoding)
+{
+    return encoding == btc_utils::bech32::Encoding::BECH32 ? BECH32_CONST : BECH32M_CONST;
+}
+
+/** {c0}k(x) for every value of c0, see PolyModStep. */
+struct GeneratorTable
+{
+    uint32_t values[32];
+};
+
+constexpr GeneratorTable MakeGeneratorTable()
+{
+    const uint32_t k[5] = {
+        0x3b6a57b2, //     k(x) = {29}x^5 + {22}x^4 + {20}x^3 + {21}x^2 + {29}x + {18}
+        0x26508e6d, //  {2}k(x) = {19}x^5 +  {5}x^4 +     x^3 +  {3}x^2 + {19}x + {13}
+        0x1ea119fa, //  {4}k(x) = {15}x^5 + {10}x^4 +  {2}x^3 +  {6}x^2 + {15}x + {26}
+        0x3d4233dd, //  {8}k(x) = {30}x^5 + {20}x^4 +  {4}x^3 + {12}x^2 + {30}x + {29}
+        0x2a1462b3  // {16}k(x) = {21}x^5 +     x^4 +  {8}x^3 + {24}x^2 + {21}x + {19}
+    };
+    GeneratorTable table{};
+    for (unsigned c0 = 0; c0 < 32; ++c0) {
+        for (unsigned bit = 0; bit < 5; ++bit) {
+            if ((c0 >> bit) & 1) table.values[c0] ^= k[bit];
+        }
+    }
+    return table;
+}
+
+constexpr GeneratorTable GENERATOR = MakeGeneratorTable();
+
+/** One step of PolyMod: c extended by the value v_i. */
+inline uint32_t PolyModStep(uint32_t c, uint8_t v_i)
+{
+    // We want to update `c` to correspond to a polynomial with one extra term. If the initial
+    // value of `c` consists of the coefficients of c(x) = f(x) mod g(x), we modify it to
+    // correspond to c'(x) = (f(x) * x + v_i) mod g(x), where v_i is the next input to
+    // process. Simplifying:
+    // c'(x) = (f(x) * x + v_i) mod g(x)
+    //         ((f(x) mod g(x)) * x + v_i) mod g(x)
+    //         (c(x) * x + v_i) mod g(x)
+    // If c(x) = c0*x^5 + c1*x^4 + c2*x^3 + c3*x^2 + c4*x + c5, we want to compute
+    // c'(x) = (c0*x^5 + c1*x^4 + c2*x^3 + c3*x^2 + c4*x + c5) * x + v_i mod g(x)
+    //       = c0*x^6 + c1*x^5 + c2*x^4 + c3*x^3 + c4*x^2 + c5*x + v_i mod g(x)
+    //       = c0*(x^6 mod g(x)) + c1*x^5 + c2*x^4 + c3*x^3 + c4*x^2 + c5*x + v_i
+    // If we call (x^6 mod g(x)) = k(x), this can be written as
+    // c'(x) = (c1*x^5 + c2*x^4 + c3*x^3 + c4*x^2 + c5*x + v_i) + c0*k(x)
+
+    // First, determine the value of c0:
+    uint8_t c0 = c >> 25;
+
+    // Then compute c1*x^5 + c2*x^4 + c3*x^3 + c4*x^2 + c5*x + v_i:
+    c = ((c & 0x1ffffff) << 5) ^ v_i;
+
+    // Finally, add c0*k(x), the sum of {2^n}k(x) for each set bit n in c0, from the table:
+    return c ^ GENERATOR.values[c0];
+}
+
 /** This function will compute what 6 5-bit values to XOR into the last 6 input values, in order to
  *  make the checksum 0. These 6 values are packed together in a single 30-bit integer. The higher
- *  bits correspond to earlier values. */
-uint32_t PolyMod(const data& v)
+ *  bits correspond to earlier values. The input is the expanded hrp followed by count values. */
+uint32_t PolyMod(std::string_view hrp, const uint8_t* v, size_t count)
 {
     // The input is interpreted as a list of coefficients of a polynomial over F = GF(32), with an
     // implicit 1 in front. If the input is [v0,v1,v2,v3,v4], that polynomial is v(x) =
@@ -55,34 +117,18 @@ uint32_t PolyMod(const data& v)
     // the above example, `c` initially corresponds to 1 mod g(x), and after processing 2 inputs of
     // v, it corresponds to x^2 + v0*x + v1 mod g(x). As 1 mod g(x) = 1, that is the starting value
     // for `c`.
+    // The HRP is expanded in front of the values: the high bits of its characters, a zero and
+    // the low bits of its characters.
     uint32_t c = 1;
-    for (const auto v_i : v) {
-        // We want to update `c` to correspond to a polynomial with one extra term. If the initial
-        // value of `c` consists of the coefficients of c(x) = f(x) mod g(x), we modify it to
-        // correspond to c'(x) = (f(x) * x + v_i) mod g(x), where v_i is the next input to
-        // process. Simplifying:
-        // c'(x) = (f(x) * x + v_i) mod g(x)
-        //         ((f(x) mod g(x)) * x + v_i) mod g(x)
-        //         (c(x) * x + v_i) mod g(x)
-        // If c(x) = c0*x^5 + c1*x^4 + c2*x^3 + c3*x^2 + c4*x + c5, we want to compute
-        // c'(x) = (c0*x^5 + c1*x^4 + c2*x^3 + c3*x^2 + c4*x + c5) * x + v_i mod g(x)
-        //       = c0*x^6 + c1*x^5 + c2*x^4 + c3*x^3 + c4*x^2 + c5*x + v_i mod g(x)
-        //       = c0*(x^6 mod g(x)) + c1*x^5 + c2*x^4 + c3*x^3 + c4*x^2 + c5*x + v_i
-        // If we call (x^6 mod g(x)) = k(x), this can be written as
-        // c'(x) = (c1*x^5 + c2*x^4 + c3*x^3 + c4*x^2 + c5*x + v_i) + c0*k(x)
-
-        // First, determine the value of c0:
-        uint8_t c0 = c >> 25;
-
-        // Then compute c1*x^5 + c2*x^4 + c3*x^3 + c4*x^2 + c5*x + v_i:
-        c = ((c & 0x1ffffff) << 5) ^ v_i;
-
-        // Finally, for each set bit n in c0, conditionally add {2^n}k(x):
-        if (c0 & 1)  c ^= 0x3b6a57b2; //     k(x) = {29}x^5 + {22}x^4 + {20}x^3 + {21}x^2 + {29}x + {18}
-        if (c0 & 2)  c ^= 0x26508e6d; //  {2}k(x) = {19}x^5 +  {5}x^4 +     x^3 +  {3}x^2 + {19}x + {13}
-        if (c0 & 4)  c ^= 0x1ea119fa; //  {4}k(x) = {15}x^5 + {10}x^4 +  {2}x^3 +  {6}x^2 + {15}x + {26}
-        if (c0 & 8)  c ^= 0x3d4233dd; //  {8}k(x) = {30}x^5 + {20}x^4 +  {4}x^3 + {12}x^2 + {30}x + {29}
-        if (c0 & 16) c ^= 0x2a1462b3; // {16}k(x) = {21}x^5 +     x^4 +  {8}x^3 + {24}x^2 + {21}x + {19}
+    for (const char ch : hrp) {
+        c = PolyModStep(c, static_cast<unsigned char>(ch) >> 5);
+    }
+    c = PolyModStep(c, 0);
+    for (const char ch : hrp) {
+        c = PolyModStep(c, static_cast<unsigned char>(ch) & 0x1f);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        c = PolyModStep(c, v[i]);
     }
     return c;
 }
@@ -93,54 +139,27 @@ inline unsigned char LowerCase(unsigned char c)
     return (c >= 'A' && c <= 'Z') ? (c - 'A') + 'a' : c;
 }
 
-/** Concatenate two vectors. */
-template<typename V>
-inline V Cat(V v1, const V& v2)
-{
-    v1.reserve(v1.size() + v2.size());
-    for (const auto& arg : v2) {
-        v1.push_back(arg);
-    }
-    return v1;
-}
-
-/** Expand a HRP for use in checksum computation. */
-data ExpandHRP(const std::string& hrp)
-{
-    data ret;
-    ret.reserve(hrp.size() + 90);
-    ret.resize(hrp.size() * 2 + 1);
-    for (size_t i = 0; i < hrp.size(); ++i) {
-        unsigned char c = hrp[i];
-        ret[i] = c >> 5;
-        ret[i + hrp.size() + 1] = c & 0x1f;
-    }
-    ret[hrp.size()] = 0;
-    return ret;
-}
-
 /** Verify a checksum. */
-bool VerifyChecksum(const std::string& hrp, const data& values)
+btc_utils::bech32::Encoding VerifyChecksum(std::string_view hrp, const data& values)
 {
     // PolyMod computes what value to xor into the final values to make the checksum 0. However,
     // if we required that the checksum was 0, it would be the case that appending a 0 to a valid
     // list of values would result in a new valid list. For that reason, Bech32 requires the
-    // resulting checksum to be 1 instead.
-    return PolyMod(Cat(ExpandHRP(hrp), values)) == 1;
+    // resulting checksum to be 1 instead. In Bech32m, this constant was amended.
+    const uint32_t check = PolyMod(hrp, values.data(), values.size());
+    if (check == BECH32_CONST) return btc_utils::bech32::Encoding::BECH32;
+    if (check == BECH32M_CONST) return btc_utils::bech32::Encoding::BECH32M;
+    return btc_utils::bech32::Encoding::INVALID;
 }
 
-/** Create a checksum. */
-data CreateChecksum(const std::string& hrp, const data& values)
+/** Create a checksum, the values are followed by 6 zeroes. */
+uint32_t CreateChecksum(btc_utils::bech32::Encoding encoding, std::string_view hrp, const uint8_t* values, size_t count)
 {
-    data enc = Cat(ExpandHRP(hrp), values);
-    enc.resize(enc.size() + 6); // Append 6 zeroes
-    uint32_t mod = PolyMod(enc) ^ 1; // Determine what to XOR into those 6 zeroes.
-    data ret(6);
+    uint32_t c = PolyMod(hrp, values, count);
     for (size_t i = 0; i < 6; ++i) {
-        // Convert the 5-bit groups in mod to checksum values.
-        ret[i] = (mod >> (5 * (5 - i))) & 31;
+        c = PolyModStep(c, 0);
     }
-    return ret;
+    return c ^ EncodingConstant(encoding); // Determine what to XOR into those 6 zeroes.
 }
 
 } // namespace
@@ -150,27 +169,36 @@ namespace btc_utils
 namespace bech32
 {
 
-/** Encode a Bech32 string. */
-std::string Encode(const std::string& hrp, const data& values) {
-    // First ensure that the HRP is all lowercase. BIP-173 requires an encoder
-    // to return a lowercase Bech32 string, but if given an uppercase HRP, the
+/** Encode a Bech32 or Bech32m string. */
+std::string Encode(Encoding encoding, std::string_view hrp, const data& values) {
+    return Encode(encoding, hrp, values.data(), values.size());
+}
+
+std::string Encode(Encoding encoding, std::string_view hrp, const uint8_t* values, size_t count) {
+    // First ensure that the HRP is all lowercase. BIP-173 and BIP-350 require an encoder
+    // to return a lowercase Bech32/Bech32m string, but if given an uppercase HRP, the
     // result will always be invalid.
     for (const char& c : hrp) {
        if (c >= 'A' && c <= 'Z')
-          throw std::runtime_error("Invalid HRP in bech32 address: " + hrp);
+          throw std::runtime_error("Invalid HRP in bech32 address: " + std::string(hrp));
     }
-    data checksum = CreateChecksum(hrp, values);
-    data combined = Cat(values, checksum);
-    std::string ret = hrp + '1';
-    ret.reserve(ret.size() + combined.size());
-    for (const auto c : combined) {
-        ret += CHARSET[c];
+    uint32_t checksum = CreateChecksum(encoding, hrp, values, count);
+    std::string ret;
+    ret.reserve(hrp.size() + 1 + count + 6);
+    ret += hrp;
+    ret += '1';
+    for (size_t i = 0; i < count; ++i) {
+        ret += CHARSET[values[i]];
+    }
+    for (size_t i = 0; i < 6; ++i) {
+        // Convert the 5-bit groups in checksum to checksum values.
+        ret += CHARSET[(checksum >> (5 * (5 - i))) & 31];
     }
     return ret;
 }
 
-/** Decode a Bech32 string. */
-std::pair<std::string, data> Decode(const std::string& str) {
+/** Decode a Bech32 or Bech32m string. */
+DecodeResult Decode(const std::string& str) {
     bool lower = false, upper = false;
     for (size_t i = 0; i < str.size(); ++i) {
         unsigned char c = str[i];
@@ -197,10 +225,54 @@ std::pair<std::string, data> Decode(const std::string& str) {
     for (size_t i = 0; i < pos; ++i) {
         hrp += LowerCase(str[i]);
     }
-    if (!VerifyChecksum(hrp, values)) {
-        return {};
+    Encoding result = VerifyChecksum(hrp, values);
+    if (result == Encoding::INVALID) return {};
+    return {result, std::move(hrp), data(values.begin(), values.end() - 6)};
+}
+
+/** Decode a segwit address without allocating. */
+bool DecodeWitnessProgram(std::string_view str, std::string_view hrp, unsigned int& version,
+                          unsigned char* program, size_t& length)
+{
+    size_t pos = str.rfind('1');
+    if (str.size() > 90 || pos != hrp.size() || pos + 8 > str.size()) {
+        return false;
+    }
+    bool lower = false, upper = false;
+    for (const char& c : str) {
+        if (c >= 'a' && c <= 'z') lower = true;
+        else if (c >= 'A' && c <= 'Z') upper = true;
+        else if (c < 33 || c > 126) return false;
+    }
+    if (lower && upper) return false;
+
+    uint32_t c = 1;
+    for (size_t i = 0; i < pos; ++i) {
+        unsigned char ch = LowerCase(static_cast<unsigned char>(str[i]));
+        if (ch != static_cast<unsigned char>(hrp[i])) return false;
+        c = PolyModStep(c, ch >> 5);
+    }
+    c = PolyModStep(c, 0);
+    for (size_t i = 0; i < pos; ++i) {
+        c = PolyModStep(c, LowerCase(static_cast<unsigned char>(str[i])) & 0x1f);
+    }
+    uint8_t values[90];
+    size_t count = str.size() - 1 - pos;
+    for (size_t i = 0; i < count; ++i) {
+        int8_t rev = CHARSET_REV[static_cast<unsigned char>(str[pos + 1 + i])];
+        if (rev == -1) return false;
+        values[i] = static_cast<uint8_t>(rev);
+        c = PolyModStep(c, values[i]);
+    }
+    version = values[0];
+    if (version > 16 || c != (version == 0 ? BECH32_CONST : BECH32M_CONST)) {
+        return false;
     }
-    return {hrp, data(values.begin(), values.end() - 6)};
+    // the program is at most 40 bytes, 64 5-bit values
+    if (count - 7 > 64) return false;
+    length = 0;
+    return ConvertBits<5, 8, false>([&](unsigned char b) { program[length++] = b; },
+                                    values + 1, values + count - 6);
 }
 
 } // namespace bech32
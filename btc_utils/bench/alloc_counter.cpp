@@ -0,0 +1,91 @@
+// Copyright (c) 2020 gladcow
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Replacements of the global operators new and delete counting the
+// allocations. They are compiled apart from the benchmarks so that their
+// malloc() and free() are never inlined into the callers, where GCC would
+// take them for a mismatch with new and delete (-Wmismatched-new-delete).
+
+#include "alloc_counter.h"
+
+#include <cstdlib>
+#include <new>
+
+// Allocation counting: the benchmarks run in a single thread, the counter
+// only needs to be consistent with itself.
+static uint64_t g_allocations = 0;
+
+uint64_t allocation_count()
+{
+   return g_allocations;
+}
+
+void* operator new(size_t size)
+{
+   g_allocations++;
+   void* p = malloc(size ? size : 1);
+   if (!p)
+      throw std::bad_alloc();
+   return p;
+}
+
+void* operator new[](size_t size)
+{
+   return operator new(size);
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+   g_allocations++;
+   size_t align = static_cast<size_t>(alignment);
+   void* p = aligned_alloc(align, (size + align - 1) / align * align);
+   if (!p)
+      throw std::bad_alloc();
+   return p;
+}
+
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+   return operator new(size, alignment);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+   free(p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept
+{
+   free(p);
+}
+
+void operator delete(void* p, size_t, std::align_val_t) noexcept
+{
+   free(p);
+}
+
+void operator delete[](void* p, size_t, std::align_val_t) noexcept
+{
+   free(p);
+}
+
+void operator delete(void* p) noexcept
+{
+   free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+   free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+   free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+   free(p);
+}
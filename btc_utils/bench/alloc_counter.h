@@ -0,0 +1,13 @@
+// Copyright (c) 2020 gladcow
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BTC_UTILS_BENCH_ALLOC_COUNTER_H__
+#define BTC_UTILS_BENCH_ALLOC_COUNTER_H__
+
+#include <cstdint>
+
+//! number of calls of the global operators new so far
+uint64_t allocation_count();
+
+#endif // BTC_UTILS_BENCH_ALLOC_COUNTER_H__
@@ -0,0 +1,373 @@
+// Copyright (c) 2020 gladcow
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Microbenchmarks for the hot paths of the address parser.
+// Prints one JSON document to stdout, so runs on different commits can be
+// compared by a script.
+//
+// Usage: btc_utils_bench [-t min_time_ms] [-f name_filter]
+
+#include <address.h>
+#include <bech32.h>
+#include <block.h>
+#include <chainparams.h>
+#include <crypto.h>
+#include <pattern_matcher.h>
+#include <script.h>
+#include <serialize.h>
+
+#include "alloc_counter.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace btc_utils;
+
+/** Keep the compiler from optimizing away a result */
+template<typename T>
+static inline void do_not_optimize(const T& value)
+{
+   asm volatile("" : : "r"(&value) : "memory");
+}
+
+struct bench_result_t
+{
+   std::string name_;
+   uint64_t iterations_;
+   double ns_per_op_;
+   double ops_per_sec_;
+   double allocs_per_op_;
+};
+
+class bench_runner_t
+{
+private:
+   std::chrono::nanoseconds min_time_;
+   std::string filter_;
+   std::vector<bench_result_t> results_;
+
+public:
+   bench_runner_t(std::chrono::milliseconds min_time, const std::string& filter) :
+      min_time_(min_time), filter_(filter) {}
+
+   //! run f repeatedly, doubling the iteration count until a batch takes at least min_time
+   template<typename F>
+   void run(const std::string& name, F&& f)
+   {
+      if (!filter_.empty() && name.find(filter_) == std::string::npos)
+         return;
+      // warm up caches and lazily initialized state
+      f();
+      uint64_t iterations = 1;
+      while (true)
+      {
+         uint64_t allocations = allocation_count();
+         auto start = std::chrono::steady_clock::now();
+         for (uint64_t i = 0; i < iterations; i++)
+            f();
+         auto elapsed = std::chrono::steady_clock::now() - start;
+         allocations = allocation_count() - allocations;
+         if (elapsed >= min_time_ || iterations >= (1ull << 40))
+         {
+            double ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+            double ops = static_cast<double>(iterations);
+            results_.push_back(bench_result_t{name, iterations, ns / ops, ops * 1e9 / ns,
+                                              static_cast<double>(allocations) / ops});
+            return;
+         }
+         iterations *= 2;
+      }
+   }
+
+   void print_json(std::ostream& os) const
+   {
+      os << "{\n  \"benchmarks\": [\n";
+      for (size_t i = 0; i < results_.size(); i++)
+      {
+         const bench_result_t& r = results_[i];
+         char buf[512];
+         snprintf(buf, sizeof(buf),
+                  "    {\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.2f, "
+                  "\"ops_per_sec\": %.1f, \"allocs_per_op\": %.3f}%s\n",
+                  r.name_.c_str(), static_cast<unsigned long long>(r.iterations_),
+                  r.ns_per_op_, r.ops_per_sec_, r.allocs_per_op_,
+                  i + 1 < results_.size() ? "," : "");
+         os << buf;
+      }
+      os << "  ]\n}\n";
+   }
+};
+
+/** Deterministic pseudo random bytes for the inputs */
+class input_rng_t
+{
+private:
+   uint64_t state_;
+
+public:
+   explicit input_rng_t(uint64_t seed) : state_(seed) {}
+
+   uint64_t next()
+   {
+      // xorshift64*
+      state_ ^= state_ >> 12;
+      state_ ^= state_ << 25;
+      state_ ^= state_ >> 27;
+      return state_ * 2685821657736338717ull;
+   }
+
+   std::vector<unsigned char> bytes(size_t n)
+   {
+      std::vector<unsigned char> res(n);
+      for (auto& c: res)
+         c = static_cast<unsigned char>(next());
+      return res;
+   }
+};
+
+template<size_t N>
+static std::array<unsigned char, N> to_array(const std::vector<unsigned char>& v, size_t offset)
+{
+   std::array<unsigned char, N> res;
+   std::copy(v.begin() + static_cast<long>(offset), v.begin() + static_cast<long>(offset + N), res.begin());
+   return res;
+}
+
+static std::vector<unsigned char> concat(std::initializer_list<std::vector<unsigned char>> parts)
+{
+   std::vector<unsigned char> res;
+   for (const auto& p: parts)
+      res.insert(res.end(), p.begin(), p.end());
+   return res;
+}
+
+/** One script of every standard output type, in a mix close to recent blocks */
+static std::vector<std::vector<unsigned char>> make_scripts(input_rng_t& rng)
+{
+   std::vector<unsigned char> pubkey = concat({{0x02}, rng.bytes(32)});
+   return {
+      concat({{0x76, 0xa9, 0x14}, rng.bytes(20), {0x88, 0xac}}),   // P2PKH
+      concat({{0x00, 0x14}, rng.bytes(20)}),                       // P2WPKH
+      concat({{0xa9, 0x14}, rng.bytes(20), {0x87}}),               // P2SH
+      concat({{0x51, 0x20}, rng.bytes(32)}),                       // witness v1
+      concat({{0x00, 0x14}, rng.bytes(20)}),                       // P2WPKH
+      concat({{0x00, 0x20}, rng.bytes(32)}),                       // P2WSH
+      concat({{0x76, 0xa9, 0x14}, rng.bytes(20), {0x88, 0xac}}),   // P2PKH
+      concat({{0x6a, 0x24}, rng.bytes(36)}),                       // OP_RETURN
+      concat({{0x21}, pubkey, {0xac}}),                            // P2PK
+   };
+}
+
+/** Serialized block with a mix of legacy and segwit transactions */
+static std::vector<unsigned char> make_block(input_rng_t& rng, size_t tx_count)
+{
+   std::vector<std::vector<unsigned char>> scripts = make_scripts(rng);
+   block_t block;
+   block.version_ = 0x20000000;
+   block.time_ = 1600000000;
+   block.bits_ = 0x170d1f8c;
+   block.nonce_ = 0;
+   block.txes_.resize(tx_count);
+   for (size_t i = 0; i < tx_count; i++)
+   {
+      transaction_t& tx = block.txes_[i];
+      bool segwit = (rng.next() % 3) != 0;
+      tx.nVersion = segwit ? 2 : 1;
+      tx.nLockTime = 0;
+      tx.vin.resize(1 + rng.next() % 2);
+      for (auto& in: tx.vin)
+      {
+         std::vector<unsigned char> h = rng.bytes(32);
+         std::copy(h.begin(), h.end(), in.prevout.hash.begin());
+         in.prevout.n = static_cast<uint32_t>(rng.next() % 4);
+         in.nSequence = 0xffffffff;
+         if (segwit)
+         {
+            std::vector<unsigned char> sig = rng.bytes(72);
+            std::vector<unsigned char> key = concat({{0x02}, rng.bytes(32)});
+            in.scriptWitness.emplace_back(sig.begin(), sig.end());
+            in.scriptWitness.emplace_back(key.begin(), key.end());
+         }
+         else
+         {
+            std::vector<unsigned char> sig = concat({{72}, rng.bytes(72), {33, 0x02}, rng.bytes(32)});
+            in.scriptSig.assign(sig.begin(), sig.end());
+         }
+      }
+      tx.vout.resize(2 + rng.next() % 2);
+      for (auto& out: tx.vout)
+      {
+         out.nValue = rng.next() % 100000000;
+         const auto& script = scripts[rng.next() % scripts.size()];
+         out.scriptPubKey.assign(script.begin(), script.end());
+      }
+   }
+   std::vector<unsigned char> res;
+   vector_writer_t writer(res);
+   writer << block;
+   return res;
+}
+
+int main(int argc, char* argv[])
+{
+   long min_time_ms = 200;
+   std::string filter;
+   int c;
+   while ((c = getopt(argc, argv, "t:f:")) != -1)
+   {
+      switch (c)
+      {
+         case 't':
+            min_time_ms = atol(optarg);
+            break;
+         case 'f':
+            filter = optarg;
+            break;
+         default:
+            std::cerr << "Usage: btc_utils_bench [-t min_time_ms] [-f name_filter]" << std::endl;
+            return 1;
+      }
+   }
+
+   bench_runner_t runner{std::chrono::milliseconds(min_time_ms), filter};
+   input_rng_t rng(0x5eed);
+   typedef chain_params<network_t::mainnet> params_t;
+
+   std::vector<std::vector<unsigned char>> scripts = make_scripts(rng);
+   size_t script_index = 0;
+   runner.run("solver", [&]() {
+      std::vector<std::vector<unsigned char>> solutions;
+      txnouttype type = solver(scripts[script_index++ % scripts.size()], solutions);
+      do_not_optimize(type);
+      do_not_optimize(solutions);
+   });
+   runner.run("solver_span", [&]() {
+      tx_destination_t dest;
+      txnouttype type = solver(scripts[script_index++ % scripts.size()], dest);
+      do_not_optimize(type);
+      do_not_optimize(dest);
+   });
+   runner.run("for_each_destination_encode", [&]() {
+      for_each_destination(scripts[script_index++ % scripts.size()], [](const auto& dest) {
+         std::string addr = encode_destination<params_t>(dest);
+         do_not_optimize(addr);
+      });
+   });
+
+   std::vector<unsigned char> payload25 = concat({{0x00}, rng.bytes(24)});
+   runner.run("encode_base58", [&]() {
+      std::string res = encode_base58(payload25);
+      do_not_optimize(res);
+   });
+   std::vector<unsigned char> payload21 = concat({{0x00}, rng.bytes(20)});
+   runner.run("encode_base58_check", [&]() {
+      std::string res = encode_base58_check(payload21);
+      do_not_optimize(res);
+   });
+
+   std::vector<unsigned char> program = rng.bytes(20);
+   std::vector<unsigned char> values = {0};
+   ConvertBits<8, 5, true>([&values](unsigned char v) { values.push_back(v); }, program.begin(), program.end());
+   runner.run("bech32_encode", [&]() {
+      std::string res = bech32::Encode(bech32::Encoding::BECH32, params_t::bech32_hrp, values);
+      do_not_optimize(res);
+   });
+   witness_v0_key_hash_tx_destination_t wpkh(to_array<20>(program, 0));
+   runner.run("encode_destination_p2wpkh", [&]() {
+      std::string res = encode_destination<params_t>(wpkh);
+      do_not_optimize(res);
+   });
+   witness_v1_taproot_tx_destination_t p2tr(to_array<32>(rng.bytes(32), 0));
+   runner.run("encode_destination_p2tr", [&]() {
+      std::string res = encode_destination<params_t>(p2tr);
+      do_not_optimize(res);
+   });
+
+   std::string base58_address = encode_destination<params_t>(pk_hash_tx_destination_t(to_array<20>(payload21, 1)));
+   runner.run("decode_destination_base58", [&]() {
+      tx_destination_t res = decode_destination<params_t>(base58_address);
+      do_not_optimize(res);
+   });
+   std::string bech32_address = bech32::Encode(bech32::Encoding::BECH32, params_t::bech32_hrp, values);
+   runner.run("decode_destination_bech32", [&]() {
+      tx_destination_t res = decode_destination<params_t>(bech32_address);
+      do_not_optimize(res);
+   });
+
+   std::vector<unsigned char> data32 = rng.bytes(32);
+   std::vector<unsigned char> data64 = rng.bytes(64);
+   runner.run("hash_sha256_32", [&]() {
+      uint256_t res = hash_sha256(data32);
+      do_not_optimize(res);
+   });
+   runner.run("hash_sha256_64", [&]() {
+      uint256_t res = hash_sha256(data64);
+      do_not_optimize(res);
+   });
+   runner.run("hash_ripemd160_32", [&]() {
+      uint160_t res = hash_ripemd160(data32);
+      do_not_optimize(res);
+   });
+
+   std::vector<unsigned char> compressed = concat({{0x03}, rng.bytes(32)});
+   std::vector<unsigned char> uncompressed = concat({{0x04}, rng.bytes(64)});
+   pub_key_t compressed_key(compressed.begin(), compressed.end());
+   pub_key_t uncompressed_key(uncompressed.begin(), uncompressed.end());
+   runner.run("pub_key_get_id_compressed", [&]() {
+      key_id_t res = compressed_key.get_id();
+      do_not_optimize(res);
+   });
+   runner.run("pub_key_get_id_uncompressed", [&]() {
+      key_id_t res = uncompressed_key.get_id();
+      do_not_optimize(res);
+   });
+   runner.run("pub_key_compute_id_compressed", [&]() {
+      key_id_t res = compressed_key.compute_id();
+      do_not_optimize(res);
+   });
+   runner.run("pub_key_compute_id_uncompressed", [&]() {
+      key_id_t res = uncompressed_key.compute_id();
+      do_not_optimize(res);
+   });
+
+   // an 80-byte payload searched for one marker and for 4096, the cost per byte is the same
+   std::vector<unsigned char> payload80 = rng.bytes(80);
+   std::vector<multi_pattern_matcher_t::pattern_t> patterns{{{0x6f, 0x6d, 0x6e, 0x69}, 0}};
+   multi_pattern_matcher_t one_pattern;
+   one_pattern.build(patterns);
+   for (uint32_t i = 1; i < 4096; i++)
+      patterns.push_back({rng.bytes(4 + i % 9), i});
+   multi_pattern_matcher_t many_patterns;
+   many_patterns.build(patterns);
+   runner.run("pattern_find_first_1", [&]() {
+      uint32_t res = one_pattern.find_first(payload80);
+      do_not_optimize(res);
+   });
+   runner.run("pattern_find_first_4096", [&]() {
+      uint32_t res = many_patterns.find_first(payload80);
+      do_not_optimize(res);
+   });
+
+   std::vector<unsigned char> block_data = make_block(rng, 2000);
+   runner.run("block_unserialize_fresh", [&]() {
+      block_t block;
+      span_reader_t reader(block_data);
+      reader >> block;
+      do_not_optimize(block);
+   });
+   block_t recycled;
+   runner.run("block_unserialize_recycled", [&]() {
+      span_reader_t reader(block_data);
+      reader >> recycled;
+      do_not_optimize(recycled);
+   });
+
+   runner.print_json(std::cout);
+   return 0;
+}
@@ -3,8 +3,22 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <block.h>
+#include <serialize.h>
 
 namespace btc_utils {
 
+uint256_t block_t::get_hash() const
+{
+   std::vector<unsigned char> header;
+   header.reserve(80);
+   vector_writer_t writer(header);
+   writer.serialize(version_);
+   writer.serialize(prev_block_hash_);
+   writer.serialize(merkle_root_);
+   writer.serialize(time_);
+   writer.serialize(bits_);
+   writer.serialize(nonce_);
+   return hash_sha256d(header);
+}
 
 }
@@ -0,0 +1,531 @@
+// Copyright (c) 2020 gladcow
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <block_index.h>
+#include <mapped_file.h>
+#include <serialize.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+namespace btc_utils
+{
+
+static const size_t BLOCK_HEADER_SIZE = 80;
+
+uint64_t scan_block_headers(byte_span_t data, const start_marker_t message_start, uint32_t file,
+                            std::vector<block_location_t>& blocks)
+{
+   const size_t framing = MESSAGE_START_SIZE + sizeof(uint32_t);
+   uint64_t skipped = 0;
+   size_t parsed = 0;  // end of the last record
+   size_t pos = 0;
+   while (pos < data.size())
+   {
+      const void* found = memchr(data.data() + pos, message_start[0], data.size() - pos);
+      if (!found)
+         break;
+      pos = static_cast<size_t>(static_cast<const unsigned char*>(found) - data.data());
+      if (data.size() - pos < framing + BLOCK_HEADER_SIZE)
+         break;
+      if (memcmp(data.data() + pos, message_start, MESSAGE_START_SIZE) != 0)
+      {
+         pos++;
+         continue;
+      }
+      uint32_t size = span_reader_t(data.subspan(pos + MESSAGE_START_SIZE, sizeof(uint32_t))).readdata32();
+      size_t offset = pos + framing;
+      // a record cut short by the end of the file would fail to deserialize
+      if (size < BLOCK_HEADER_SIZE || size > MAX_BLOCK_SERIALIZED_SIZE || size > data.size() - offset)
+      {
+         pos++;
+         continue;
+      }
+      block_location_t block;
+      block.hash = hash_sha256d(data.subspan(offset, BLOCK_HEADER_SIZE));
+      // the header and at most a 9 byte compact size
+      span_reader_t reader(data.subspan(offset, std::min<size_t>(size, BLOCK_HEADER_SIZE + 9)));
+      reader.readdata32();  // version
+      reader.unserialize(block.prev);
+      reader.skip(block.hash.size());  // merkle root
+      block.time = reader.readdata32();
+      block.bits = reader.readdata32();
+      reader.readdata32();  // nonce
+      block.tx_count = 0;
+      try
+      {
+         if (!reader.eof())
+            block.tx_count = static_cast<uint32_t>(std::min<uint64_t>(reader.read_compact_int(), UINT32_MAX));
+      }
+      catch (const std::exception&)
+      {
+      }
+      block.file = file;
+      block.size = size;
+      block.offset = offset;
+      blocks.push_back(block);
+
+      skipped += pos - parsed;
+      pos = parsed = offset + size;
+   }
+   return skipped + (data.size() - parsed);
+}
+
+std::vector<block_location_t> scan_block_files(const std::vector<std::string>& paths,
+                                               const start_marker_t message_start,
+                                               uint64_t& skipped_bytes, unsigned int threads)
+{
+   if (threads == 0)
+      threads = std::max(1u, std::thread::hardware_concurrency());
+   threads = static_cast<unsigned int>(std::min<size_t>(threads, std::max<size_t>(1, paths.size())));
+
+   // files are handed out one at a time, they differ a lot in block count
+   std::vector<std::vector<block_location_t>> found(paths.size());
+   std::vector<uint64_t> skipped(paths.size(), 0);
+   std::atomic<size_t> next(0);
+   std::exception_ptr error;
+   std::mutex error_mutex;
+   auto worker = [&]() {
+      for (size_t i = next++; i < paths.size(); i = next++)
+      {
+         try
+         {
+            mapped_file_t file(paths[i]);
+            file.advise_random();
+            skipped[i] = scan_block_headers(byte_span_t(file.data(), file.size()), message_start,
+                                            static_cast<uint32_t>(i), found[i]);
+         }
+         catch (...)
+         {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error)
+               error = std::current_exception();
+            next = paths.size();
+         }
+      }
+   };
+   std::vector<std::thread> pool;
+   for (unsigned int t = 1; t < threads; t++)
+      pool.emplace_back(worker);
+   worker();
+   for (auto& th: pool)
+      th.join();
+   if (error)
+      std::rethrow_exception(error);
+
+   size_t count = 0;
+   for (const auto& f: found)
+      count += f.size();
+   std::vector<block_location_t> blocks;
+   blocks.reserve(count);
+   skipped_bytes = 0;
+   for (size_t i = 0; i < paths.size(); i++)
+   {
+      blocks.insert(blocks.end(), found[i].begin(), found[i].end());
+      skipped_bytes += skipped[i];
+   }
+   return blocks;
+}
+
+namespace {
+
+/** An amount of proof of work, the 256-bit number bitcoind keeps as
+ *  nChainWork, in little endian 64-bit limbs */
+struct chain_work_t
+{
+   uint64_t limbs[4] = {0, 0, 0, 0};
+
+   chain_work_t& operator+=(const chain_work_t& other)
+   {
+      unsigned __int128 carry = 0;
+      for (size_t i = 0; i < 4; i++)
+      {
+         carry += static_cast<unsigned __int128>(limbs[i]) + other.limbs[i];
+         limbs[i] = static_cast<uint64_t>(carry);
+         carry >>= 64;
+      }
+      return *this;
+   }
+
+   bool operator<(const chain_work_t& other) const
+   {
+      for (size_t i = 4; i-- > 0; )
+      {
+         if (limbs[i] != other.limbs[i])
+            return limbs[i] < other.limbs[i];
+      }
+      return false;
+   }
+};
+
+/** The expected number of hashes for a block of the compact target bits,
+ *  2^256 / (target + 1), zero for a negative, zero or overflowing target,
+ *  like GetBlockProof() */
+chain_work_t block_work(uint32_t bits)
+{
+   chain_work_t work;
+   unsigned int exponent = bits >> 24;
+   uint64_t mantissa = bits & 0x007fffff;
+   if (!mantissa || (bits & 0x00800000) ||
+       exponent > 34 || (mantissa > 0xff && exponent > 33) || (mantissa > 0xffff && exponent > 32))
+      return work;
+   chain_work_t target;
+   if (exponent <= 3)
+      target.limbs[0] = mantissa >> (8 * (3 - exponent));
+   else
+   {
+      unsigned int shift = 8 * (exponent - 3);
+      target.limbs[shift / 64] = mantissa << (shift % 64);
+      if (shift % 64 && shift / 64 < 3)
+         target.limbs[shift / 64 + 1] = mantissa >> (64 - shift % 64);
+   }
+   if (!target.limbs[0] && !target.limbs[1] && !target.limbs[2] && !target.limbs[3])
+      return work;
+   // 2^256 / (target + 1) = ~target / (target + 1) + 1, by shifting and subtracting
+   chain_work_t one;
+   one.limbs[0] = 1;
+   chain_work_t divisor = target;
+   divisor += one;
+   chain_work_t dividend = target;
+   for (uint64_t& limb: dividend.limbs)
+      limb = ~limb;
+   chain_work_t rem;
+   for (size_t bit = 256; bit-- > 0; )
+   {
+      bool carry = rem.limbs[3] >> 63;
+      for (size_t i = 3; i > 0; i--)
+         rem.limbs[i] = rem.limbs[i] << 1 | rem.limbs[i - 1] >> 63;
+      rem.limbs[0] = rem.limbs[0] << 1 | (dividend.limbs[bit / 64] >> (bit % 64) & 1);
+      if (carry || !(rem < divisor))
+      {
+         chain_work_t negated = divisor;
+         for (uint64_t& limb: negated.limbs)
+            limb = ~limb;
+         negated += one;
+         rem += negated;  // rem - divisor modulo 2^256
+         work.limbs[bit / 64] |= uint64_t(1) << (bit % 64);
+      }
+   }
+   work += one;
+   return work;
+}
+
+const char BLOCK_INDEX_MAGIC[8] = {'B', 'T', 'C', 'B', 'L', 'K', 'I', 'X'};
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+struct block_index_header_t
+{
+   char magic[8];
+   uint32_t version;
+   uint32_t byte_order;
+   uint64_t entry_count;
+   uint64_t stale_count;
+   uint32_t file_count;
+   uint32_t entry_size;
+   uint32_t location_size;
+   uint32_t file_state_size;
+};
+
+//! section offsets of a saved index: the blk file states, the best chain and the stale records
+struct block_index_layout_t
+{
+   uint64_t files;
+   uint64_t entries;
+   uint64_t stale;
+   uint64_t end;
+
+   explicit block_index_layout_t(const block_index_header_t& header)
+   {
+      files = sizeof(block_index_header_t);
+      entries = files + header.file_count * sizeof(blk_file_state_t);
+      stale = entries + header.entry_count * sizeof(block_index_entry_t);
+      end = stale + header.stale_count * sizeof(block_location_t);
+   }
+};
+
+//! the hashes are uniformly distributed already
+struct uint256_hasher_t
+{
+   size_t operator()(const uint256_t& h) const
+   {
+      size_t res;
+      memcpy(&res, h.data(), sizeof(res));
+      return res;
+   }
+};
+
+}
+
+block_index_t::block_index_t() :
+   entries_(nullptr), size_(0), stale_(nullptr), stale_size_(0), files_(nullptr), file_count_(0)
+{
+}
+
+block_index_t::~block_index_t() = default;
+
+void block_index_t::build(std::vector<block_location_t> blocks, const std::vector<blk_file_state_t>& files)
+{
+   const uint32_t UNKNOWN = UINT32_MAX;      // height not computed yet
+   const uint32_t UNLINKED = UINT32_MAX - 1; // an ancestor is missing
+
+   std::stable_sort(blocks.begin(), blocks.end(), [](const block_location_t& a, const block_location_t& b) {
+      return a.file != b.file ? a.file < b.file : a.offset < b.offset;
+   });
+
+   // the first record of every block, later ones are duplicates
+   std::unordered_map<uint256_t, uint32_t, uint256_hasher_t> by_hash;
+   by_hash.reserve(blocks.size());
+   for (size_t i = 0; i < blocks.size(); i++)
+      by_hash.emplace(blocks[i].hash, static_cast<uint32_t>(i));
+
+   // the work of a block only depends on its bits, which change every 2016 blocks on mainnet
+   std::unordered_map<uint32_t, chain_work_t> work_by_bits;
+   auto proof = [&work_by_bits](uint32_t bits) -> const chain_work_t& {
+      auto found = work_by_bits.find(bits);
+      if (found == work_by_bits.end())
+         found = work_by_bits.emplace(bits, block_work(bits)).first;
+      return found->second;
+   };
+
+   // heights and chain work along the prev links, iteratively as the chain is deep
+   std::vector<uint32_t> heights(blocks.size(), UNKNOWN);
+   std::vector<chain_work_t> work(blocks.size());
+   std::vector<uint32_t> path;
+   size_t tip = blocks.size();
+   for (size_t i = 0; i < blocks.size(); i++)
+   {
+      uint32_t cur = static_cast<uint32_t>(i);
+      while (heights[cur] == UNKNOWN)
+      {
+         path.push_back(cur);
+         auto parent = by_hash.find(blocks[cur].prev);
+         if (parent == by_hash.end())
+         {
+            if (blocks[cur].prev == uint256_t())
+            {
+               heights[cur] = 0;
+               work[cur] = proof(blocks[cur].bits);
+               path.pop_back();
+            }
+            else
+               heights[cur] = UNLINKED;
+            break;
+         }
+         cur = parent->second;
+      }
+      uint32_t height = heights[cur];
+      chain_work_t total = work[cur];
+      while (!path.empty())
+      {
+         if (height != UNLINKED)
+         {
+            height++;
+            total += proof(blocks[path.back()].bits);
+            work[path.back()] = total;
+         }
+         heights[path.back()] = height;
+         path.pop_back();
+      }
+      // the chain with the most work, as bitcoind picks it; the first one seen wins a tie
+      if (heights[i] != UNLINKED && (tip == blocks.size() || work[tip] < work[i]))
+         tip = i;
+   }
+
+   std::vector<bool> on_chain(blocks.size(), false);
+   store_.clear();
+   if (tip != blocks.size())
+   {
+      store_.resize(heights[tip] + size_t(1));
+      for (size_t cur = tip; ; )
+      {
+         const block_location_t& b = blocks[cur];
+         block_index_entry_t& e = store_[heights[cur]];
+         memset(&e, 0, sizeof(e));
+         e.hash = b.hash;
+         e.offset = b.offset;
+         e.height = heights[cur];
+         e.file = b.file;
+         e.size = b.size;
+         e.tx_count = b.tx_count;
+         e.bits = b.bits;
+         on_chain[cur] = true;
+         if (!heights[cur])
+            break;
+         cur = by_hash.find(b.prev)->second;
+      }
+   }
+   stale_store_.clear();
+   for (size_t i = 0; i < blocks.size(); i++)
+   {
+      if (!on_chain[i] && by_hash[blocks[i].hash] == i)
+      {
+         // zero the padding, the records are saved as they are
+         stale_store_.emplace_back();
+         block_location_t& b = stale_store_.back();
+         memset(&b, 0, sizeof(b));
+         b.hash = blocks[i].hash;
+         b.prev = blocks[i].prev;
+         b.time = blocks[i].time;
+         b.bits = blocks[i].bits;
+         b.file = blocks[i].file;
+         b.size = blocks[i].size;
+         b.tx_count = blocks[i].tx_count;
+         b.offset = blocks[i].offset;
+      }
+   }
+   file_store_ = files;
+
+   file_.reset();
+   entries_ = store_.data();
+   size_ = store_.size();
+   stale_ = stale_store_.data();
+   stale_size_ = stale_store_.size();
+   files_ = file_store_.data();
+   file_count_ = file_store_.size();
+}
+
+std::vector<uint32_t> block_index_t::changed_files(const std::vector<blk_file_state_t>& files) const
+{
+   std::vector<uint32_t> res;
+   for (uint32_t i = 0; i < files.size(); i++)
+      if (changed(i, files))
+         res.push_back(i);
+   return res;
+}
+
+void block_index_t::update(const std::vector<block_location_t>& blocks, const std::vector<blk_file_state_t>& files)
+{
+   std::vector<block_location_t> all;
+   all.reserve(size_ + stale_size_ + blocks.size());
+   for (size_t height = 0; height < size_; height++)
+   {
+      const block_index_entry_t& e = entries_[height];
+      if (changed(e.file, files))
+         continue;
+      block_location_t b;
+      memset(&b, 0, sizeof(b));
+      b.hash = e.hash;
+      if (height)
+         b.prev = entries_[height - 1].hash;
+      b.file = e.file;
+      b.size = e.size;
+      b.bits = e.bits;
+      b.tx_count = e.tx_count;
+      b.offset = e.offset;
+      all.push_back(b);
+   }
+   for (size_t i = 0; i < stale_size_; i++)
+      if (!changed(stale_[i].file, files))
+         all.push_back(stale_[i]);
+   all.insert(all.end(), blocks.begin(), blocks.end());
+   build(std::move(all), files);
+}
+
+void block_index_t::save(const std::string& path) const
+{
+   block_index_header_t header;
+   memset(&header, 0, sizeof(header));
+   memcpy(header.magic, BLOCK_INDEX_MAGIC, sizeof(header.magic));
+   header.version = FILE_VERSION;
+   header.byte_order = BYTE_ORDER_MARK;
+   header.entry_count = size_;
+   header.stale_count = stale_size_;
+   header.file_count = static_cast<uint32_t>(file_count_);
+   header.entry_size = sizeof(block_index_entry_t);
+   header.location_size = sizeof(block_location_t);
+   header.file_state_size = sizeof(blk_file_state_t);
+
+   std::string tmp = path + ".tmp";
+   {
+      std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+      f.write(reinterpret_cast<const char*>(&header), sizeof(header));
+      f.write(reinterpret_cast<const char*>(files_), static_cast<std::streamsize>(file_count_ * sizeof(blk_file_state_t)));
+      f.write(reinterpret_cast<const char*>(entries_), static_cast<std::streamsize>(size_ * sizeof(block_index_entry_t)));
+      f.write(reinterpret_cast<const char*>(stale_), static_cast<std::streamsize>(stale_size_ * sizeof(block_location_t)));
+      if (!f)
+         throw std::runtime_error("Can't write " + tmp);
+   }
+   if (rename(tmp.c_str(), path.c_str()) != 0)
+      throw std::runtime_error("Can't rename " + tmp + " to " + path + ": " + strerror(errno));
+}
+
+void block_index_t::load(const std::string& path)
+{
+   std::unique_ptr<mapped_file_t> file(new mapped_file_t(path));
+   block_index_header_t header;
+   if (file->size() < sizeof(header))
+      throw std::runtime_error(path + " is not a block index file");
+   memcpy(&header, file->data(), sizeof(header));
+   if (memcmp(header.magic, BLOCK_INDEX_MAGIC, sizeof(header.magic)) != 0)
+      throw std::runtime_error(path + " is not a block index file");
+   if (header.version != FILE_VERSION || header.byte_order != BYTE_ORDER_MARK ||
+       header.entry_size != sizeof(block_index_entry_t) || header.location_size != sizeof(block_location_t) ||
+       header.file_state_size != sizeof(blk_file_state_t))
+      throw std::runtime_error(path + ": unsupported block index version or byte order");
+   // the counts are bounded by the file size before the layout is computed from them
+   if (header.entry_count > file->size() / sizeof(block_index_entry_t) ||
+       header.stale_count > file->size() / sizeof(block_location_t))
+      throw std::runtime_error(path + ": corrupted block index file");
+   block_index_layout_t layout(header);
+   if (file->size() != layout.end)
+      throw std::runtime_error(path + ": corrupted block index file");
+
+   const block_index_entry_t* entries = reinterpret_cast<const block_index_entry_t*>(file->data() + layout.entries);
+   size_t count = static_cast<size_t>(header.entry_count);
+   // the file is ordered by height, entries are looked up by it
+   if (count && (entries[0].height != 0 || entries[count - 1].height != count - 1))
+      throw std::runtime_error(path + ": corrupted block index file");
+
+   entries_ = entries;
+   size_ = count;
+   stale_ = reinterpret_cast<const block_location_t*>(file->data() + layout.stale);
+   stale_size_ = static_cast<size_t>(header.stale_count);
+   files_ = reinterpret_cast<const blk_file_state_t*>(file->data() + layout.files);
+   file_count_ = header.file_count;
+   file_ = std::move(file);
+   store_.clear();
+   stale_store_.clear();
+   file_store_.clear();
+}
+
+std::vector<const block_index_entry_t*> block_index_t::locate(size_t begin, size_t end) const
+{
+   std::vector<const block_index_entry_t*> blocks;
+   blocks.reserve(end - begin);
+   for (size_t height = begin; height < end; height++)
+      blocks.push_back(&entries_[height]);
+   std::sort(blocks.begin(), blocks.end(), [](const block_index_entry_t* a, const block_index_entry_t* b) {
+      return a->file != b->file ? a->file < b->file : a->offset < b->offset;
+   });
+   return blocks;
+}
+
+size_t split_by_size(const std::vector<const block_index_entry_t*>& blocks, unsigned int parts, unsigned int part)
+{
+   if (part == 0)
+      return 0;
+   if (part >= parts)
+      return blocks.size();
+   uint64_t total = 0;
+   for (const block_index_entry_t* b: blocks)
+      total += b->size;
+   // the first block whose bytes before it reach the share of the parts before
+   uint64_t target = static_cast<uint64_t>(static_cast<double>(total) * part / parts);
+   uint64_t bytes = 0;
+   size_t pos = 0;
+   for (; pos < blocks.size() && bytes < target; pos++)
+      bytes += blocks[pos]->size;
+   return pos;
+}
+
+}
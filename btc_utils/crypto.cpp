@@ -4,13 +4,18 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "crypto.h"
+#include "clock_cache.h"
 #include <openssl/sha.h>
 #include <openssl/ripemd.h>
+#include <openssl/evp.h>
 #include <openssl/ec.h>
 #include <openssl/bn.h>
 #include <openssl/obj_mac.h>
 #include <memory>
 #include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
 
 namespace btc_utils
 {
@@ -18,7 +23,7 @@ namespace btc_utils
 /** All alphanumeric characters except for "0", "I", "O", and "l" */
 static const char* pszBase58 = "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
 
-std::string encode_base58(const std::vector<unsigned char>& data)
+std::string encode_base58(byte_span_t data)
 {
     // Skip & count leading zeroes.
     auto pbegin = std::find_if(data.begin(), data.end(),
@@ -55,16 +60,148 @@ std::string encode_base58(const std::vector<unsigned char>& data)
     return str;
 }
 
-std::string encode_base58_check(const std::vector<unsigned char> &data)
+std::string encode_base58_check(byte_span_t data)
 {
    // add 4-byte hash check to the end
-   std::vector<unsigned char> vch(data);
+   std::vector<unsigned char> vch(data.begin(), data.end());
    uint256_t tmp = hash_sha256(vch);
    uint256_t h = hash_sha256(std::vector<unsigned char>(tmp.begin(), tmp.end()));
    vch.insert(vch.end(), &h[0], &h[0] + 4);
    return encode_base58(vch);
 }
 
+static const int8_t mapBase58[256] = {
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1, 0, 1, 2, 3, 4, 5, 6,  7, 8,-1,-1,-1,-1,-1,-1,
+    -1, 9,10,11,12,13,14,15, 16,-1,17,18,19,20,21,-1,
+    22,23,24,25,26,27,28,29, 30,31,32,-1,-1,-1,-1,-1,
+    -1,33,34,35,36,37,38,39, 40,41,42,43,-1,44,45,46,
+    47,48,49,50,51,52,53,54, 55,56,57,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+};
+
+bool decode_base58(const std::string& str, std::vector<unsigned char>& ret, size_t max_ret_len)
+{
+    const char* psz = str.c_str();
+    // Skip and count leading '1's.
+    size_t zeroes = 0;
+    size_t length = 0;
+    while (*psz == '1') {
+        zeroes++;
+        if (zeroes > max_ret_len) return false;
+        psz++;
+    }
+    // Allocate enough space in big-endian base256 representation.
+    size_t size = strlen(psz) * 733u / 1000u + 1u; // log(58) / log(256), rounded up.
+    std::vector<unsigned char> b256(size);
+    // Process the characters.
+    while (*psz) {
+        // Decode base58 character
+        int carry = mapBase58[static_cast<uint8_t>(*psz)];
+        if (carry == -1)  // Invalid b58 character
+            return false;
+        size_t i = 0;
+        for (auto it = b256.rbegin(); (carry != 0 || i < length) && (it != b256.rend()); ++it, ++i) {
+            carry += 58 * (*it);
+            *it = static_cast<unsigned char>(carry % 256);
+            carry /= 256;
+        }
+        length = i;
+        if (length + zeroes > max_ret_len) return false;
+        psz++;
+    }
+    // Skip leading zeroes in b256.
+    auto it = b256.begin() + static_cast<long int>(size - length);
+    // Copy result into output vector.
+    ret.clear();
+    ret.reserve(zeroes + static_cast<size_t>(b256.end() - it));
+    ret.assign(zeroes, 0x00);
+    while (it != b256.end())
+        ret.push_back(*(it++));
+    return true;
+}
+
+bool decode_base58_check(const std::string& str, std::vector<unsigned char>& ret, size_t max_ret_len)
+{
+    if (!decode_base58(str, ret, max_ret_len > std::numeric_limits<size_t>::max() - 4 ? std::numeric_limits<size_t>::max() : max_ret_len + 4) ||
+        ret.size() < 4) {
+        ret.clear();
+        return false;
+    }
+    // re-calculate the checksum, ensure it matches the included 4-byte checksum
+    uint256_t h = hash_sha256d(byte_span_t(ret.data(), ret.size() - 4));
+    if (memcmp(&h[0], &ret[ret.size() - 4], 4) != 0) {
+        ret.clear();
+        return false;
+    }
+    ret.resize(ret.size() - 4);
+    return true;
+}
+
+bool decode_base58_check(std::string_view str, unsigned char* out, size_t len)
+{
+    const size_t MAX_LEN = 64;
+    if (len > MAX_LEN)
+        return false;
+    size_t total = len + 4;
+    // Leading '1's are leading zero bytes.
+    size_t zeroes = 0;
+    while (zeroes < str.size() && str[zeroes] == '1')
+        zeroes++;
+    if (zeroes > total)
+        return false;
+    // Accumulate the number in little-endian 32-bit limbs, five digits at a time (58^5 < 2^32).
+    uint32_t limbs[(MAX_LEN + 4 + 3) / 4] = {};
+    size_t limb_count = (total + 3) / 4;
+    for (size_t pos = zeroes; pos < str.size(); ) {
+        uint64_t mul = 1;
+        uint64_t carry = 0;
+        for (int k = 0; k < 5 && pos < str.size(); k++, pos++) {
+            int digit = mapBase58[static_cast<uint8_t>(str[pos])];
+            if (digit == -1)
+                return false;
+            carry = carry * 58 + static_cast<uint64_t>(digit);
+            mul *= 58;
+        }
+        for (size_t i = 0; i < limb_count; i++) {
+            uint64_t v = limbs[i] * mul + carry;
+            limbs[i] = static_cast<uint32_t>(v);
+            carry = v >> 32;
+        }
+        if (carry != 0)
+            return false;
+    }
+    for (size_t b = total; b < limb_count * 4; b++) {
+        if ((limbs[b / 4] >> (8 * (b % 4))) & 0xff)
+            return false;
+    }
+    unsigned char buf[MAX_LEN + 4];
+    for (size_t i = 0; i < total; i++) {
+        size_t b = total - 1 - i;
+        buf[i] = static_cast<unsigned char>(limbs[b / 4] >> (8 * (b % 4)));
+    }
+    // A canonical encoding has exactly one '1' per leading zero byte.
+    size_t leading = 0;
+    while (leading < total && buf[leading] == 0)
+        leading++;
+    if (leading != zeroes)
+        return false;
+    uint256_t h = hash_sha256d(byte_span_t(buf, len));
+    if (memcmp(h.data(), buf + len, 4) != 0)
+        return false;
+    memcpy(out, buf, len);
+    return true;
+}
+
 uint256_t hash_sha256(const std::vector<unsigned char> &data)
 {
     SHA256_CTX sha256;
@@ -75,6 +212,131 @@ uint256_t hash_sha256(const std::vector<unsigned char> &data)
     return res;
 }
 
+namespace {
+
+//! the implementation of a digest, fetched once: the one-shot functions fetch it on every call
+const EVP_MD* fetch_digest(const char* name)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    EVP_MD* md = EVP_MD_fetch(nullptr, name, nullptr);
+#else
+    const EVP_MD* md = EVP_get_digestbyname(name);
+#endif
+    if (!md)
+        throw std::runtime_error(std::string("OpenSSL has no ") + name + " digest");
+    return md;
+}
+
+/** A digest context of the thread, allocated once and initialized again for
+ *  every message */
+class digest_t
+{
+private:
+    const EVP_MD* md_;
+    EVP_MD_CTX* ctx_;
+
+public:
+    explicit digest_t(const EVP_MD* md) : md_(md), ctx_(EVP_MD_CTX_new())
+    {
+        if (!ctx_)
+            throw std::bad_alloc();
+    }
+
+    ~digest_t()
+    {
+        EVP_MD_CTX_free(ctx_);
+    }
+
+    digest_t(const digest_t&) = delete;
+    digest_t& operator=(const digest_t&) = delete;
+
+    //! writes the digest of data to out, which must have room for it
+    void hash(byte_span_t data, unsigned char* out)
+    {
+        if (!EVP_DigestInit_ex(ctx_, md_, nullptr) ||
+            !EVP_DigestUpdate(ctx_, data.data(), data.size()) ||
+            !EVP_DigestFinal_ex(ctx_, out, nullptr))
+            throw std::runtime_error("EVP digest failed");
+    }
+};
+
+digest_t& sha256_digest()
+{
+    static const EVP_MD* md = fetch_digest("SHA256");
+    thread_local digest_t digest(md);
+    return digest;
+}
+
+digest_t& ripemd160_digest()
+{
+    static const EVP_MD* md = fetch_digest("RIPEMD160");
+    thread_local digest_t digest(md);
+    return digest;
+}
+
+}
+
+uint256_t hash_sha256d(byte_span_t data)
+{
+    uint256_t res;
+    digest_t& sha256 = sha256_digest();
+    sha256.hash(data, res.data());
+    sha256.hash(res, res.data());
+    return res;
+}
+
+uint160_t hash160(byte_span_t data)
+{
+    uint256_t h;
+    sha256_digest().hash(data, h.data());
+    uint160_t res;
+    ripemd160_digest().hash(h, res.data());
+    return res;
+}
+
+void hash160_batch(const byte_span_t* inputs, size_t count, uint160_t* out)
+{
+    for (size_t i = 0; i < count; i++)
+        out[i] = hash160(inputs[i]);
+}
+
+namespace {
+
+//! the keys are points on the curve, a few of their bytes are already well distributed
+struct pub_key_hasher_t
+{
+    uint64_t operator()(const pub_key_t& key) const
+    {
+        byte_span_t b = key.bytes();
+        uint64_t h = 0;
+        memcpy(&h, b.data() + 1, sizeof(h));
+        h ^= static_cast<uint64_t>(b[0]) << 56;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        return h;
+    }
+};
+
+// 4096 entries of about 100 bytes, some 400 KB, fit in the 1-2 MB L2 cache of recent cores
+typedef clock_cache_t<pub_key_t, key_id_t, pub_key_hasher_t> pub_key_cache_t;
+thread_local pub_key_cache_t g_pub_key_cache(4096);
+
+}
+
+key_id_t pub_key_t::get_id() const
+{
+    if (!is_valid())
+        return compute_id();
+    return g_pub_key_cache.get(*this, [](const pub_key_t& key) { return key.compute_id(); });
+}
+
+void get_pub_key_cache_stats(uint64_t& hits, uint64_t& misses)
+{
+    hits = g_pub_key_cache.hits();
+    misses = g_pub_key_cache.misses();
+}
+
 uint160_t hash_ripemd160(const std::vector<unsigned char> &data)
 {
     RIPEMD160_CTX ripemd;
@@ -132,13 +394,13 @@ std::vector<unsigned char> from_hex(const std::string& hex)
     return res;
 }
 
-std::string to_hex(const std::vector<unsigned char>& v)
+std::string to_hex(byte_span_t v)
 {
     std::string rv;
     static const char hexmap[16] = { '0', '1', '2', '3', '4', '5', '6', '7',
                                      '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
     rv.reserve(v.size() * 2);
-    for(auto c = v.rend(); c != v.rbegin(); c++)
+    for(auto c = v.begin(); c != v.end(); c++)
     {
         unsigned char val = *c;
         rv.push_back(hexmap[val>>4]);
@@ -153,7 +415,7 @@ uint256_t uint256_from_hex(const std::string& hex)
         throw std::runtime_error("Invalid hex string size for uint256");
     uint256_t res;
     auto it = hex.begin();
-    size_t count = 0;
+    size_t count = res.size();
     static signed char failed = static_cast<signed char>(-1);
     while (it != hex.end())
     {
@@ -165,7 +427,7 @@ uint256_t uint256_from_hex(const std::string& hex)
         if (c == failed)
             throw std::runtime_error("Invalid symbol in hex string");
         n = static_cast<unsigned char>(n | c);
-        res[count++] = n;
+        res[--count] = n;
     }
     return res;
 }
@@ -176,7 +438,7 @@ std::string uint256_to_hex(const uint256_t& v)
    static const char hexmap[16] = { '0', '1', '2', '3', '4', '5', '6', '7',
                                     '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
    rv.reserve(v.size() * 2);
-   for(auto c = v.rend(); c != v.rbegin(); c++)
+   for(auto c = v.rbegin(); c != v.rend(); c++)
    {
        unsigned char val = *c;
        rv.push_back(hexmap[val>>4]);
@@ -0,0 +1,226 @@
+// Copyright (c) 2020 gladcow
+// Copyright (c) 2021 Thomas Mueller Graf, Daniel Lemire
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <fuse_filter.h>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace btc_utils
+{
+
+static const int MAX_ITERATIONS = 100;
+
+static uint64_t murmur64(uint64_t h)
+{
+   h ^= h >> 33;
+   h *= 0xff51afd7ed558ccdull;
+   h ^= h >> 33;
+   h *= 0xc4ceb9fe1a85ec53ull;
+   h ^= h >> 33;
+   return h;
+}
+
+static uint64_t splitmix64(uint64_t& state)
+{
+   uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+   z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+   z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+   return z ^ (z >> 31);
+}
+
+static uint8_t mod3(uint8_t x)
+{
+   return x > 2 ? static_cast<uint8_t>(x - 3) : x;
+}
+
+uint64_t binary_fuse_filter_t::mix(uint64_t key, uint64_t seed)
+{
+   return murmur64(key + seed);
+}
+
+binary_fuse_filter_t::binary_fuse_filter_t() :
+   params_(), segment_length_mask_(0), segment_count_length_(0), fingerprints_(nullptr)
+{
+}
+
+binary_fuse_filter_t::binary_fuse_filter_t(const binary_fuse_filter_t& other) :
+   params_(other.params_), segment_length_mask_(other.segment_length_mask_),
+   segment_count_length_(other.segment_count_length_), owned_(other.owned_),
+   fingerprints_(other.owned_.empty() ? other.fingerprints_ : owned_.data())
+{
+}
+
+binary_fuse_filter_t& binary_fuse_filter_t::operator=(const binary_fuse_filter_t& other)
+{
+   if (this != &other)
+   {
+      params_ = other.params_;
+      segment_length_mask_ = other.segment_length_mask_;
+      segment_count_length_ = other.segment_count_length_;
+      owned_ = other.owned_;
+      fingerprints_ = other.owned_.empty() ? other.fingerprints_ : owned_.data();
+   }
+   return *this;
+}
+
+void binary_fuse_filter_t::init(uint32_t size)
+{
+   const uint32_t arity = 3;
+   uint32_t segment_length = size == 0 ? 4 :
+      1u << static_cast<int>(std::floor(std::log(static_cast<double>(size)) / std::log(3.33) + 2.25));
+   segment_length = std::min<uint32_t>(segment_length, 262144);
+   double size_factor = size <= 1 ? 0 :
+      std::max(1.125, 0.875 + 0.25 * std::log(1000000.0) / std::log(static_cast<double>(size)));
+   uint64_t capacity = static_cast<uint64_t>(std::round(static_cast<double>(size) * size_factor));
+   uint64_t segments = (capacity + segment_length - 1) / segment_length;
+   uint32_t segment_count = segments > arity - 1 ? static_cast<uint32_t>(segments - (arity - 1)) : 1;
+
+   params_.segment_length = segment_length;
+   params_.segment_count = segment_count;
+   params_.array_length = (segment_count + arity - 1) * segment_length;
+   params_.reserved = 0;
+   segment_length_mask_ = segment_length - 1;
+   segment_count_length_ = segment_count * segment_length;
+}
+
+uint32_t binary_fuse_filter_t::hash_index(int index, uint64_t hash) const
+{
+   uint64_t h = static_cast<uint64_t>((static_cast<unsigned __int128>(hash) * segment_count_length_) >> 64);
+   h += static_cast<uint64_t>(index) * params_.segment_length;
+   // index 0 uses no bits of the hash, 1 the bits from 18, 2 the lowest ones
+   uint64_t hh = hash & ((1ull << 36) - 1);
+   h ^= (hh >> (36 - 18 * index)) & segment_length_mask_;
+   return static_cast<uint32_t>(h);
+}
+
+void binary_fuse_filter_t::attach(const params_t& params, const uint8_t* fingerprints)
+{
+   params_ = params;
+   segment_length_mask_ = params.segment_length - 1;
+   segment_count_length_ = params.segment_count * params.segment_length;
+   owned_.clear();
+   owned_.shrink_to_fit();
+   fingerprints_ = fingerprints;
+}
+
+void binary_fuse_filter_t::build(const std::vector<uint64_t>& keys)
+{
+   if (keys.size() > 0xffffffffu)
+      throw std::runtime_error("binary_fuse_filter_t: too many keys");
+   uint32_t size = static_cast<uint32_t>(keys.size());
+   init(size);
+   owned_.assign(params_.array_length, 0);
+   fingerprints_ = owned_.data();
+   if (size == 0)
+      return;
+
+   uint32_t capacity = params_.array_length;
+   std::vector<uint64_t> reverse_order(size + 1, 0);
+   std::vector<uint32_t> alone(capacity);
+   std::vector<uint8_t> t2count(capacity, 0);
+   std::vector<uint8_t> reverse_h(size);
+   std::vector<uint64_t> t2hash(capacity, 0);
+
+   uint32_t block_bits = 1;
+   while ((1u << block_bits) < params_.segment_count)
+      block_bits++;
+   uint32_t block = 1u << block_bits;
+   std::vector<uint32_t> start_pos(block);
+   uint32_t h012[5];
+
+   uint64_t rng = 0x726b2b9d438b9d4dull;
+   params_.seed = splitmix64(rng);
+   reverse_order[size] = 1;
+   for (int loop = 0; ; loop++)
+   {
+      if (loop + 1 > MAX_ITERATIONS)
+         throw std::runtime_error("binary_fuse_filter_t: construction failed, are the keys distinct?");
+      // sort the hashes roughly by segment, this keeps the table accesses local
+      for (uint32_t i = 0; i < block; i++)
+         start_pos[i] = static_cast<uint32_t>((static_cast<uint64_t>(i) * size) >> block_bits);
+      for (uint32_t i = 0; i < size; i++)
+      {
+         uint64_t hash = mix(keys[i], params_.seed);
+         uint64_t segment_index = hash >> (64 - block_bits);
+         while (reverse_order[start_pos[segment_index]] != 0)
+            segment_index = (segment_index + 1) & (block - 1);
+         reverse_order[start_pos[segment_index]] = hash;
+         start_pos[segment_index]++;
+      }
+      bool error = false;
+      for (uint32_t i = 0; i < size; i++)
+      {
+         uint64_t hash = reverse_order[i];
+         uint32_t h0 = hash_index(0, hash);
+         uint32_t h1 = hash_index(1, hash);
+         uint32_t h2 = hash_index(2, hash);
+         t2count[h0] = static_cast<uint8_t>(t2count[h0] + 4);
+         t2hash[h0] ^= hash;
+         t2count[h1] = static_cast<uint8_t>((t2count[h1] + 4) ^ 1);
+         t2hash[h1] ^= hash;
+         t2count[h2] = static_cast<uint8_t>((t2count[h2] + 4) ^ 2);
+         t2hash[h2] ^= hash;
+         error = error || t2count[h0] < 4 || t2count[h1] < 4 || t2count[h2] < 4;
+      }
+      if (!error)
+      {
+         // peel: queue the slots with a single key
+         uint32_t qsize = 0;
+         for (uint32_t i = 0; i < capacity; i++)
+         {
+            alone[qsize] = i;
+            qsize += (t2count[i] >> 2) == 1 ? 1u : 0u;
+         }
+         uint32_t stack_size = 0;
+         while (qsize > 0)
+         {
+            qsize--;
+            uint32_t index = alone[qsize];
+            if ((t2count[index] >> 2) != 1)
+               continue;
+            uint64_t hash = t2hash[index];
+            h012[1] = hash_index(1, hash);
+            h012[2] = hash_index(2, hash);
+            h012[3] = hash_index(0, hash);
+            h012[4] = h012[1];
+            uint8_t found = t2count[index] & 3;
+            reverse_h[stack_size] = found;
+            reverse_order[stack_size] = hash;
+            stack_size++;
+            for (uint8_t k = 1; k <= 2; k++)
+            {
+               uint32_t other = h012[found + k];
+               alone[qsize] = other;
+               qsize += (t2count[other] >> 2) == 2 ? 1u : 0u;
+               t2count[other] = static_cast<uint8_t>((t2count[other] - 4) ^ mod3(static_cast<uint8_t>(found + k)));
+               t2hash[other] ^= hash;
+            }
+         }
+         if (stack_size == size)
+            break;
+      }
+      std::fill(reverse_order.begin(), reverse_order.begin() + size, 0);
+      std::fill(t2count.begin(), t2count.end(), 0);
+      std::fill(t2hash.begin(), t2hash.end(), 0);
+      params_.seed = splitmix64(rng);
+   }
+
+   for (uint32_t i = size; i-- > 0; )
+   {
+      uint64_t hash = reverse_order[i];
+      uint8_t xor2 = static_cast<uint8_t>(hash ^ (hash >> 32));
+      h012[0] = hash_index(0, hash);
+      h012[1] = hash_index(1, hash);
+      h012[2] = hash_index(2, hash);
+      h012[3] = h012[0];
+      h012[4] = h012[1];
+      uint8_t found = reverse_h[i];
+      owned_[h012[found]] = static_cast<uint8_t>(xor2 ^ owned_[h012[found + 1]] ^ owned_[h012[found + 2]]);
+   }
+}
+
+}
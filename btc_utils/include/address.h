@@ -9,6 +9,8 @@
 #include "crypto.h"
 
 #include <string>
+#include <string_view>
+#include <variant>
 #include <vector>
 
 namespace btc_utils
@@ -21,7 +23,9 @@ namespace btc_utils
  *  * script_hash_tx_destination_t: TX_SCRIPTHASH destination (P2SH)
  *  * witness_v0_script_hash_tx_destination_t: TX_WITNESS_V0_SCRIPTHASH destination (P2WSH)
  *  * witness_v0_key_hash_tx_destination_t: TX_WITNESS_V0_KEYHASH destination (P2WPKH)
+ *  * witness_v1_taproot_tx_destination_t: TX_WITNESS_V1_TAPROOT destination (P2TR)
  *  * witness_unknown_tx_destination_t: TX_WITNESS_UNKNOWN destination (P2W???)
+ *  * pub_key_t: TX_PUBKEY destination (P2PK), its address is the P2PKH one
  */
 struct no_destination_t
 {
@@ -53,6 +57,12 @@ struct witness_v0_script_hash_tx_destination_t
    explicit witness_v0_script_hash_tx_destination_t(const uint256_t& hash) : data_(hash) {}
 };
 
+struct witness_v1_taproot_tx_destination_t
+{
+   uint256_t data_; //!< x-only output key
+   explicit witness_v1_taproot_tx_destination_t(const uint256_t& key) : data_(key) {}
+};
+
 struct witness_unknown_tx_destination_t
 {
    unsigned int version_;
@@ -60,13 +70,45 @@ struct witness_unknown_tx_destination_t
    std::array<unsigned char, 40> program_;
 };
 
+typedef std::variant<
+   no_destination_t,
+   pub_key_t,
+   pk_hash_tx_destination_t,
+   script_hash_tx_destination_t,
+   witness_v0_key_hash_tx_destination_t,
+   witness_v0_script_hash_tx_destination_t,
+   witness_v1_taproot_tx_destination_t,
+   witness_unknown_tx_destination_t
+> tx_destination_t;
+
+/** Encode destination for the network selected by g_network */
 std::string encode_destination(const no_destination_t& dest);
+std::string encode_destination(const pub_key_t& dest);
 std::string encode_destination(const pk_hash_tx_destination_t& dest);
 std::string encode_destination(const script_hash_tx_destination_t& dest);
 std::string encode_destination(const witness_v0_key_hash_tx_destination_t& dest);
 std::string encode_destination(const witness_v0_script_hash_tx_destination_t& dest);
+std::string encode_destination(const witness_v1_taproot_tx_destination_t& dest);
 std::string encode_destination(const witness_unknown_tx_destination_t& dest);
 
+/** Encode destination for the network given by compile-time parameters P (one of chain_params<N>) */
+template<typename P> std::string encode_destination(const no_destination_t& dest);
+template<typename P> std::string encode_destination(const pub_key_t& dest);
+template<typename P> std::string encode_destination(const pk_hash_tx_destination_t& dest);
+template<typename P> std::string encode_destination(const script_hash_tx_destination_t& dest);
+template<typename P> std::string encode_destination(const witness_v0_key_hash_tx_destination_t& dest);
+template<typename P> std::string encode_destination(const witness_v0_script_hash_tx_destination_t& dest);
+template<typename P> std::string encode_destination(const witness_v1_taproot_tx_destination_t& dest);
+template<typename P> std::string encode_destination(const witness_unknown_tx_destination_t& dest);
+
+/** Decode an address of the network given by P (one of chain_params<N>) without allocating.
+ *  Returns no_destination_t if the address is invalid or belongs to another network.
+ *  Witness v1+ addresses must use the bech32m checksum (BIP 350).
+ */
+template<typename P> tx_destination_t decode_destination(std::string_view str);
+/** Decode an address of the network selected by g_network */
+tx_destination_t decode_destination(std::string_view str);
+
 }
 
 #endif // BTC_UTILS_ADDRESS_H__
@@ -0,0 +1,62 @@
+// Copyright (c) 2020 gladcow
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BTC_UTILS_ARENA_H__
+#define BTC_UTILS_ARENA_H__
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+namespace btc_utils
+{
+
+/** Bump allocator for objects that die together, e.g. everything deserialized
+ *  from one block. Allocation only advances a pointer in the current chunk and
+ *  deallocation is a no-op; reset() makes all memory available again at once.
+ *  Chunks are kept across resets, so after the first few blocks the arena
+ *  stops calling the global allocator. Not thread safe.
+ *
+ *  Every object allocated from the arena must be destroyed before reset().
+ */
+class block_arena_t: public std::pmr::memory_resource
+{
+private:
+   struct chunk_t
+   {
+      std::unique_ptr<unsigned char[]> data_;
+      size_t size_;
+   };
+
+   std::vector<chunk_t> chunks_;
+   size_t current_;  //!< index of the chunk we allocate from
+   size_t offset_;   //!< first free byte in the current chunk
+   size_t chunk_size_; //!< size of the next chunk to allocate
+
+protected:
+   void* do_allocate(size_t bytes, size_t alignment) override;
+   void do_deallocate(void*, size_t, size_t) override {}
+   bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+   {
+      return this == &other;
+   }
+
+public:
+   explicit block_arena_t(size_t initial_size = 16 * 1024 * 1024);
+
+   // Disallow copies
+   block_arena_t(const block_arena_t&) = delete;
+   block_arena_t& operator=(const block_arena_t&) = delete;
+
+   //! make all allocated memory available again, keeping the chunks
+   void reset();
+
+   //! total size of the chunks owned by the arena
+   size_t capacity() const;
+};
+
+}
+
+#endif // BTC_UTILS_ARENA_H__
@@ -7,13 +7,15 @@
 // separator character (1), and a base32 data section, the last
 // 6 characters of which are a checksum.
 //
-// For more information, see BIP 173.
+// For more information, see BIP 173. Bech32m differs only in the checksum
+// constant; it encodes witness programs of version 1 and later (BIP 350).
 
 #ifndef BTC_UTILS_BECH32_H
 #define BTC_UTILS_BECH32_H
 
 #include <stdint.h>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace btc_utils
@@ -46,11 +48,36 @@ bool ConvertBits(const O& outfn, I it, I end) {
 namespace bech32
 {
 
-/** Encode a Bech32 string. If hrp contains uppercase characters, this will cause an assertion error. */
-std::string Encode(const std::string& hrp, const std::vector<uint8_t>& values);
+enum class Encoding {
+    INVALID, //!< Failed decoding
 
-/** Decode a Bech32 string. Returns (hrp, data). Empty hrp means failure. */
-std::pair<std::string, std::vector<uint8_t>> Decode(const std::string& str);
+    BECH32,  //!< Bech32 encoding as defined in BIP173
+    BECH32M, //!< Bech32m encoding as defined in BIP350
+};
+
+/** Encode a Bech32 or Bech32m string. Throws std::runtime_error if hrp contains uppercase characters. */
+std::string Encode(Encoding encoding, std::string_view hrp, const std::vector<uint8_t>& values);
+/** Encode count 5-bit values, the string is the only allocation. */
+std::string Encode(Encoding encoding, std::string_view hrp, const uint8_t* values, size_t count);
+
+struct DecodeResult
+{
+    Encoding encoding;         //!< What encoding was detected in the result; Encoding::INVALID if failed.
+    std::string hrp;           //!< The human readable part
+    std::vector<uint8_t> data; //!< The payload (excluding checksum)
+
+    DecodeResult() : encoding(Encoding::INVALID) {}
+    DecodeResult(Encoding enc, std::string&& h, std::vector<uint8_t>&& d) : encoding(enc), hrp(std::move(h)), data(std::move(d)) {}
+};
+
+/** Decode a Bech32 or Bech32m string. */
+DecodeResult Decode(const std::string& str);
+
+/** Decode a segwit address with the human-readable part hrp without allocating. The checksum
+ *  must be bech32 for witness version 0 and bech32m for later versions (BIP 350). The program,
+ *  up to 40 bytes, is written to program; its length is not checked against the version. */
+bool DecodeWitnessProgram(std::string_view str, std::string_view hrp, unsigned int& version,
+                          unsigned char* program, size_t& length);
 
 } // namespace bech32
 } // namespace btc_utils
@@ -16,6 +16,8 @@ namespace btc_utils
 class block_t
 {
 public:
+   typedef tx_allocator_t allocator_type;
+
    uint32_t version_;
    uint256_t prev_block_hash_;
    uint256_t merkle_root_;
@@ -23,7 +25,16 @@ public:
    uint32_t bits_;
    uint32_t nonce_;
 
-   std::vector<transaction_t> txes_;
+   std::pmr::vector<transaction_t> txes_;
+
+   block_t() = default;
+   block_t(const block_t&) = default;
+   block_t(block_t&&) = default;
+   block_t& operator=(const block_t&) = default;
+   block_t& operator=(block_t&&) = default;
+
+   explicit block_t(const allocator_type& alloc) :
+      version_(0), prev_block_hash_(), merkle_root_(), time_(0), bits_(0), nonce_(0), txes_(alloc) {}
 
    template<typename T>
    void unserialize(T& data_source)
@@ -37,6 +48,20 @@ public:
       data_source.unserialize(txes_);
    }
 
+   template<typename T>
+   void serialize(T& sink) const
+   {
+      sink.serialize(version_);
+      sink.serialize(prev_block_hash_);
+      sink.serialize(merkle_root_);
+      sink.serialize(time_);
+      sink.serialize(bits_);
+      sink.serialize(nonce_);
+      sink.serialize(txes_);
+   }
+
+   //! hash of the 80-byte header
+   uint256_t get_hash() const;
 };
 
 }
@@ -0,0 +1,155 @@
+// Copyright (c) 2020 gladcow
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BTC_UTILS_BLOCK_INDEX_H__
+#define BTC_UTILS_BLOCK_INDEX_H__
+
+#include <chainparams.h>
+#include <crypto.h>
+#include <mapped_file.h>
+#include <span.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace btc_utils
+{
+
+/** A block record of a blk file: the header fields that order the chain
+ *  and where the serialized block is, offset being past its magic and size */
+struct block_location_t
+{
+   uint256_t hash;
+   uint256_t prev;
+   uint32_t time;
+   uint32_t bits;
+   uint32_t file;
+   uint32_t size;
+   uint32_t tx_count;  //!< 0 if the record is too short to hold it
+   uint64_t offset;
+};
+
+/**
+ * Appends the block records of the contents of blk file number file to
+ * blocks, reading only their magic, size, 80-byte header and transaction
+ * count. Bytes between records are skipped one at a time to the next
+ * message_start, like the full parse does; bodies are not checked, so a
+ * record with a damaged body is listed all the same. Returns the number of bytes outside of the records.
+ */
+uint64_t scan_block_headers(byte_span_t data, const start_marker_t message_start, uint32_t file,
+                            std::vector<block_location_t>& blocks);
+
+/**
+ * Scans the blk files paths, numbered by their position, on up to threads
+ * threads (0 - one per core). Each file is memory mapped and only the pages
+ * of the headers are read. The blocks are returned in file and offset order;
+ * throws std::runtime_error if a file can't be mapped.
+ */
+std::vector<block_location_t> scan_block_files(const std::vector<std::string>& paths,
+                                               const start_marker_t message_start,
+                                               uint64_t& skipped_bytes, unsigned int threads = 0);
+
+/** A block of the best chain as saved in a block index file, host byte order */
+struct block_index_entry_t
+{
+   uint256_t hash;
+   uint64_t offset;  //!< of the block data in blkNNNNN.dat, past its magic and size
+   uint32_t height;
+   uint32_t file;
+   uint32_t size;
+   uint32_t tx_count;
+   uint32_t bits;  //!< the compact target, that gives the work of the block
+};
+
+/** Size and modification time of a blk file when it was indexed. bitcoind
+ *  preallocates blk files, so a file may get new blocks without growing. */
+struct blk_file_state_t
+{
+   uint64_t size;
+   int64_t mtime_ns;
+
+   bool operator==(const blk_file_state_t& other) const { return size == other.size && mtime_ns == other.mtime_ns; }
+   bool operator!=(const blk_file_state_t& other) const { return !(*this == other); }
+};
+
+/**
+ * Where every block of the best chain is stored, ordered by height, so the
+ * blocks of a height range are found without reading any blk file. It is
+ * built from a header scan and can be saved to a file and memory mapped
+ * back, like watchlist_t. The records off the best chain are kept too, and
+ * the state of every blk file, so that after the node wrote more blocks only
+ * the changed and new files have to be scanned again.
+ */
+class block_index_t
+{
+private:
+   std::vector<block_index_entry_t> store_;
+   std::vector<block_location_t> stale_store_;
+   std::vector<blk_file_state_t> file_store_;
+   std::unique_ptr<mapped_file_t> file_;
+   const block_index_entry_t* entries_;
+   size_t size_;
+   const block_location_t* stale_;  //!< records off the best chain, duplicates left out
+   size_t stale_size_;
+   const blk_file_state_t* files_;
+   size_t file_count_;
+
+   //! whether the records of blk file number file are not those the index holds
+   bool changed(uint32_t file, const std::vector<blk_file_state_t>& files) const
+   {
+      return file >= file_count_ || file >= files.size() || files_[file] != files[file];
+   }
+
+public:
+   static const uint32_t FILE_VERSION = 3;
+
+   block_index_t();
+   ~block_index_t();
+
+   block_index_t(const block_index_t&) = delete;
+   block_index_t& operator=(const block_index_t&) = delete;
+
+   /** Replaces the contents with the chain of the most work, summed from
+    *  the bits of the headers, that blocks link from a block with a null prev
+    *  hash; the first one seen in file order wins a tie. Duplicate records are left out of both the chain and the stale
+    *  records, and so are blocks whose ancestors are missing from the chain.
+    *  files are the states of the scanned blk files. */
+   void build(std::vector<block_location_t> blocks, const std::vector<blk_file_state_t>& files);
+
+   //! the numbers of the blk files of files that changed since the index was built or are new
+   std::vector<uint32_t> changed_files(const std::vector<blk_file_state_t>& files) const;
+
+   /** Rebuilds from blocks, the records of changed_files(files), and the
+    *  records the index holds of the other files; those of files that are
+    *  gone are dropped */
+   void update(const std::vector<block_location_t>& blocks, const std::vector<blk_file_state_t>& files);
+
+   //! writes the index, throws std::runtime_error on failure
+   void save(const std::string& path) const;
+   //! replaces the contents with a memory mapped saved index, throws std::runtime_error on failure
+   void load(const std::string& path);
+
+   //! number of blocks, the height of the tip plus one
+   size_t size() const { return size_; }
+   const block_index_entry_t& operator[](size_t height) const { return entries_[height]; }
+   size_t stale_count() const { return stale_size_; }
+   //! number of blk files indexed
+   size_t file_count() const { return file_count_; }
+
+   /** The blocks of the heights [begin, end) in file and offset order, the
+    *  order in which reading them only goes forward in each file */
+   std::vector<const block_index_entry_t*> locate(size_t begin, size_t end) const;
+};
+
+/** Splits blocks into parts runs of about the same number of bytes and
+ *  returns the position of the first block of run part, blocks.size() for
+ *  part == parts. Runs of blocks in file order are read sequentially and
+ *  their outputs put together are those of all the blocks. */
+size_t split_by_size(const std::vector<const block_index_entry_t*>& blocks, unsigned int parts, unsigned int part);
+
+}
+
+#endif // BTC_UTILS_BLOCK_INDEX_H__
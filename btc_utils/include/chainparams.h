@@ -5,6 +5,7 @@
 #ifndef BTC_UTILS_CHAINPARAMS_H__
 #define BTC_UTILS_CHAINPARAMS_H__
 
+#include <stdexcept>
 #include <vector>
 #include <string>
 
@@ -15,9 +16,11 @@ enum network_t
 {
    mainnet,
    testnet,
-   regtest
+   regtest,
+   signet
 };
 
+/** Network used by the functions without compile-time network parameter */
 extern network_t g_network;
 
 /** The maximum allowed size for a serialized block, in bytes (only for buffer size limits) */
@@ -26,6 +29,76 @@ constexpr unsigned int MESSAGE_START_SIZE = 4;
 
 typedef unsigned char start_marker_t[MESSAGE_START_SIZE];
 
+/**
+ * Compile-time network parameters. Code templated on chain_params<N> gets
+ * the address prefixes, bech32 HRP and message start as constants.
+ *
+ * The message start string is designed to be unlikely to occur in normal data.
+ * The characters are rarely used upper ASCII, not valid as UTF-8, and produce
+ * a large 32-bit integer with any alignment.
+ */
+template<network_t N>
+struct chain_params;
+
+template<>
+struct chain_params<network_t::mainnet>
+{
+   static constexpr network_t network = network_t::mainnet;
+   static constexpr unsigned char base_58_pubkey_address_prefix = 0;
+   static constexpr unsigned char base_58_script_address_prefix = 5;
+   static constexpr char bech32_hrp[] = "bc";
+   static constexpr start_marker_t message_start = {0xf9,0xbe,0xb4,0xd9};
+};
+
+template<>
+struct chain_params<network_t::testnet>
+{
+   static constexpr network_t network = network_t::testnet;
+   static constexpr unsigned char base_58_pubkey_address_prefix = 111;
+   static constexpr unsigned char base_58_script_address_prefix = 196;
+   static constexpr char bech32_hrp[] = "tb";
+   static constexpr start_marker_t message_start = {0x0b,0x11,0x09,0x07};
+};
+
+template<>
+struct chain_params<network_t::regtest>
+{
+   static constexpr network_t network = network_t::regtest;
+   static constexpr unsigned char base_58_pubkey_address_prefix = 111;
+   static constexpr unsigned char base_58_script_address_prefix = 196;
+   static constexpr char bech32_hrp[] = "bcrt";
+   static constexpr start_marker_t message_start = {0xfa,0xbf,0xb5,0xda};
+};
+
+/** Default signet (BIP325); custom signets have their own message start */
+template<>
+struct chain_params<network_t::signet>
+{
+   static constexpr network_t network = network_t::signet;
+   static constexpr unsigned char base_58_pubkey_address_prefix = 111;
+   static constexpr unsigned char base_58_script_address_prefix = 196;
+   static constexpr char bech32_hrp[] = "tb";
+   static constexpr start_marker_t message_start = {0x0a,0x03,0xcf,0x40};
+};
+
+/** Call f with a chain_params<N> instance matching the runtime network value */
+template<typename F>
+decltype(auto) visit_chain_params(network_t network, F&& f)
+{
+   switch(network)
+   {
+   case(network_t::mainnet):
+      return f(chain_params<network_t::mainnet>());
+   case(network_t::testnet):
+      return f(chain_params<network_t::testnet>());
+   case(network_t::regtest):
+      return f(chain_params<network_t::regtest>());
+   case(network_t::signet):
+      return f(chain_params<network_t::signet>());
+   }
+   throw std::runtime_error("Unknown network type");
+}
+
 const start_marker_t& message_start();
 
 std::vector<unsigned char> base_58_pubkey_address_prefix();
@@ -0,0 +1,190 @@
+// Copyright (c) 2020 gladcow
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BTC_UTILS_CLOCK_CACHE_H__
+#define BTC_UTILS_CLOCK_CACHE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace btc_utils
+{
+
+/** Bounded key-value cache with CLOCK eviction, not thread safe.
+ *  All memory is allocated by the constructor: the entries live in a fixed
+ *  array swept by the clock hand, and a linear probing index of twice the
+ *  capacity maps key hashes to entries. H is a functor returning a 64-bit
+ *  hash of a key; it does not need to be cryptographic.
+ */
+template<typename K, typename V, typename H>
+class clock_cache_t
+{
+private:
+   static constexpr uint32_t EMPTY = 0xffffffffu;
+
+   struct entry_t
+   {
+      K key;
+      V value;
+      uint64_t hash;
+      bool referenced;
+   };
+
+   std::vector<entry_t> entries_;
+   std::vector<uint32_t> index_;
+   size_t capacity_;
+   size_t mask_;
+   size_t hand_;
+   H hasher_;
+   uint64_t hits_;
+   uint64_t misses_;
+
+   //! position of entry slot in the index, the entry must be present
+   size_t index_position(uint64_t hash, uint32_t slot) const
+   {
+      size_t pos = static_cast<size_t>(hash) & mask_;
+      while (index_[pos] != slot)
+         pos = (pos + 1) & mask_;
+      return pos;
+   }
+
+   //! removes the index position pos, shifting the following run back
+   void erase_position(size_t pos)
+   {
+      size_t next = pos;
+      while (true)
+      {
+         next = (next + 1) & mask_;
+         if (index_[next] == EMPTY)
+            break;
+         size_t home = static_cast<size_t>(entries_[index_[next]].hash) & mask_;
+         // move the entry back unless its home lies cyclically in (pos, next]
+         bool stays = pos <= next ? (home > pos && home <= next) : (home > pos || home <= next);
+         if (!stays)
+         {
+            index_[pos] = index_[next];
+            pos = next;
+         }
+      }
+      index_[pos] = EMPTY;
+   }
+
+   //! index position of key, or the empty position ending its probe sequence
+   size_t probe(const K& key, uint64_t hash) const
+   {
+      size_t pos = static_cast<size_t>(hash) & mask_;
+      while (index_[pos] != EMPTY)
+      {
+         const entry_t& e = entries_[index_[pos]];
+         if (e.hash == hash && e.key == key)
+            break;
+         pos = (pos + 1) & mask_;
+      }
+      return pos;
+   }
+
+   //! stores a new key at the empty index position pos, evicting an entry when full
+   const V& place(const K& key, const V& value, uint64_t hash, size_t pos)
+   {
+      uint32_t slot;
+      if (entries_.size() < capacity_)
+      {
+         slot = static_cast<uint32_t>(entries_.size());
+         entries_.push_back(entry_t{key, value, hash, false});
+      }
+      else
+      {
+         slot = evict();
+         entries_[slot] = entry_t{key, value, hash, false};
+         // the eviction may have shifted the run the new key probes into
+         pos = static_cast<size_t>(hash) & mask_;
+         while (index_[pos] != EMPTY)
+            pos = (pos + 1) & mask_;
+      }
+      index_[pos] = slot;
+      return entries_[slot].value;
+   }
+
+   //! picks the entry to reuse: the first one the hand finds without a second chance
+   uint32_t evict()
+   {
+      while (entries_[hand_].referenced)
+      {
+         entries_[hand_].referenced = false;
+         hand_ = (hand_ + 1) % entries_.size();
+      }
+      uint32_t slot = static_cast<uint32_t>(hand_);
+      hand_ = (hand_ + 1) % entries_.size();
+      erase_position(index_position(entries_[slot].hash, slot));
+      return slot;
+   }
+
+public:
+   explicit clock_cache_t(size_t capacity, H hasher = H()) :
+      capacity_(capacity ? capacity : 1), mask_(0), hand_(0), hasher_(hasher), hits_(0), misses_(0)
+   {
+      entries_.reserve(capacity_);
+      size_t index_size = 1;
+      while (index_size < 2 * capacity_)
+         index_size <<= 1;
+      index_.assign(index_size, EMPTY);
+      mask_ = index_size - 1;
+   }
+
+   size_t capacity() const { return capacity_; }
+   size_t size() const { return entries_.size(); }
+   uint64_t hits() const { return hits_; }
+   uint64_t misses() const { return misses_; }
+
+   /** Returns the cached value of key or nullptr, counting a hit or a miss.
+    *  The pointer is valid until the next insertion. */
+   const V* find(const K& key)
+   {
+      uint64_t hash = hasher_(key);
+      size_t pos = probe(key, hash);
+      if (index_[pos] == EMPTY)
+      {
+         misses_++;
+         return nullptr;
+      }
+      hits_++;
+      entry_t& e = entries_[index_[pos]];
+      e.referenced = true;
+      return &e.value;
+   }
+
+   /** Inserts or replaces the value of key, without counting a lookup */
+   void insert(const K& key, const V& value)
+   {
+      uint64_t hash = hasher_(key);
+      size_t pos = probe(key, hash);
+      if (index_[pos] != EMPTY)
+         entries_[index_[pos]].value = value;
+      else
+         place(key, value, hash, pos);
+   }
+
+   /** Returns the cached value of key, computing and inserting it with
+    *  compute(key) on a miss. The reference is valid until the next call. */
+   template<typename F>
+   const V& get(const K& key, F&& compute)
+   {
+      uint64_t hash = hasher_(key);
+      size_t pos = probe(key, hash);
+      if (index_[pos] != EMPTY)
+      {
+         hits_++;
+         entry_t& e = entries_[index_[pos]];
+         e.referenced = true;
+         return e.value;
+      }
+      misses_++;
+      return place(key, compute(key), hash, pos);
+   }
+};
+
+}
+
+#endif // BTC_UTILS_CLOCK_CACHE_H__
@@ -6,7 +6,13 @@
 #ifndef BTC_UTILS_CRYPTO_H__
 #define BTC_UTILS_CRYPTO_H__
 
+#include <span.h>
+#include <algorithm>
 #include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
 #include <vector>
 
 namespace btc_utils
@@ -16,16 +22,33 @@ typedef std::array<unsigned char,  20> uint160_t;
 typedef std::array<unsigned char,  32> uint256_t;
 
 std::vector<unsigned char> from_hex(const std::string& hex);
-std::string to_hex(const std::vector<unsigned char>& v);
+std::string to_hex(byte_span_t data);
 
+/** uint256 hex conversion in the byte-reversed order bitcoin displays hashes in */
 uint256_t uint256_from_hex(const std::string& hex);
 std::string uint256_to_hex(const uint256_t& v);
 
 uint256_t hash_sha256(const std::vector<unsigned char>& data);
 uint160_t hash_ripemd160(const std::vector<unsigned char>& data);
-
-std::string encode_base58(const std::vector<unsigned char>& data);
-std::string encode_base58_check(const std::vector<unsigned char>& data);
+//! SHA256(SHA256(data)), the hash of block headers and transactions
+uint256_t hash_sha256d(byte_span_t data);
+//! RIPEMD160(SHA256(data)), the hash of P2PKH and P2SH addresses, without allocating
+uint160_t hash160(byte_span_t data);
+/** hash160 of count inputs into out. Hashing them back to back, instead of one
+ *  at a time in between script matching, keeps the hash code and tables hot. */
+void hash160_batch(const byte_span_t* inputs, size_t count, uint160_t* out);
+
+std::string encode_base58(byte_span_t data);
+std::string encode_base58_check(byte_span_t data);
+
+/** Decode a base58 string into ret, returns false on invalid characters or
+ *  if the result would be longer than max_ret_len */
+bool decode_base58(const std::string& str, std::vector<unsigned char>& ret, size_t max_ret_len);
+/** Decode a base58 string and verify and strip its 4-byte checksum */
+bool decode_base58_check(const std::string& str, std::vector<unsigned char>& ret, size_t max_ret_len);
+/** Decode a base58check string with a payload of exactly len (at most 64) bytes into out without
+ *  allocating, returns false on invalid characters, another length or a bad checksum */
+bool decode_base58_check(std::string_view str, unsigned char* out, size_t len);
 
 class key_id_t: public uint160_t
 {
@@ -59,7 +82,7 @@ private:
         data_[0] = 0xff;
     }
 public:
-    bool static valid_size(const std::vector<unsigned char> &vch) {
+    bool static valid_size(byte_span_t vch) {
       return vch.size() > 0 && get_len(vch[0]) == vch.size();
     }
 
@@ -84,14 +107,34 @@ public:
         set(pbegin, pend);
     }
 
-    key_id_t get_id() const
+    bool is_valid() const
+    {
+        return get_len(data_[0]) != 0;
+    }
+
+    bool operator==(const pub_key_t& other) const
     {
-        std::vector<unsigned char> tmp(data_.begin(), data_.begin() + get_len(data_[0]));
-        uint256_t h = hash_sha256(tmp);
-        return hash_ripemd160(std::vector<unsigned char>(h.begin(), h.end()));
+        return data_[0] == other.data_[0] &&
+               std::equal(data_.begin(), data_.begin() + get_len(data_[0]), other.data_.begin());
+    }
+
+    byte_span_t bytes() const
+    {
+        return byte_span_t(data_.data(), get_len(data_[0]));
+    }
+
+    //! hash160 of the key through the per-thread key id cache, P2PK keys are often reused
+    key_id_t get_id() const;
+    //! hash160 of the key, without the cache
+    key_id_t compute_id() const
+    {
+        return hash160(bytes());
     }
 };
 
+/** Lookups and misses of the key id cache of the calling thread */
+void get_pub_key_cache_stats(uint64_t& hits, uint64_t& misses);
+
 class priv_key_t
 {
 private:
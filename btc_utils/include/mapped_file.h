@@ -0,0 +1,37 @@
+// Copyright (c) 2020 gladcow
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BTC_UTILS_MAPPED_FILE_H__
+#define BTC_UTILS_MAPPED_FILE_H__
+
+#include <cstddef>
+#include <string>
+
+namespace btc_utils
+{
+
+/** Read-only memory mapping of a whole file, throws std::runtime_error on failure */
+class mapped_file_t
+{
+private:
+   const unsigned char* data_;
+   size_t size_;
+
+public:
+   explicit mapped_file_t(const std::string& path);
+   ~mapped_file_t();
+
+   mapped_file_t(const mapped_file_t&) = delete;
+   mapped_file_t& operator=(const mapped_file_t&) = delete;
+
+   //! tell the kernel that reads are sparse, so faults don't read ahead
+   void advise_random() const;
+
+   const unsigned char* data() const { return data_; }
+   size_t size() const { return size_; }
+};
+
+}
+
+#endif // BTC_UTILS_MAPPED_FILE_H__
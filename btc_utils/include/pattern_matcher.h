@@ -0,0 +1,122 @@
+// Copyright (c) 2020 gladcow
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BTC_UTILS_PATTERN_MATCHER_H__
+#define BTC_UTILS_PATTERN_MATCHER_H__
+
+#include "span.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace btc_utils
+{
+
+/** Aho-Corasick automaton over byte patterns, compiled into a dense DFA.
+ *  Every text byte costs one table lookup however many patterns there are.
+ *  Bytes that occur in no pattern share one column, so the table has
+ *  states * (distinct pattern bytes + 1) entries.
+ */
+class multi_pattern_matcher_t
+{
+public:
+   static constexpr uint32_t NO_MATCH = 0xffffffffu;
+
+   struct pattern_t
+   {
+      std::vector<unsigned char> bytes;
+      uint32_t id;
+   };
+
+   /** State of an anchored match of a text given in pieces */
+   struct prefix_state_t
+   {
+      uint32_t state = 0;
+      uint32_t match = NO_MATCH;  //!< id of the longest pattern the text seen so far starts with
+      bool failed = false;        //!< no longer pattern can match
+   };
+
+private:
+   uint8_t classes_[256];
+   uint32_t class_count_;
+   std::vector<uint32_t> next_;    //!< state * class_count_ + class
+   std::vector<uint32_t> depth_;
+   std::vector<uint32_t> output_;  //!< id of the longest pattern ending in the state
+   std::vector<uint32_t> dict_;    //!< next state on the failure chain with an output, 0 if none
+
+public:
+   //! matches nothing until built
+   multi_pattern_matcher_t();
+
+   /** Compile the patterns, throws std::runtime_error on an empty pattern.
+    *  Of equal patterns the id of the first one is kept. */
+   void build(const std::vector<pattern_t>& patterns);
+
+   size_t state_count() const { return depth_.size(); }
+
+   /** Continue an anchored match with the next piece of the text */
+   void match_prefix(prefix_state_t& st, byte_span_t piece) const
+   {
+      for (size_t i = 0; i < piece.size() && !st.failed; i++)
+      {
+         uint32_t next = next_[st.state * class_count_ + classes_[piece[i]]];
+         // a transition that is not a trie edge means the text left every pattern
+         if (depth_[next] != depth_[st.state] + 1)
+         {
+            st.failed = true;
+            break;
+         }
+         st.state = next;
+         if (output_[next] != NO_MATCH)
+            st.match = output_[next];
+      }
+   }
+
+   /** Id of the longest pattern text starts with, or NO_MATCH */
+   uint32_t match_prefix(byte_span_t text) const
+   {
+      prefix_state_t st;
+      match_prefix(st, text);
+      return st.match;
+   }
+
+   /** Id of the pattern that ends first in text, the longest of those ending
+    *  at the same byte, or NO_MATCH */
+   uint32_t find_first(byte_span_t text) const
+   {
+      uint32_t state = 0;
+      for (size_t i = 0; i < text.size(); i++)
+      {
+         state = next_[state * class_count_ + classes_[text[i]]];
+         if (output_[state] != NO_MATCH)
+            return output_[state];
+         if (dict_[state])
+            return output_[dict_[state]];
+      }
+      return NO_MATCH;
+   }
+
+   /** Calls f(id, end) for every occurrence of a pattern in text, end is the
+    *  offset just past it */
+   template<typename F>
+   void find_all(byte_span_t text, F&& f) const
+   {
+      uint32_t state = 0;
+      for (size_t i = 0; i < text.size(); i++)
+      {
+         state = next_[state * class_count_ + classes_[text[i]]];
+         uint32_t out = output_[state] != NO_MATCH ? state : dict_[state];
+         while (out)
+         {
+            f(output_[out], i + 1);
+            out = dict_[out];
+         }
+      }
+   }
+};
+
+}
+
+#endif // BTC_UTILS_PATTERN_MATCHER_H__
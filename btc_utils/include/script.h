@@ -6,12 +6,175 @@
 #ifndef BTC_UTILS_SCRIPT_H__
 #define BTC_UTILS_SCRIPT_H__
 
+#include <address.h>
 #include <crypto.h>
+#include <span.h>
+#include <memory_resource>
+#include <stdexcept>
+#include <variant>
 #include <vector>
 
+/** Signature hash sizes */
+static constexpr size_t WITNESS_V0_SCRIPTHASH_SIZE = 32;
+static constexpr size_t WITNESS_V0_KEYHASH_SIZE = 20;
+static constexpr size_t WITNESS_V1_TAPROOT_SIZE = 32;
+
+/** Largest n of a bare n-key multisig output, n is a small integer opcode */
+static constexpr unsigned int MAX_MULTISIG_KEYS = 16;
+
 namespace btc_utils
 {
 
+/** Script opcodes */
+enum opcode_t
+{
+    // push value
+    OP_0 = 0x00,
+    OP_FALSE = OP_0,
+    OP_PUSHDATA1 = 0x4c,
+    OP_PUSHDATA2 = 0x4d,
+    OP_PUSHDATA4 = 0x4e,
+    OP_1NEGATE = 0x4f,
+    OP_RESERVED = 0x50,
+    OP_1 = 0x51,
+    OP_TRUE=OP_1,
+    OP_2 = 0x52,
+    OP_3 = 0x53,
+    OP_4 = 0x54,
+    OP_5 = 0x55,
+    OP_6 = 0x56,
+    OP_7 = 0x57,
+    OP_8 = 0x58,
+    OP_9 = 0x59,
+    OP_10 = 0x5a,
+    OP_11 = 0x5b,
+    OP_12 = 0x5c,
+    OP_13 = 0x5d,
+    OP_14 = 0x5e,
+    OP_15 = 0x5f,
+    OP_16 = 0x60,
+
+    // control
+    OP_NOP = 0x61,
+    OP_VER = 0x62,
+    OP_IF = 0x63,
+    OP_NOTIF = 0x64,
+    OP_VERIF = 0x65,
+    OP_VERNOTIF = 0x66,
+    OP_ELSE = 0x67,
+    OP_ENDIF = 0x68,
+    OP_VERIFY = 0x69,
+    OP_RETURN = 0x6a,
+
+    // stack ops
+    OP_TOALTSTACK = 0x6b,
+    OP_FROMALTSTACK = 0x6c,
+    OP_2DROP = 0x6d,
+    OP_2DUP = 0x6e,
+    OP_3DUP = 0x6f,
+    OP_2OVER = 0x70,
+    OP_2ROT = 0x71,
+    OP_2SWAP = 0x72,
+    OP_IFDUP = 0x73,
+    OP_DEPTH = 0x74,
+    OP_DROP = 0x75,
+    OP_DUP = 0x76,
+    OP_NIP = 0x77,
+    OP_OVER = 0x78,
+    OP_PICK = 0x79,
+    OP_ROLL = 0x7a,
+    OP_ROT = 0x7b,
+    OP_SWAP = 0x7c,
+    OP_TUCK = 0x7d,
+
+    // splice ops
+    OP_CAT = 0x7e,
+    OP_SUBSTR = 0x7f,
+    OP_LEFT = 0x80,
+    OP_RIGHT = 0x81,
+    OP_SIZE = 0x82,
+
+    // bit logic
+    OP_INVERT = 0x83,
+    OP_AND = 0x84,
+    OP_OR = 0x85,
+    OP_XOR = 0x86,
+    OP_EQUAL = 0x87,
+    OP_EQUALVERIFY = 0x88,
+    OP_RESERVED1 = 0x89,
+    OP_RESERVED2 = 0x8a,
+
+    // numeric
+    OP_1ADD = 0x8b,
+    OP_1SUB = 0x8c,
+    OP_2MUL = 0x8d,
+    OP_2DIV = 0x8e,
+    OP_NEGATE = 0x8f,
+    OP_ABS = 0x90,
+    OP_NOT = 0x91,
+    OP_0NOTEQUAL = 0x92,
+
+    OP_ADD = 0x93,
+    OP_SUB = 0x94,
+    OP_MUL = 0x95,
+    OP_DIV = 0x96,
+    OP_MOD = 0x97,
+    OP_LSHIFT = 0x98,
+    OP_RSHIFT = 0x99,
+
+    OP_BOOLAND = 0x9a,
+    OP_BOOLOR = 0x9b,
+    OP_NUMEQUAL = 0x9c,
+    OP_NUMEQUALVERIFY = 0x9d,
+    OP_NUMNOTEQUAL = 0x9e,
+    OP_LESSTHAN = 0x9f,
+    OP_GREATERTHAN = 0xa0,
+    OP_LESSTHANOREQUAL = 0xa1,
+    OP_GREATERTHANOREQUAL = 0xa2,
+    OP_MIN = 0xa3,
+    OP_MAX = 0xa4,
+
+    OP_WITHIN = 0xa5,
+
+    // crypto
+    OP_RIPEMD160 = 0xa6,
+    OP_SHA1 = 0xa7,
+    OP_SHA256 = 0xa8,
+    OP_HASH160 = 0xa9,
+    OP_HASH256 = 0xaa,
+    OP_CODESEPARATOR = 0xab,
+    OP_CHECKSIG = 0xac,
+    OP_CHECKSIGVERIFY = 0xad,
+    OP_CHECKMULTISIG = 0xae,
+    OP_CHECKMULTISIGVERIFY = 0xaf,
+
+    // expansion
+    OP_NOP1 = 0xb0,
+    OP_CHECKLOCKTIMEVERIFY = 0xb1,
+    OP_NOP2 = OP_CHECKLOCKTIMEVERIFY,
+    OP_CHECKSEQUENCEVERIFY = 0xb2,
+    OP_NOP3 = OP_CHECKSEQUENCEVERIFY,
+    OP_NOP4 = 0xb3,
+    OP_NOP5 = 0xb4,
+    OP_NOP6 = 0xb5,
+    OP_NOP7 = 0xb6,
+    OP_NOP8 = 0xb7,
+    OP_NOP9 = 0xb8,
+    OP_NOP10 = 0xb9,
+
+    OP_INVALIDOPCODE = 0xff,
+};
+
+/** Decode small integers: */
+inline int decode_OP_N(opcode_t opcode)
+{
+    if (opcode == OP_0)
+        return 0;
+    if(opcode >= OP_1 && opcode <= OP_16)
+        return static_cast<int>(opcode) - static_cast<int>(OP_1 - 1);
+    throw std::runtime_error("Invalid OP_N");
+}
+
 enum txnouttype
 {
     TX_NONSTANDARD,
@@ -23,12 +186,124 @@ enum txnouttype
     TX_NULL_DATA, //!< unspendable OP_RETURN script that carries data
     TX_WITNESS_V0_SCRIPTHASH,
     TX_WITNESS_V0_KEYHASH,
+    TX_WITNESS_V1_TAPROOT,
     TX_WITNESS_UNKNOWN, //!< Only for Witness versions not already defined above
 };
 
+//! number of txnouttype values, TX_WITNESS_UNKNOWN is kept last
+static const unsigned int TX_TYPE_COUNT = TX_WITNESS_UNKNOWN + 1;
+
+/** Get the name of a txnouttype as a C string, or nullptr if unknown. */
+const char* get_txn_output_type(txnouttype t);
+
 txnouttype solver(const std::vector<unsigned char>& script,
                   std::vector<std::vector<unsigned char>>& solutions);
 
+/**
+ * Allocation-free solver: all matching is done on the script bytes and the
+ * destination is returned by value in the variant. Null data and nonstandard
+ * scripts yield no_destination_t, as do bare multisig outputs (TX_MULTISIG),
+ * whose keys are given by match_multisig().
+ */
+txnouttype solver(byte_span_t script, tx_destination_t& destination);
+
+/**
+ * Match a bare multisig output: OP_m <pubkey>... OP_n OP_CHECKMULTISIG with
+ * 1 <= m <= n <= MAX_MULTISIG_KEYS and directly pushed 33 or 65-byte keys.
+ * The keys are written to keys, room for MAX_MULTISIG_KEYS spans into the script.
+ */
+bool match_multisig(byte_span_t script, unsigned int& required, byte_span_t* keys, unsigned int& count);
+
+/**
+ * Step through the payload of a null data output, the pushes after OP_RETURN.
+ * Start with pos = 1; element is set to the data of the next push or, for
+ * OP_1NEGATE and OP_1..OP_16, to the opcode byte itself (Runes are tagged
+ * with OP_13). Returns false at the end of the script, and on any other
+ * opcode or a truncated push, where pos is left short of the script size.
+ */
+bool next_null_data_element(byte_span_t script, size_t& pos, byte_span_t& element);
+
+/**
+ * Match an input against the standard spends that reveal the spent address:
+ *  * P2PKH: scriptSig <sig> <pubkey>, data is the pubkey
+ *  * P2WPKH: empty scriptSig, witness <sig> <pubkey>, data is the pubkey
+ *  * P2SH-P2WPKH and P2SH-P2WSH: scriptSig is a single push of the witness
+ *    program, data is that redeem script
+ * Returns the type of the spent output (TX_PUBKEYHASH, TX_WITNESS_V0_KEYHASH or
+ * TX_SCRIPTHASH), whose hash is hash160(data), or TX_NONSTANDARD.
+ */
+txnouttype match_spending_input(byte_span_t script_sig,
+                                const std::pmr::vector<std::pmr::vector<unsigned char>>& witness,
+                                byte_span_t& data);
+
+/** Ordinals inscription in a witness item */
+struct inscription_envelope_t
+{
+   byte_span_t content_type;  //!< empty if the inscription has none
+   uint64_t body_size;
+};
+
+/**
+ * Find the next OP_FALSE OP_IF "ord" ... OP_ENDIF inscription envelope in a
+ * witness item, starting at pos. The envelope holds tag and value pushes up to
+ * an empty push (OP_0), then the pushes of the body; tag 1 is the content type.
+ * pos is set past the envelope, returns false once there is none left.
+ */
+bool next_inscription_envelope(byte_span_t item, size_t& pos, inscription_envelope_t& envelope);
+
+/**
+ * Decode the BIP34 block height a coinbase scriptSig starts with: OP_0,
+ * OP_1..OP_16 or a non-negative script number pushed in 1 to 8 bytes.
+ * Before BIP34 activation the first push is whatever the miner put there.
+ */
+bool decode_coinbase_height(byte_span_t script_sig, uint64_t& height);
+
+/** Forwards every alternative of tx_destination_t except no_destination_t to the visitor */
+template<typename V>
+struct destination_forwarder_t
+{
+   V& visitor_;
+
+   void operator()(const no_destination_t&) {}
+
+   template<typename D>
+   void operator()(const D& dest)
+   {
+      visitor_(dest);
+   }
+};
+
+/**
+ * Match script against the standard output templates and call visitor
+ * once for every destination found in it, without building any intermediate
+ * containers. Visitor must be callable with each of
+ *  * pub_key_t: TX_PUBKEY (P2PK), and every key of TX_MULTISIG
+ *  * pk_hash_tx_destination_t: TX_PUBKEYHASH (P2PKH)
+ *  * script_hash_tx_destination_t: TX_SCRIPTHASH (P2SH)
+ *  * witness_v0_key_hash_tx_destination_t: TX_WITNESS_V0_KEYHASH (P2WPKH)
+ *  * witness_v0_script_hash_tx_destination_t: TX_WITNESS_V0_SCRIPTHASH (P2WSH)
+ *  * witness_v1_taproot_tx_destination_t: TX_WITNESS_V1_TAPROOT (P2TR)
+ *  * witness_unknown_tx_destination_t: TX_WITNESS_UNKNOWN (P2W???)
+ * Returns the script type, the same as solver() does.
+ */
+template<typename V>
+txnouttype for_each_destination(byte_span_t script, V&& visitor)
+{
+   tx_destination_t dest;
+   txnouttype type = solver(script, dest);
+   if (type == TX_MULTISIG)
+   {
+      unsigned int required, count;
+      byte_span_t keys[MAX_MULTISIG_KEYS];
+      match_multisig(script, required, keys, count);
+      for (unsigned int i = 0; i < count; i++)
+         visitor(pub_key_t(keys[i].begin(), keys[i].end()));
+      return type;
+   }
+   std::visit(destination_forwarder_t<V>{visitor}, dest);
+   return type;
+}
+
 }
 
 #endif //BTC_UTILS_SCRIPT_H__
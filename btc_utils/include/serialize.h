@@ -0,0 +1,358 @@
+// Copyright (c) 2020 gladcow
+// Copyright (c) 2009-2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BTC_UTILS_SERIALIZE_H__
+#define BTC_UTILS_SERIALIZE_H__
+
+#include <crypto.h>
+#include <span.h>
+
+#include <endian.h>
+#include <cstdint>
+#include <cstring>
+#include <ios>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+namespace btc_utils
+{
+
+/** Upper bound for the sizes read from the compact size fields */
+static const unsigned int MAX_SIZE = 0x02000000;
+
+/** Deserialization of the bitcoin wire format on top of a byte source.
+ *  Derived must provide read(unsigned char* pch, size_t nSize) that throws
+ *  when the data is exhausted. It may provide view(nSize), returning the next
+ *  nSize bytes in place and consuming them, or nullptr if it cannot.
+ */
+template<typename Derived>
+class deserializer_t
+{
+private:
+    Derived& self() { return static_cast<Derived&>(*this); }
+
+public:
+    uint8_t readdata8()
+    {
+       uint8_t obj;
+       self().read(&obj, 1);
+       return obj;
+    }
+
+    uint16_t readdata16()
+    {
+       uint16_t obj;
+       self().read(reinterpret_cast<unsigned char*>(&obj), 2);
+       return le16toh(obj);
+    }
+
+    uint32_t readdata32()
+    {
+       uint32_t obj;
+       self().read(reinterpret_cast<unsigned char*>(&obj), 4);
+       return le32toh(obj);
+    }
+
+    uint64_t readdata64()
+    {
+       uint64_t obj;
+       self().read(reinterpret_cast<unsigned char*>(&obj), 8);
+       return le64toh(obj);
+    }
+
+    uint64_t read_compact_int()
+    {
+        uint8_t ci_size = readdata8();
+        uint64_t res = 0;
+        if (ci_size < 253)
+        {
+            res = ci_size;
+        }
+        else if (ci_size == 253)
+        {
+            res = readdata16();
+            if (res < 253)
+                throw std::runtime_error("non-canonical compact int");
+        }
+        else if (ci_size == 254)
+        {
+            res = readdata32();
+            if (res < 0x10000u)
+                throw std::runtime_error("non-canonical compact int");
+        }
+        else
+        {
+            res = readdata64();
+            if (res < 0x100000000ULL)
+                throw std::runtime_error("non-canonical compact int");
+        }
+        if (res > static_cast<uint64_t>(MAX_SIZE))
+            throw std::runtime_error("compact int is too large");
+        return res;
+    }
+
+    //! bytes left to read, unbounded unless Derived provides remaining()
+    uint64_t remaining()
+    {
+       return std::numeric_limits<uint64_t>::max();
+    }
+
+    /** Returns count if that many elements of at least min_size bytes each
+     *  fit in the bytes left and throws otherwise, so that a damaged count
+     *  does not make a vector allocate room for it */
+    uint64_t check_count(uint64_t count, size_t min_size)
+    {
+       if (count > self().remaining() / min_size)
+           throw std::ios_base::failure("element count past the end of the data");
+       return count;
+    }
+
+    void unserialize(unsigned char& val)
+    {
+       val = readdata8();
+    }
+
+    void unserialize(uint32_t& val)
+    {
+       val = readdata32();
+    }
+
+    void unserialize(uint64_t& val)
+    {
+       val = readdata64();
+    }
+
+    void unserialize(uint256_t& val)
+    {
+       self().read(val.data(), val.size());
+    }
+
+    // Vectors are resized rather than cleared: the elements that are already
+    // there are overwritten in place and keep the capacity of their own
+    // containers, so a recycled block does not allocate in steady state.
+    template<typename T, typename A>
+    void unserialize_items(std::vector<T, A>& v, uint64_t v_size)
+    {
+       v.resize(check_count(v_size, T::MIN_SIZE));
+       for (uint64_t i = 0; i < v_size; i++)
+           v[i].unserialize(self());
+    }
+
+    template<typename T, typename A>
+    void unserialize(std::vector<T, A>& v)
+    {
+       unserialize_items(v, read_compact_int());
+    }
+
+    template<typename A>
+    void unserialize(std::vector<unsigned char, A>& v)
+    {
+       uint64_t v_size = check_count(read_compact_int(), 1);
+       v.resize(v_size);
+       self().read(v.data(), v_size);
+    }
+
+    template<typename A1, typename A2>
+    void unserialize(std::vector<std::vector<unsigned char, A1>, A2>& v)
+    {
+       // every item takes at least its size byte
+       uint64_t v_size = check_count(read_compact_int(), 1);
+       v.resize(v_size);
+       for (uint64_t i = 0; i < v_size; i++)
+           unserialize(v[i]);
+    }
+
+    //! no bytes are read in place unless Derived provides view()
+    const unsigned char* view(size_t)
+    {
+       return nullptr;
+    }
+
+    /** The next size bytes, consumed: in place if Derived::view() has them,
+     *  copied to scratch otherwise */
+    byte_span_t read_span(size_t size, std::vector<unsigned char>& scratch)
+    {
+       const unsigned char* p = self().view(size);
+       if (p)
+          return byte_span_t(p, size);
+       scratch.resize(size);
+       self().read(scratch.data(), size);
+       return byte_span_t(scratch);
+    }
+
+    /** Witness stack of an input. Derived may hide this to look at the items
+     *  without keeping them; the stack must be left with its item count, as
+     *  has_witness() depends on it. */
+    template<typename A1, typename A2>
+    void unserialize_witness(std::vector<std::vector<unsigned char, A1>, A2>& stack)
+    {
+       unserialize(stack);
+    }
+
+    template<typename T>
+    Derived& operator>>(T&& obj) {
+        // Unserialize from this stream
+        obj.unserialize(self());
+        return self();
+    }
+};
+
+/** Deserializes from a block of memory */
+class span_reader_t: public deserializer_t<span_reader_t>
+{
+private:
+    byte_span_t data_;
+    size_t pos_;
+
+public:
+    explicit span_reader_t(byte_span_t data) : data_(data), pos_(0) {}
+
+    //! read a number of bytes
+    void read(unsigned char *pch, size_t nSize)
+    {
+        if (nSize > data_.size() - pos_)
+            throw std::ios_base::failure("span_reader_t::read: end of data");
+        if (nSize)
+            memcpy(pch, data_.data() + pos_, nSize);
+        pos_ += nSize;
+    }
+
+    uint64_t remaining() const { return data_.size() - pos_; }
+
+    //! the next nSize bytes in place
+    const unsigned char* view(size_t nSize)
+    {
+        if (nSize > data_.size() - pos_)
+            throw std::ios_base::failure("span_reader_t::view: end of data");
+        pos_ += nSize;
+        return data_.data() + pos_ - nSize;
+    }
+
+    //! skip a number of bytes
+    void skip(size_t nSize)
+    {
+        if (nSize > data_.size() - pos_)
+            throw std::ios_base::failure("span_reader_t::skip: end of data");
+        pos_ += nSize;
+    }
+
+    size_t pos() const { return pos_; }
+    bool eof() const { return pos_ == data_.size(); }
+};
+
+/** Serializes to the end of a byte vector */
+class vector_writer_t
+{
+private:
+    std::vector<unsigned char>& out_;
+
+public:
+    explicit vector_writer_t(std::vector<unsigned char>& out) : out_(out) {}
+
+    void write(const unsigned char* pch, size_t nSize)
+    {
+        out_.insert(out_.end(), pch, pch + nSize);
+    }
+
+    void writedata8(uint8_t obj)
+    {
+        out_.push_back(obj);
+    }
+
+    void writedata16(uint16_t obj)
+    {
+        obj = htole16(obj);
+        write(reinterpret_cast<const unsigned char*>(&obj), 2);
+    }
+
+    void writedata32(uint32_t obj)
+    {
+        obj = htole32(obj);
+        write(reinterpret_cast<const unsigned char*>(&obj), 4);
+    }
+
+    void writedata64(uint64_t obj)
+    {
+        obj = htole64(obj);
+        write(reinterpret_cast<const unsigned char*>(&obj), 8);
+    }
+
+    void write_compact_int(uint64_t val)
+    {
+        if (val < 253)
+        {
+            writedata8(static_cast<uint8_t>(val));
+        }
+        else if (val <= 0xffff)
+        {
+            writedata8(253);
+            writedata16(static_cast<uint16_t>(val));
+        }
+        else if (val <= 0xffffffff)
+        {
+            writedata8(254);
+            writedata32(static_cast<uint32_t>(val));
+        }
+        else
+        {
+            writedata8(255);
+            writedata64(val);
+        }
+    }
+
+    void serialize(unsigned char val)
+    {
+        writedata8(val);
+    }
+
+    void serialize(uint32_t val)
+    {
+        writedata32(val);
+    }
+
+    void serialize(uint64_t val)
+    {
+        writedata64(val);
+    }
+
+    void serialize(const uint256_t& val)
+    {
+        write(val.data(), val.size());
+    }
+
+    template<typename T, typename A>
+    void serialize(const std::vector<T, A>& v)
+    {
+        write_compact_int(v.size());
+        for (const auto& item: v)
+            item.serialize(*this);
+    }
+
+    template<typename A>
+    void serialize(const std::vector<unsigned char, A>& v)
+    {
+        write_compact_int(v.size());
+        write(v.data(), v.size());
+    }
+
+    template<typename A1, typename A2>
+    void serialize(const std::vector<std::vector<unsigned char, A1>, A2>& v)
+    {
+        write_compact_int(v.size());
+        for (const auto& item: v)
+            serialize(item);
+    }
+
+    template<typename T>
+    vector_writer_t& operator<<(const T& obj) {
+        obj.serialize(*this);
+        return *this;
+    }
+};
+
+}
+
+#endif // BTC_UTILS_SERIALIZE_H__
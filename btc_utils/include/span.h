@@ -0,0 +1,54 @@
+// Copyright (c) 2020 gladcow
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BTC_UTILS_SPAN_H__
+#define BTC_UTILS_SPAN_H__
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+namespace btc_utils
+{
+
+/** Non-owning view of a contiguous sequence of bytes.
+ *  It is only valid while the storage it points to is alive and unchanged.
+ */
+class byte_span_t
+{
+private:
+   const unsigned char* data_;
+   size_t size_;
+
+public:
+   byte_span_t() : data_(nullptr), size_(0) {}
+   byte_span_t(const unsigned char* data, size_t size) : data_(data), size_(size) {}
+   byte_span_t(const unsigned char* begin, const unsigned char* end) : data_(begin), size_(static_cast<size_t>(end - begin)) {}
+
+   template<typename A>
+   byte_span_t(const std::vector<unsigned char, A>& v) : data_(v.data()), size_(v.size()) {}
+
+   template<size_t N>
+   byte_span_t(const std::array<unsigned char, N>& a) : data_(a.data()), size_(N) {}
+
+   const unsigned char* data() const { return data_; }
+   size_t size() const { return size_; }
+   bool empty() const { return size_ == 0; }
+
+   const unsigned char* begin() const { return data_; }
+   const unsigned char* end() const { return data_ + size_; }
+
+   unsigned char operator[](size_t pos) const { return data_[pos]; }
+   unsigned char front() const { return data_[0]; }
+   unsigned char back() const { return data_[size_ - 1]; }
+
+   //! view of count bytes starting at offset, no bounds checking
+   byte_span_t subspan(size_t offset, size_t count) const { return byte_span_t(data_ + offset, count); }
+   //! view of the tail starting at offset, no bounds checking
+   byte_span_t subspan(size_t offset) const { return byte_span_t(data_ + offset, size_ - offset); }
+};
+
+}
+
+#endif // BTC_UTILS_SPAN_H__
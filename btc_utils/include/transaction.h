@@ -7,6 +7,9 @@
 #define BTC_UTILS_TRANSACTION_H__
 
 #include <crypto.h>
+#include <memory_resource>
+#include <stdexcept>
+#include <string>
 #include <vector>
 
 namespace btc_utils
@@ -25,8 +28,21 @@ public:
        data_source.unserialize(hash);
        data_source.unserialize(n);
     }
+
+    template<typename T>
+    void serialize(T& sink) const
+    {
+       sink.serialize(hash);
+       sink.serialize(n);
+    }
 };
 
+/** Allocator used by the transaction and block types. By default it takes memory
+ * from the global heap, a memory resource such as block_arena_t can be passed
+ * to the constructors to put all memory of a block into one arena.
+ */
+typedef std::pmr::polymorphic_allocator<unsigned char> tx_allocator_t;
+
 /** An input of a transaction.  It contains the location of the previous
  * transaction's output that it claims and a signature that matches the
  * output's public key.
@@ -34,10 +50,27 @@ public:
 class tx_in_t
 {
 public:
+   typedef tx_allocator_t allocator_type;
+
+   static const size_t MIN_SIZE = 41;  //!< serialized: outpoint, empty scriptSig and sequence
+
    out_point_t prevout;
-   std::vector<unsigned char> scriptSig;
+   std::pmr::vector<unsigned char> scriptSig;
    uint32_t nSequence;
-   std::vector<std::vector<unsigned char> > scriptWitness; //!< Only serialized through CTransaction
+   std::pmr::vector<std::pmr::vector<unsigned char> > scriptWitness; //!< Only serialized through CTransaction
+
+   tx_in_t() = default;
+   tx_in_t(const tx_in_t&) = default;
+   tx_in_t(tx_in_t&&) = default;
+   tx_in_t& operator=(const tx_in_t&) = default;
+   tx_in_t& operator=(tx_in_t&&) = default;
+
+   explicit tx_in_t(const allocator_type& alloc) :
+      prevout(), scriptSig(alloc), nSequence(0), scriptWitness(alloc) {}
+   tx_in_t(const tx_in_t& other, const allocator_type& alloc) :
+      prevout(other.prevout), scriptSig(other.scriptSig, alloc), nSequence(other.nSequence), scriptWitness(other.scriptWitness, alloc) {}
+   tx_in_t(tx_in_t&& other, const allocator_type& alloc) :
+      prevout(other.prevout), scriptSig(std::move(other.scriptSig), alloc), nSequence(other.nSequence), scriptWitness(std::move(other.scriptWitness), alloc) {}
 
    template<typename T>
    void unserialize(T& data_source)
@@ -46,6 +79,14 @@ public:
       data_source.unserialize(scriptSig);
       data_source.unserialize(nSequence);
    }
+
+   template<typename T>
+   void serialize(T& sink) const
+   {
+      prevout.serialize(sink);
+      sink.serialize(scriptSig);
+      sink.serialize(nSequence);
+   }
 };
 
 /** An output of a transaction.  It contains the public key that the next input
@@ -54,8 +95,25 @@ public:
 class tx_out_t
 {
 public:
+   typedef tx_allocator_t allocator_type;
+
+   static const size_t MIN_SIZE = 9;  //!< serialized: value and empty scriptPubKey
+
    uint64_t nValue;
-   std::vector<unsigned char> scriptPubKey;
+   std::pmr::vector<unsigned char> scriptPubKey;
+
+   tx_out_t() = default;
+   tx_out_t(const tx_out_t&) = default;
+   tx_out_t(tx_out_t&&) = default;
+   tx_out_t& operator=(const tx_out_t&) = default;
+   tx_out_t& operator=(tx_out_t&&) = default;
+
+   explicit tx_out_t(const allocator_type& alloc) :
+      nValue(0), scriptPubKey(alloc) {}
+   tx_out_t(const tx_out_t& other, const allocator_type& alloc) :
+      nValue(other.nValue), scriptPubKey(other.scriptPubKey, alloc) {}
+   tx_out_t(tx_out_t&& other, const allocator_type& alloc) :
+      nValue(other.nValue), scriptPubKey(std::move(other.scriptPubKey), alloc) {}
 
    template<typename T>
    void unserialize(T& data_source)
@@ -64,47 +122,84 @@ public:
       data_source.unserialize(scriptPubKey);
    }
 
+   template<typename T>
+   void serialize(T& sink) const
+   {
+      sink.serialize(nValue);
+      sink.serialize(scriptPubKey);
+   }
+
    std::vector<std::string> addresses() const;
 };
 
 class transaction_t
 {
 public:
-   std::vector<tx_in_t> vin;
-   std::vector<tx_out_t> vout;
+   typedef tx_allocator_t allocator_type;
+
+   static const size_t MIN_SIZE = 10;  //!< serialized: version, empty vin and vout, lock time
+
+   std::pmr::vector<tx_in_t> vin;
+   std::pmr::vector<tx_out_t> vout;
    uint32_t nVersion;
    uint32_t nLockTime;
 
+   transaction_t() = default;
+   transaction_t(const transaction_t&) = default;
+   transaction_t(transaction_t&&) = default;
+   transaction_t& operator=(const transaction_t&) = default;
+   transaction_t& operator=(transaction_t&&) = default;
+
+   explicit transaction_t(const allocator_type& alloc) :
+      vin(alloc), vout(alloc), nVersion(0), nLockTime(0) {}
+   transaction_t(const transaction_t& other, const allocator_type& alloc) :
+      vin(other.vin, alloc), vout(other.vout, alloc), nVersion(other.nVersion), nLockTime(other.nLockTime) {}
+   transaction_t(transaction_t&& other, const allocator_type& alloc) :
+      vin(std::move(other.vin), alloc), vout(std::move(other.vout), alloc), nVersion(other.nVersion), nLockTime(other.nLockTime) {}
+
+   /** Deserialization overwrites the existing inputs and outputs in place,
+    *  so a transaction reused for the next one keeps the capacity of its
+    *  containers. Besides unserialize() for the field types, the data source
+    *  must provide read_compact_int(), unserialize_items(vector, size) and
+    *  unserialize_witness(stack), see deserializer_t.
+    */
    template<typename T>
    void unserialize(T& data_source)
    {
       data_source.unserialize(nVersion);
       unsigned char flags = 0;
-      vin.clear();
-      vout.clear();
-      /* Try to read the vin. In case the dummy is there, this will be read as an empty vector. */
-      data_source.unserialize(vin);
-      if (vin.size() == 0) {
+      /* Try to read the vin size. In case the dummy is there, this will be read as zero.
+       * The size is read separately to keep the old inputs for reuse until we know it. */
+      uint64_t vin_size = data_source.read_compact_int();
+      if (vin_size == 0) {
           /* We read a dummy or an empty vin. */
           data_source.unserialize(flags);
           if (flags != 0) {
               data_source.unserialize(vin);
               data_source.unserialize(vout);
+          } else {
+              vin.clear();
+              vout.clear();
           }
       } else {
           /* We read a non-empty vin. Assume a normal vout follows. */
+          data_source.unserialize_items(vin, vin_size);
           data_source.unserialize(vout);
       }
       if ((flags & 1)) {
           /* The witness flag is present, and we support witnesses. */
           flags ^= 1;
           for (size_t i = 0; i < vin.size(); i++) {
-              data_source.unserialize(vin[i].scriptWitness);
+              data_source.unserialize_witness(vin[i].scriptWitness);
           }
           if (!has_witness()) {
               /* It's illegal to encode witnesses when all witness stacks are empty. */
               throw std::runtime_error("Superfluous witness record");
           }
+      } else {
+          for (size_t i = 0; i < vin.size(); i++) {
+              vin[i].scriptWitness.clear();
+          }
       }
       if (flags) {
           /* Unknown flag in the serialization */
@@ -113,7 +208,32 @@ public:
       data_source.unserialize(nLockTime);
    }
 
+   /** Serialize in the extended format with witnesses if there are any
+    *  and with_witness is set, in the legacy format otherwise. */
+   template<typename T>
+   void serialize(T& sink, bool with_witness = true) const
+   {
+      sink.serialize(nVersion);
+      with_witness = with_witness && has_witness();
+      if (with_witness) {
+         /* marker and flags */
+         sink.serialize(static_cast<unsigned char>(0));
+         sink.serialize(static_cast<unsigned char>(1));
+      }
+      sink.serialize(vin);
+      sink.serialize(vout);
+      if (with_witness) {
+         for (size_t i = 0; i < vin.size(); i++) {
+            sink.serialize(vin[i].scriptWitness);
+         }
+      }
+      sink.serialize(nLockTime);
+   }
+
    bool has_witness() const;
+
+   //! txid: hash of the serialization without witnesses
+   uint256_t get_hash() const;
 };
 
 }
@@ -0,0 +1,132 @@
+// Copyright (c) 2020 gladcow
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BTC_UTILS_WATCHLIST_H__
+#define BTC_UTILS_WATCHLIST_H__
+
+#include <address.h>
+#include <fuse_filter.h>
+#include <mapped_file.h>
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace btc_utils
+{
+
+/** Compact binary form of a destination for set lookups: the kind of the
+ *  destination and its hash or witness program. A P2PK destination gets the
+ *  key of its P2PKH address, as that is the address written for it.
+ */
+struct destination_key_t
+{
+   enum kind_t : unsigned char
+   {
+      PUBKEYHASH,
+      SCRIPTHASH,
+      WITNESS_V0_KEYHASH,
+      WITNESS_V0_SCRIPTHASH,
+      WITNESS_UNKNOWN     //!< followed by the witness version: WITNESS_UNKNOWN + version - 1, taproot included
+   };
+
+   unsigned char kind_;
+   unsigned char length_;
+   std::array<unsigned char, 40> data_;
+
+   destination_key_t() : kind_(0), length_(0), data_() {}
+
+   bool operator==(const destination_key_t& other) const
+   {
+      return kind_ == other.kind_ && length_ == other.length_ &&
+             memcmp(data_.data(), other.data_.data(), length_) == 0;
+   }
+   bool operator!=(const destination_key_t& other) const { return !(*this == other); }
+
+   //! 64-bit hash, the data is mostly a hash already so this only mixes it
+   uint64_t hash() const;
+};
+
+/** Key of a destination, returns false for no_destination_t */
+bool make_destination_key(const tx_destination_t& dest, destination_key_t& key);
+
+/** Decodes an address of the network P straight into its key, without allocating.
+ *  Returns false if the address is invalid or belongs to another network. */
+template<typename P>
+bool decode_destination_key(std::string_view str, destination_key_t& key)
+{
+   return make_destination_key(decode_destination<P>(str), key);
+}
+
+/** Decodes many addresses on up to threads threads (0 - one per core).
+ *  keys[i] is set if valid[i] is nonzero; returns the number of valid addresses. */
+template<typename P>
+size_t decode_destination_keys(const std::vector<std::string_view>& addresses,
+                               std::vector<destination_key_t>& keys,
+                               std::vector<unsigned char>& valid,
+                               unsigned int threads = 0);
+
+/** Set of destination keys: a binary fuse filter in front of an exact set.
+ *  The exact set keeps the keys sorted by hash with a directory on the top
+ *  bits of the hash, so a lookup is a directory read, a short scan of the
+ *  hashes and one key comparison.
+ *  The whole set can be saved to a file and memory mapped back, so repeated
+ *  scans with the same watchlist skip decoding and building. The file is in
+ *  host byte order and checked on load.
+ */
+class watchlist_t
+{
+private:
+   binary_fuse_filter_t filter_;
+   std::vector<uint64_t> hash_store_;
+   std::vector<destination_key_t> key_store_;
+   std::vector<uint32_t> directory_store_;
+   std::unique_ptr<mapped_file_t> file_;
+   const uint64_t* hashes_;
+   const destination_key_t* keys_;
+   const uint32_t* directory_;
+   size_t size_;
+   unsigned int shift_;
+
+public:
+   static const uint32_t FILE_VERSION = 1;
+
+   watchlist_t();
+   ~watchlist_t();
+
+   watchlist_t(const watchlist_t&) = delete;
+   watchlist_t& operator=(const watchlist_t&) = delete;
+
+   //! replaces the contents, duplicates are removed
+   void build(std::vector<destination_key_t> keys);
+
+   //! writes the built set, throws std::runtime_error on failure
+   void save(const std::string& path) const;
+   //! replaces the contents with a memory mapped saved set, throws std::runtime_error on failure
+   void load(const std::string& path);
+
+   size_t size() const { return size_; }
+
+   bool contains(const destination_key_t& key) const
+   {
+      uint64_t h = key.hash();
+      if (!filter_.contains(h))
+         return false;
+      size_t bucket = static_cast<size_t>(h >> shift_);
+      for (uint32_t i = directory_[bucket]; i < directory_[bucket + 1]; i++)
+      {
+         if (hashes_[i] == h && keys_[i] == key)
+            return true;
+      }
+      return false;
+   }
+};
+
+}
+
+#endif // BTC_UTILS_WATCHLIST_H__
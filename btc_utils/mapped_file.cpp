@@ -0,0 +1,59 @@
+// Copyright (c) 2020 gladcow
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <mapped_file.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace btc_utils
+{
+
+mapped_file_t::mapped_file_t(const std::string& path) :
+   data_(nullptr), size_(0)
+{
+   int fd = open(path.c_str(), O_RDONLY);
+   if (fd < 0)
+      throw std::runtime_error("Can't open " + path + ": " + strerror(errno));
+   struct stat st;
+   if (fstat(fd, &st) != 0)
+   {
+      int err = errno;
+      close(fd);
+      throw std::runtime_error("Can't stat " + path + ": " + strerror(err));
+   }
+   size_ = static_cast<size_t>(st.st_size);
+   if (size_ > 0)
+   {
+      void* p = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED)
+      {
+         int err = errno;
+         close(fd);
+         throw std::runtime_error("Can't map " + path + ": " + strerror(err));
+      }
+      data_ = static_cast<const unsigned char*>(p);
+   }
+   close(fd);
+}
+
+void mapped_file_t::advise_random() const
+{
+   if (data_)
+      madvise(const_cast<unsigned char*>(data_), size_, MADV_RANDOM);
+}
+
+mapped_file_t::~mapped_file_t()
+{
+   if (data_)
+      munmap(const_cast<unsigned char*>(data_), size_);
+}
+
+}
@@ -0,0 +1,89 @@
+// Copyright (c) 2020 gladcow
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <pattern_matcher.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace btc_utils
+{
+
+multi_pattern_matcher_t::multi_pattern_matcher_t() :
+   class_count_(1),
+   next_(1, 0),
+   depth_(1, 0),
+   output_(1, NO_MATCH),
+   dict_(1, 0)
+{
+   memset(classes_, 0, sizeof(classes_));
+}
+
+void multi_pattern_matcher_t::build(const std::vector<pattern_t>& patterns)
+{
+   // byte classes: 0 for the bytes no pattern contains
+   memset(classes_, 0, sizeof(classes_));
+   class_count_ = 1;
+   for (const pattern_t& p: patterns)
+   {
+      if (p.bytes.empty())
+         throw std::runtime_error("multi_pattern_matcher_t: empty pattern");
+      for (unsigned char c: p.bytes)
+         if (!classes_[c])
+            classes_[c] = static_cast<uint8_t>(class_count_++);
+   }
+
+   // the trie, 0 in next_ is no edge as the root is nobody's child
+   next_.assign(class_count_, 0);
+   depth_.assign(1, 0);
+   output_.assign(1, NO_MATCH);
+   for (const pattern_t& p: patterns)
+   {
+      uint32_t state = 0;
+      for (unsigned char c: p.bytes)
+      {
+         uint32_t& edge = next_[state * class_count_ + classes_[c]];
+         if (!edge)
+         {
+            edge = static_cast<uint32_t>(depth_.size());
+            next_.resize(next_.size() + class_count_, 0);
+            depth_.push_back(depth_[state] + 1);
+            output_.push_back(NO_MATCH);
+         }
+         // the reference may be stale after the resize
+         state = next_[state * class_count_ + classes_[c]];
+      }
+      if (output_[state] == NO_MATCH)
+         output_[state] = p.id;
+   }
+
+   // failure links in breadth first order, turning the trie into a DFA
+   std::vector<uint32_t> fail(depth_.size(), 0);
+   dict_.assign(depth_.size(), 0);
+   std::vector<uint32_t> queue;
+   queue.reserve(depth_.size());
+   for (uint32_t c = 0; c < class_count_; c++)
+      if (next_[c])
+         queue.push_back(next_[c]);
+   for (size_t head = 0; head < queue.size(); head++)
+   {
+      uint32_t state = queue[head];
+      uint32_t f = fail[state];
+      dict_[state] = output_[f] != NO_MATCH ? f : dict_[f];
+      for (uint32_t c = 0; c < class_count_; c++)
+      {
+         uint32_t& edge = next_[state * class_count_ + c];
+         if (edge)
+         {
+            fail[edge] = next_[f * class_count_ + c];
+            queue.push_back(edge);
+         }
+         else
+            edge = next_[f * class_count_ + c];
+      }
+   }
+}
+
+}
@@ -4,166 +4,13 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <script.h>
-
-/** Signature hash sizes */
-static constexpr size_t WITNESS_V0_SCRIPTHASH_SIZE = 32;
-static constexpr size_t WITNESS_V0_KEYHASH_SIZE = 20;
+#include <algorithm>
+#include <stdexcept>
 
 namespace btc_utils
 {
 
-/** Script opcodes */
-enum opcode_t
-{
-    // push value
-    OP_0 = 0x00,
-    OP_FALSE = OP_0,
-    OP_PUSHDATA1 = 0x4c,
-    OP_PUSHDATA2 = 0x4d,
-    OP_PUSHDATA4 = 0x4e,
-    OP_1NEGATE = 0x4f,
-    OP_RESERVED = 0x50,
-    OP_1 = 0x51,
-    OP_TRUE=OP_1,
-    OP_2 = 0x52,
-    OP_3 = 0x53,
-    OP_4 = 0x54,
-    OP_5 = 0x55,
-    OP_6 = 0x56,
-    OP_7 = 0x57,
-    OP_8 = 0x58,
-    OP_9 = 0x59,
-    OP_10 = 0x5a,
-    OP_11 = 0x5b,
-    OP_12 = 0x5c,
-    OP_13 = 0x5d,
-    OP_14 = 0x5e,
-    OP_15 = 0x5f,
-    OP_16 = 0x60,
-
-    // control
-    OP_NOP = 0x61,
-    OP_VER = 0x62,
-    OP_IF = 0x63,
-    OP_NOTIF = 0x64,
-    OP_VERIF = 0x65,
-    OP_VERNOTIF = 0x66,
-    OP_ELSE = 0x67,
-    OP_ENDIF = 0x68,
-    OP_VERIFY = 0x69,
-    OP_RETURN = 0x6a,
-
-    // stack ops
-    OP_TOALTSTACK = 0x6b,
-    OP_FROMALTSTACK = 0x6c,
-    OP_2DROP = 0x6d,
-    OP_2DUP = 0x6e,
-    OP_3DUP = 0x6f,
-    OP_2OVER = 0x70,
-    OP_2ROT = 0x71,
-    OP_2SWAP = 0x72,
-    OP_IFDUP = 0x73,
-    OP_DEPTH = 0x74,
-    OP_DROP = 0x75,
-    OP_DUP = 0x76,
-    OP_NIP = 0x77,
-    OP_OVER = 0x78,
-    OP_PICK = 0x79,
-    OP_ROLL = 0x7a,
-    OP_ROT = 0x7b,
-    OP_SWAP = 0x7c,
-    OP_TUCK = 0x7d,
-
-    // splice ops
-    OP_CAT = 0x7e,
-    OP_SUBSTR = 0x7f,
-    OP_LEFT = 0x80,
-    OP_RIGHT = 0x81,
-    OP_SIZE = 0x82,
-
-    // bit logic
-    OP_INVERT = 0x83,
-    OP_AND = 0x84,
-    OP_OR = 0x85,
-    OP_XOR = 0x86,
-    OP_EQUAL = 0x87,
-    OP_EQUALVERIFY = 0x88,
-    OP_RESERVED1 = 0x89,
-    OP_RESERVED2 = 0x8a,
-
-    // numeric
-    OP_1ADD = 0x8b,
-    OP_1SUB = 0x8c,
-    OP_2MUL = 0x8d,
-    OP_2DIV = 0x8e,
-    OP_NEGATE = 0x8f,
-    OP_ABS = 0x90,
-    OP_NOT = 0x91,
-    OP_0NOTEQUAL = 0x92,
-
-    OP_ADD = 0x93,
-    OP_SUB = 0x94,
-    OP_MUL = 0x95,
-    OP_DIV = 0x96,
-    OP_MOD = 0x97,
-    OP_LSHIFT = 0x98,
-    OP_RSHIFT = 0x99,
-
-    OP_BOOLAND = 0x9a,
-    OP_BOOLOR = 0x9b,
-    OP_NUMEQUAL = 0x9c,
-    OP_NUMEQUALVERIFY = 0x9d,
-    OP_NUMNOTEQUAL = 0x9e,
-    OP_LESSTHAN = 0x9f,
-    OP_GREATERTHAN = 0xa0,
-    OP_LESSTHANOREQUAL = 0xa1,
-    OP_GREATERTHANOREQUAL = 0xa2,
-    OP_MIN = 0xa3,
-    OP_MAX = 0xa4,
-
-    OP_WITHIN = 0xa5,
-
-    // crypto
-    OP_RIPEMD160 = 0xa6,
-    OP_SHA1 = 0xa7,
-    OP_SHA256 = 0xa8,
-    OP_HASH160 = 0xa9,
-    OP_HASH256 = 0xaa,
-    OP_CODESEPARATOR = 0xab,
-    OP_CHECKSIG = 0xac,
-    OP_CHECKSIGVERIFY = 0xad,
-    OP_CHECKMULTISIG = 0xae,
-    OP_CHECKMULTISIGVERIFY = 0xaf,
-
-    // expansion
-    OP_NOP1 = 0xb0,
-    OP_CHECKLOCKTIMEVERIFY = 0xb1,
-    OP_NOP2 = OP_CHECKLOCKTIMEVERIFY,
-    OP_CHECKSEQUENCEVERIFY = 0xb2,
-    OP_NOP3 = OP_CHECKSEQUENCEVERIFY,
-    OP_NOP4 = 0xb3,
-    OP_NOP5 = 0xb4,
-    OP_NOP6 = 0xb5,
-    OP_NOP7 = 0xb6,
-    OP_NOP8 = 0xb7,
-    OP_NOP9 = 0xb8,
-    OP_NOP10 = 0xb9,
-
-    OP_INVALIDOPCODE = 0xff,
-};
-
-/** Decode small integers: */
-static int decode_OP_N(opcode_t opcode)
-{
-    if (opcode == OP_0)
-        return 0;
-    if(opcode >= OP_1 && opcode <= OP_16)
-        return (int)opcode - (int)(OP_1 - 1);
-    throw std::runtime_error("Invalid OP_N");
-}
-
-
-static bool is_pay_to_script_hash(const std::vector<unsigned char>& script)
+static bool is_pay_to_script_hash(byte_span_t script)
 {
     // Extra-fast test for pay-to-script-hash CScripts:
     return (script.size() == 23 &&
@@ -174,7 +21,7 @@ static bool is_pay_to_script_hash(const std::vector<unsigned char>& script)
 
 // A witness program is any valid CScript that consists of a 1-byte push opcode
 // followed by a data push between 2 and 40 bytes.
-static bool is_witness_program(const std::vector<unsigned char>& script, int& version, std::vector<unsigned char>& program)
+static bool is_witness_program(byte_span_t script, int& version, byte_span_t& program)
 {
     if (script.size() < 4 || script.size() > 42) {
         return false;
@@ -182,65 +29,236 @@ static bool is_witness_program(const std::vector<unsigned char>& script, int& ve
     if (script[0] != OP_0 && (script[0] < OP_1 || script[0] > OP_16)) {
         return false;
     }
-    if ((size_t)(script[1] + 2) == script.size()) {
-        version = decode_OP_N((opcode_t)script[0]);
-        program = std::vector<unsigned char>(script.begin() + 2, script.end());
+    if (static_cast<size_t>(script[1]) + 2 == script.size()) {
+        version = decode_OP_N(static_cast<opcode_t>(script[0]));
+        program = script.subspan(2);
         return true;
     }
     return false;
 }
 
-static bool match_pay_to_pub_key(const std::vector<unsigned char>& script, std::vector<unsigned char>& pubkey)
+static bool match_pay_to_pub_key(byte_span_t script, byte_span_t& pubkey)
 {
     if (script.size() == pub_key_t::SIZE + 2 && script[0] == pub_key_t::SIZE && script.back() == OP_CHECKSIG) {
-        pubkey = std::vector<unsigned char>(script.begin() + 1, script.begin() + pub_key_t::SIZE + 1);
+        pubkey = script.subspan(1, pub_key_t::SIZE);
         return pub_key_t::valid_size(pubkey);
     }
     if (script.size() == pub_key_t::COMPRESSED_SIZE + 2 && script[0] == pub_key_t::COMPRESSED_SIZE && script.back() == OP_CHECKSIG) {
-        pubkey = std::vector<unsigned char>(script.begin() + 1, script.begin() + pub_key_t::COMPRESSED_SIZE + 1);
+        pubkey = script.subspan(1, pub_key_t::COMPRESSED_SIZE);
         return pub_key_t::valid_size(pubkey);
     }
     return false;
 }
 
-static bool match_pay_to_pubkey_hash(const std::vector<unsigned char>& script, std::vector<unsigned char>& pubkeyhash)
+static bool match_pay_to_pubkey_hash(byte_span_t script, byte_span_t& pubkeyhash)
 {
     if (script.size() == 25 && script[0] == OP_DUP && script[1] == OP_HASH160 && script[2] == 20 && script[23] == OP_EQUALVERIFY && script[24] == OP_CHECKSIG) {
-        pubkeyhash = std::vector<unsigned char>(script.begin () + 3, script.begin() + 23);
+        pubkeyhash = script.subspan(3, 20);
         return true;
     }
     return false;
 }
 
-txnouttype solver(const std::vector<unsigned char>& script, std::vector<std::vector<unsigned char> > &solutions)
+bool match_multisig(byte_span_t script, unsigned int& required, byte_span_t* keys, unsigned int& count)
 {
-   solutions.clear();
+    // OP_m <pubkey>... OP_n OP_CHECKMULTISIG, the smallest is 1-of-1 with a compressed key
+    if (script.size() < pub_key_t::COMPRESSED_SIZE + 4 || script.back() != OP_CHECKMULTISIG)
+        return false;
+    opcode_t m = static_cast<opcode_t>(script[0]);
+    opcode_t n = static_cast<opcode_t>(script[script.size() - 2]);
+    if (m < OP_1 || m > OP_16 || n < OP_1 || n > OP_16)
+        return false;
+    size_t end = script.size() - 2;
+    size_t pos = 1;
+    count = 0;
+    while (pos < end)
+    {
+        size_t len = script[pos];
+        if (count == MAX_MULTISIG_KEYS || pos + 1 + len > end)
+            return false;
+        keys[count] = script.subspan(pos + 1, len);
+        if (!pub_key_t::valid_size(keys[count]))
+            return false;
+        count++;
+        pos += 1 + len;
+    }
+    required = static_cast<unsigned int>(decode_OP_N(m));
+    return static_cast<unsigned int>(decode_OP_N(n)) == count && required <= count;
+}
+
+// The push at pos: data for OP_0 and the push opcodes, empty for OP_1NEGATE and OP_1..OP_16
+static bool get_push(byte_span_t script, size_t& pos, opcode_t& op, byte_span_t& data)
+{
+    if (pos >= script.size())
+        return false;
+    op = static_cast<opcode_t>(script[pos]);
+    if (op >= OP_1NEGATE && op <= OP_16 && op != OP_RESERVED) {
+        data = byte_span_t();
+        pos++;
+        return true;
+    }
+    size_t len, header;
+    if (op < OP_PUSHDATA1) {
+        len = op;
+        header = 1;
+    }
+    else if (op == OP_PUSHDATA1 && pos + 2 <= script.size()) {
+        len = script[pos + 1];
+        header = 2;
+    }
+    else if (op == OP_PUSHDATA2 && pos + 3 <= script.size()) {
+        len = script[pos + 1] | static_cast<size_t>(script[pos + 2]) << 8;
+        header = 3;
+    }
+    else if (op == OP_PUSHDATA4 && pos + 5 <= script.size()) {
+        len = script[pos + 1] | static_cast<size_t>(script[pos + 2]) << 8 |
+              static_cast<size_t>(script[pos + 3]) << 16 | static_cast<size_t>(script[pos + 4]) << 24;
+        header = 5;
+    }
+    else
+        return false;
+    if (len > script.size() - pos - header)
+        return false;
+    data = script.subspan(pos + header, len);
+    pos += header + len;
+    return true;
+}
+
+bool next_null_data_element(byte_span_t script, size_t& pos, byte_span_t& element)
+{
+    size_t start = pos;
+    opcode_t op;
+    if (!get_push(script, pos, op, element))
+        return false;
+    if (op >= OP_1NEGATE && op <= OP_16)
+        element = script.subspan(start, 1);
+    return true;
+}
+
+// The fields and body of the envelope whose "ord" push ends at pos, pos is set past its OP_ENDIF
+static bool match_inscription_envelope(byte_span_t item, size_t& pos, inscription_envelope_t& envelope)
+{
+    envelope.content_type = byte_span_t();
+    envelope.body_size = 0;
+    bool body = false;
+    opcode_t op;
+    byte_span_t data;
+    while (pos < item.size()) {
+        if (item[pos] == OP_ENDIF) {
+            pos++;
+            return true;
+        }
+        if (!get_push(item, pos, op, data))
+            return false;
+        if (body) {
+            envelope.body_size += op >= OP_1NEGATE && op <= OP_16 ? 1 : data.size();
+            continue;
+        }
+        // an empty tag starts the body, the others are followed by their value
+        if (op == OP_0) {
+            body = true;
+            continue;
+        }
+        bool content_type = op == OP_1 || (data.size() == 1 && data[0] == 1);
+        if (!get_push(item, pos, op, data))
+            return false;
+        if (content_type && envelope.content_type.empty())
+            envelope.content_type = data;
+    }
+    return false;
+}
 
+bool next_inscription_envelope(byte_span_t item, size_t& pos, inscription_envelope_t& envelope)
+{
+    static const unsigned char header[] = {OP_FALSE, OP_IF, 3, 'o', 'r', 'd'};
+    while (pos < item.size()) {
+        const unsigned char* found = std::search(item.begin() + pos, item.end(), std::begin(header), std::end(header));
+        if (found == item.end()) {
+            pos = item.size();
+            return false;
+        }
+        size_t start = static_cast<size_t>(found - item.begin());
+        pos = start + sizeof(header);
+        if (match_inscription_envelope(item, pos, envelope))
+            return true;
+        // not a well formed envelope, look for one after its start
+        pos = start + 1;
+    }
+    return false;
+}
+
+// A DER signature with its sighash byte, 9 to 73 bytes, as a direct push at pos
+static bool match_signature_push(byte_span_t script, size_t& pos)
+{
+    if (pos >= script.size())
+        return false;
+    size_t len = script[pos];
+    if (len < 9 || len > 73 || pos + 1 + len > script.size() || script[pos + 1] != 0x30)
+        return false;
+    pos += 1 + len;
+    return true;
+}
+
+template<typename H>
+static H to_hash(byte_span_t data)
+{
+    H res;
+    std::copy(data.begin(), data.end(), res.begin());
+    return res;
+}
+
+const char* get_txn_output_type(txnouttype t)
+{
+   switch (t)
+   {
+      case TX_NONSTANDARD: return "nonstandard";
+      case TX_PUBKEY: return "pubkey";
+      case TX_PUBKEYHASH: return "pubkeyhash";
+      case TX_SCRIPTHASH: return "scripthash";
+      case TX_MULTISIG: return "multisig";
+      case TX_NULL_DATA: return "nulldata";
+      case TX_WITNESS_V0_KEYHASH: return "witness_v0_keyhash";
+      case TX_WITNESS_V0_SCRIPTHASH: return "witness_v0_scripthash";
+      case TX_WITNESS_V1_TAPROOT: return "witness_v1_taproot";
+      case TX_WITNESS_UNKNOWN: return "witness_unknown";
+   }
+   return nullptr;
+}
+
+txnouttype solver(byte_span_t script, tx_destination_t& destination)
+{
    // Shortcut for pay-to-script-hash, which are more constrained than the other types:
    // it is always OP_HASH160 20 [20 byte hash] OP_EQUAL
    if (is_pay_to_script_hash(script))
    {
-       std::vector<unsigned char> hashBytes(script.begin()+2, script.begin()+22);
-       solutions.push_back(hashBytes);
+       destination = script_hash_tx_destination_t(to_hash<uint160_t>(script.subspan(2, 20)));
        return TX_SCRIPTHASH;
    }
 
    int witnessversion;
-   std::vector<unsigned char> witnessprogram;
+   byte_span_t witnessprogram;
    if (is_witness_program(script, witnessversion, witnessprogram)) {
        if (witnessversion == 0 && witnessprogram.size() == WITNESS_V0_KEYHASH_SIZE) {
-           solutions.push_back(witnessprogram);
+           destination = witness_v0_key_hash_tx_destination_t(to_hash<uint160_t>(witnessprogram));
            return TX_WITNESS_V0_KEYHASH;
        }
        if (witnessversion == 0 && witnessprogram.size() == WITNESS_V0_SCRIPTHASH_SIZE) {
-           solutions.push_back(witnessprogram);
+           destination = witness_v0_script_hash_tx_destination_t(to_hash<uint256_t>(witnessprogram));
            return TX_WITNESS_V0_SCRIPTHASH;
        }
+       if (witnessversion == 1 && witnessprogram.size() == WITNESS_V1_TAPROOT_SIZE) {
+           destination = witness_v1_taproot_tx_destination_t(to_hash<uint256_t>(witnessprogram));
+           return TX_WITNESS_V1_TAPROOT;
+       }
        if (witnessversion != 0) {
-           solutions.push_back(std::vector<unsigned char>{(unsigned char)witnessversion});
-           solutions.push_back(std::move(witnessprogram));
+           witness_unknown_tx_destination_t unk;
+           unk.version_ = static_cast<unsigned int>(witnessversion);
+           unk.length_ = static_cast<unsigned int>(witnessprogram.size());
+           std::copy(witnessprogram.begin(), witnessprogram.end(), unk.program_.begin());
+           destination = unk;
            return TX_WITNESS_UNKNOWN;
        }
+       destination = no_destination_t();
        return TX_NONSTANDARD;
    }
 
@@ -250,22 +268,128 @@ txnouttype solver(const std::vector<unsigned char>& script, std::vector<std::vec
    // byte passes the IsPushOnly() test we don't care what exactly is in the
    // script.
    if (script.size() >= 1 && script[0] == OP_RETURN) {
+       destination = no_destination_t();
        return TX_NULL_DATA;
    }
 
-   std::vector<unsigned char> data;
+   byte_span_t data;
    if (match_pay_to_pub_key(script, data)) {
-       solutions.push_back(std::move(data));
+       destination = pub_key_t(data.begin(), data.end());
        return TX_PUBKEY;
    }
 
    if (match_pay_to_pubkey_hash(script, data)) {
-       solutions.push_back(std::move(data));
+       destination = pk_hash_tx_destination_t(to_hash<uint160_t>(data));
        return TX_PUBKEYHASH;
    }
 
-   solutions.clear();
+   destination = no_destination_t();
+   unsigned int required, count;
+   byte_span_t keys[MAX_MULTISIG_KEYS];
+   if (match_multisig(script, required, keys, count)) {
+       return TX_MULTISIG;
+   }
+
+   return TX_NONSTANDARD;
+}
+
+txnouttype match_spending_input(byte_span_t script_sig,
+                                const std::pmr::vector<std::pmr::vector<unsigned char>>& witness,
+                                byte_span_t& data)
+{
+   if (witness.empty())
+   {
+      // <sig> <pubkey>, both direct pushes
+      size_t pos = 0;
+      if (!match_signature_push(script_sig, pos) || pos >= script_sig.size())
+         return TX_NONSTANDARD;
+      size_t len = script_sig[pos];
+      if (pos + 1 + len != script_sig.size())
+         return TX_NONSTANDARD;
+      data = script_sig.subspan(pos + 1, len);
+      return pub_key_t::valid_size(data) ? TX_PUBKEYHASH : TX_NONSTANDARD;
+   }
+   if (script_sig.empty())
+   {
+      // segwit only allows compressed keys
+      if (witness.size() != 2 || witness[1].size() != pub_key_t::COMPRESSED_SIZE ||
+          (witness[1][0] != 2 && witness[1][0] != 3))
+         return TX_NONSTANDARD;
+      data = witness[1];
+      return TX_WITNESS_V0_KEYHASH;
+   }
+   // nested segwit, the redeem script is OP_0 <20 or 32 bytes>
+   if ((script_sig.size() == 23 && script_sig[0] == 22 && script_sig[1] == OP_0 && script_sig[2] == 20) ||
+       (script_sig.size() == 35 && script_sig[0] == 34 && script_sig[1] == OP_0 && script_sig[2] == 32))
+   {
+      data = script_sig.subspan(1);
+      return TX_SCRIPTHASH;
+   }
    return TX_NONSTANDARD;
 }
 
+bool decode_coinbase_height(byte_span_t script_sig, uint64_t& height)
+{
+   if (script_sig.empty())
+      return false;
+   opcode_t op = static_cast<opcode_t>(script_sig[0]);
+   if (op == OP_0 || (op >= OP_1 && op <= OP_16))
+   {
+      height = static_cast<uint64_t>(decode_OP_N(op));
+      return true;
+   }
+   size_t len = script_sig[0];
+   // the sign bit is the top bit of the last byte
+   if (len < 1 || len > 8 || len + 1 > script_sig.size() || (script_sig[len] & 0x80))
+      return false;
+   height = 0;
+   for (size_t i = len; i > 0; i--)
+      height = height << 8 | script_sig[i];
+   return true;
+}
+
+txnouttype solver(const std::vector<unsigned char>& script, std::vector<std::vector<unsigned char> > &solutions)
+{
+   // the span solver matches the templates, the solutions are cut from the script bytes it matched
+   solutions.clear();
+   byte_span_t bytes(script);
+   tx_destination_t destination;
+   txnouttype type = solver(bytes, destination);
+   switch (type)
+   {
+      case TX_SCRIPTHASH:
+         solutions.emplace_back(script.begin() + 2, script.begin() + 22);
+         break;
+      case TX_WITNESS_UNKNOWN:
+         solutions.push_back(std::vector<unsigned char>{static_cast<unsigned char>(decode_OP_N(static_cast<opcode_t>(script[0])))});
+         solutions.emplace_back(script.begin() + 2, script.end());
+         break;
+      case TX_WITNESS_V0_KEYHASH:
+      case TX_WITNESS_V0_SCRIPTHASH:
+      case TX_WITNESS_V1_TAPROOT:
+         solutions.emplace_back(script.begin() + 2, script.end());
+         break;
+      case TX_PUBKEY:
+         solutions.emplace_back(script.begin() + 1, script.end() - 1);
+         break;
+      case TX_PUBKEYHASH:
+         solutions.emplace_back(script.begin() + 3, script.begin() + 23);
+         break;
+      case TX_MULTISIG:
+      {
+         unsigned int required, count;
+         byte_span_t keys[MAX_MULTISIG_KEYS];
+         match_multisig(bytes, required, keys, count);
+         solutions.push_back(std::vector<unsigned char>{static_cast<unsigned char>(required)});
+         for (unsigned int i = 0; i < count; i++)
+            solutions.emplace_back(keys[i].begin(), keys[i].end());
+         solutions.push_back(std::vector<unsigned char>{static_cast<unsigned char>(count)});
+         break;
+      }
+      case TX_NULL_DATA:
+      case TX_NONSTANDARD:
+         break;
+   }
+   return type;
+}
 }
@@ -1,7 +1,46 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include "doctest.h"
 
+#include <address.h>
+#include <arena.h>
+#include <bech32.h>
+#include <block.h>
+#include <block_index.h>
+#include <chainparams.h>
+#include <clock_cache.h>
 #include <crypto.h>
+#include <pattern_matcher.h>
+#include <script.h>
+#include <serialize.h>
+#include <transaction.h>
+#include <watchlist.h>
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <unistd.h>
+
+static btc_utils::uint160_t to_hash160(const std::string& hex)
+{
+    std::vector<unsigned char> v = btc_utils::from_hex(hex);
+    btc_utils::uint160_t res;
+    std::copy(v.begin(), v.end(), res.begin());
+    return res;
+}
+
+/** A file of the temporary directory that is removed when it goes out of scope */
+struct temp_file_t
+{
+    std::string path;
+
+    explicit temp_file_t(const std::string& name) :
+        path((std::filesystem::temp_directory_path() / (std::to_string(getpid()) + "_" + name)).string()) {}
+    ~temp_file_t() { std::remove(path.c_str()); }
+
+    temp_file_t(const temp_file_t&) = delete;
+    temp_file_t& operator=(const temp_file_t&) = delete;
+};
 
 TEST_CASE("crypto_base58")
 {
@@ -34,3 +73,790 @@ TEST_CASE("crypto_base58")
     CHECK(btc_utils::encode_base58(btc_utils::from_hex("000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f606162636465666768696a6b6c6d6e6f707172737475767778797a7b7c7d7e7f808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9fa0a1a2a3a4a5a6a7a8a9aaabacadaeafb0b1b2b3b4b5b6b7b8b9babbbcbdbebfc0c1c2c3c4c5c6c7c8c9cacbcccdcecfd0d1d2d3d4d5d6d7d8d9dadbdcdddedfe0e1e2e3e4e5e6e7e8e9eaebecedeeeff0f1f2f3f4f5f6f7f8f9fafbfcfdfeff")) ==
           "1cWB5HCBdLjAuqGGReWE3R3CguuwSjw6RHn39s2yuDRTS5NsBgNiFpWgAnEx6VQi8csexkgYw3mdYrMHr8x9i7aEwP8kZ7vccXWqKDvGv3u1GxFKPuAkn8JCPPGDMf3vMMnbzm6Nh9zh1gcNsMvH3ZNLmP5fSG6DGbbi2tuwMWPthr4boWwCxf7ewSgNQeacyozhKDDQQ1qL5fQFUW52QKUZDZ5fw3KXNQJMcNTcaB723LchjeKun7MuGW5qyCBZYzA1KjofN1gYBV3NqyhQJ3Ns746GNuf9N2pQPmHz4xpnSrrfCvy6TVVz5d4PdrjeshsWQwpZsZGzvbdAdN8MKV5QsBDY");
 }
+
+static void set_script(btc_utils::tx_out_t& out, const std::string& hex)
+{
+    std::vector<unsigned char> script = btc_utils::from_hex(hex);
+    out.scriptPubKey.assign(script.begin(), script.end());
+}
+
+TEST_CASE("tx_out_addresses")
+{
+    btc_utils::tx_out_t out;
+
+    // genesis coinbase P2PK
+    set_script(out, "4104678afdb0fe5548271967f1a67130b7105cd6a828e03909a67962e0ea1f61deb649f6bc3f4cef38c4f35504e51ec112de5c384df7ba0b8d578a4c702b6bf11d5fac");
+    CHECK(out.addresses() == std::vector<std::string>{"1A1zP1eP5QGefi2DMPTfTL5SLmv7DivfNa"});
+
+    set_script(out, "76a91462e907b15cbf27d5425399ebf6f0fb50ebb88f1888ac");
+    CHECK(out.addresses() == std::vector<std::string>{"1A1zP1eP5QGefi2DMPTfTL5SLmv7DivfNa"});
+
+    set_script(out, "a914748284390f9e263a4b766a75d0633c50426eb87587");
+    CHECK(out.addresses() == std::vector<std::string>{"3CK4fEwbMP7heJarmU4eqA3sMbVJyEnU3V"});
+
+    set_script(out, "0014751e76e8199196d454941c45d1b3a323f1433bd6");
+    CHECK(out.addresses() == std::vector<std::string>{"bc1qw508d6qejxtdg4y5r3zarvary0c5xw7kv8f3t4"});
+
+    set_script(out, "00201863143c14c5166804bd19203356da136c985678cd4d27a1b8c6329604903262");
+    CHECK(out.addresses() == std::vector<std::string>{"bc1qrp33g0q5c5txsp9arysrx4k6zdkfs4nce4xj0gdcccefvpysxf3qccfmv3"});
+
+    set_script(out, "6a0b68656c6c6f20776f726c64");
+    CHECK(out.addresses().empty());
+
+    set_script(out, "0015751e76e8199196d454941c45d1b3a323f1433bd6ff");
+    CHECK(out.addresses().empty());
+}
+
+struct destination_counter_t
+{
+    int pubkeys = 0;
+    int others = 0;
+    void operator()(const btc_utils::pub_key_t&) { pubkeys++; }
+    template<typename D>
+    void operator()(const D&) { others++; }
+};
+
+TEST_CASE("script_for_each_destination")
+{
+    destination_counter_t counter;
+
+    CHECK(btc_utils::for_each_destination(btc_utils::from_hex("2102b4632d08485ff1df2db55b9dafd23347d1c47a457072a1e87be26896549a8737ac"), counter) == btc_utils::TX_PUBKEY);
+    CHECK(btc_utils::for_each_destination(btc_utils::from_hex("2104b4632d08485ff1df2db55b9dafd23347d1c47a457072a1e87be26896549a8737ac"), counter) == btc_utils::TX_NONSTANDARD);
+    CHECK(btc_utils::for_each_destination(btc_utils::from_hex("5128751e76e8199196d454941c45d1b3a323f1433bd6751e76e8199196d454941c45d1b3a323f1433bd6"), counter) == btc_utils::TX_WITNESS_UNKNOWN);
+    CHECK(btc_utils::for_each_destination(btc_utils::from_hex("6a"), counter) == btc_utils::TX_NULL_DATA);
+    CHECK(counter.pubkeys == 1);
+    CHECK(counter.others == 1);
+}
+
+TEST_CASE("script_multisig")
+{
+    using namespace btc_utils;
+    // 1-of-2 with an uncompressed and a compressed key
+    const std::string k1 = "0479be667ef9dcbbac55a06295ce870b07029bfcdb2dce28d959f2815b16f81798483ada7726a3c4655da4fbfc0e1108a8fd17b448a68554199c47d08ffb10d4b8";
+    const std::string k2 = "02b4632d08485ff1df2db55b9dafd23347d1c47a457072a1e87be26896549a8737";
+    std::vector<unsigned char> script = from_hex("5141" + k1 + "21" + k2 + "52ae");
+    unsigned int required, count;
+    byte_span_t keys[MAX_MULTISIG_KEYS];
+    REQUIRE(match_multisig(script, required, keys, count));
+    CHECK(required == 1);
+    CHECK(count == 2);
+    CHECK(to_hex(keys[0]) == k1);
+    CHECK(to_hex(keys[1]) == k2);
+
+    tx_destination_t dest;
+    CHECK(solver(byte_span_t(script), dest) == TX_MULTISIG);
+    CHECK(std::holds_alternative<no_destination_t>(dest));
+    std::vector<std::vector<unsigned char>> solutions;
+    CHECK(solver(script, solutions) == TX_MULTISIG);
+    REQUIRE(solutions.size() == 4);
+    CHECK(solutions[0] == std::vector<unsigned char>{1});
+    CHECK(to_hex(solutions[2]) == k2);
+    CHECK(solutions[3] == std::vector<unsigned char>{2});
+    destination_counter_t counter;
+    CHECK(for_each_destination(script, counter) == TX_MULTISIG);
+    CHECK(counter.pubkeys == 2);
+
+    // the batch hashes are the ids of the keys, the P2PKH address of each participant
+    uint160_t hashes[2];
+    hash160_batch(keys, count, hashes);
+    CHECK(encode_destination(pk_hash_tx_destination_t(hashes[0])) == "1EHNa6Q4Jz2uvNExL497mE43ikXhwF6kZm");
+    CHECK(hashes[1] == pub_key_t(keys[1].begin(), keys[1].end()).get_id());
+
+    // m above n, n not matching the keys, a key of the wrong size, no OP_CHECKMULTISIG
+    CHECK(!match_multisig(from_hex("5321" + k2 + "21" + k2 + "52ae"), required, keys, count));
+    CHECK(!match_multisig(from_hex("5121" + k2 + "21" + k2 + "53ae"), required, keys, count));
+    CHECK(!match_multisig(from_hex("5121" + k2 + "20" + k2.substr(0, 64) + "52ae"), required, keys, count));
+    CHECK(!match_multisig(from_hex("5121" + k2 + "51ac"), required, keys, count));
+    CHECK(solver(from_hex("5121" + k2 + "51ac"), dest) == TX_NONSTANDARD);
+}
+
+TEST_CASE("coinbase_height")
+{
+    using namespace btc_utils;
+    uint64_t height = 0;
+    // block 840000: 3 byte push, then the extra nonce and the pool tag
+    CHECK(decode_coinbase_height(from_hex("0340d10c192f5669614254432f4d696e6564206279"), height));
+    CHECK(height == 840000);
+    // regtest heights 1-16 are OP_1..OP_16, 128 needs a sign byte
+    CHECK(decode_coinbase_height(from_hex("5a00"), height));
+    CHECK(height == 10);
+    CHECK(decode_coinbase_height(from_hex("028000"), height));
+    CHECK(height == 128);
+    // negative, truncated, too long and empty
+    CHECK(!decode_coinbase_height(from_hex("0180"), height));
+    CHECK(!decode_coinbase_height(from_hex("0340d1"), height));
+    CHECK(!decode_coinbase_height(from_hex("09000000000000000000"), height));
+    CHECK(!decode_coinbase_height(byte_span_t(), height));
+}
+
+TEST_CASE("null_data_patterns")
+{
+    using namespace btc_utils;
+    auto text = [](const char* str) {
+        return std::vector<unsigned char>(str, str + strlen(str));
+    };
+    multi_pattern_matcher_t matcher;
+    CHECK(matcher.match_prefix(text("omni")) == multi_pattern_matcher_t::NO_MATCH);
+    matcher.build({{text("he"), 0}, {text("she"), 1}, {text("his"), 2}, {text("hers"), 3}});
+
+    // anchored: the longest pattern the text starts with
+    CHECK(matcher.match_prefix(text("hersh")) == 3);
+    CHECK(matcher.match_prefix(text("her")) == 0);
+    CHECK(matcher.match_prefix(text("ushers")) == multi_pattern_matcher_t::NO_MATCH);
+    multi_pattern_matcher_t::prefix_state_t st;
+    matcher.match_prefix(st, text("h"));
+    matcher.match_prefix(st, text("er"));
+    matcher.match_prefix(st, text("sx"));
+    CHECK(st.match == 3);
+    CHECK(st.failed);
+
+    // anywhere: "she" and "he" end at the same byte of "ushers", then "hers"
+    CHECK(matcher.find_first(text("ushers")) == 1);
+    CHECK(matcher.find_first(text("xyz")) == multi_pattern_matcher_t::NO_MATCH);
+    std::vector<std::pair<uint32_t, size_t>> found;
+    matcher.find_all(text("ushers"), [&](uint32_t id, size_t end) { found.emplace_back(id, end); });
+    CHECK(found == std::vector<std::pair<uint32_t, size_t>>{{1, 4}, {0, 4}, {3, 6}});
+
+    // many patterns, the automaton grows with their total length only
+    std::vector<multi_pattern_matcher_t::pattern_t> patterns;
+    for (uint32_t i = 0; i < 2000; i++)
+        patterns.push_back({text(("/pool" + std::to_string(i) + "/").c_str()), i});
+    matcher.build(patterns);
+    CHECK(matcher.state_count() < 12000);
+    CHECK(matcher.find_first(text("\x03\x41\x42\x43mined by /pool1234/")) == 1234);
+    CHECK_THROWS(matcher.build({{{}, 0}}));
+
+    // OP_RETURN OP_13 <omni...> OP_PUSHDATA1 <76 bytes>: every push is an element
+    std::vector<unsigned char> script = from_hex("6a5d046f6d6e694c4c" + std::string(152, 'a'));
+    std::vector<std::string> elements;
+    size_t pos = 1;
+    byte_span_t element;
+    while (next_null_data_element(script, pos, element))
+        elements.push_back(to_hex(element));
+    CHECK(pos == script.size());
+    CHECK(elements == std::vector<std::string>{"5d", "6f6d6e69", std::string(152, 'a')});
+
+    // a truncated push or another opcode stops short of the end
+    script = from_hex("6a05aabb");
+    pos = 1;
+    CHECK(!next_null_data_element(script, pos, element));
+    CHECK(pos == 1);
+    script = from_hex("6a01aaac");
+    pos = 1;
+    CHECK(next_null_data_element(script, pos, element));
+    CHECK(!next_null_data_element(script, pos, element));
+    CHECK(pos == 3);
+}
+
+TEST_CASE("inscription_envelope")
+{
+    using namespace btc_utils;
+    auto text = [](const byte_span_t& data) {
+        return std::string(data.begin(), data.end());
+    };
+    // <key> OP_CHECKSIG OP_FALSE OP_IF "ord" 01 "text/plain" OP_0 "hello" " world" OP_ENDIF
+    std::string key(64, '1');
+    std::vector<unsigned char> item = from_hex(key + "ac0063036f726401010a746578742f706c61696e"
+                                               "000568656c6c6f0620776f726c6468");
+    size_t pos = 0;
+    inscription_envelope_t envelope;
+    CHECK(next_inscription_envelope(item, pos, envelope));
+    CHECK(text(envelope.content_type) == "text/plain");
+    CHECK(envelope.body_size == 11);
+    CHECK(pos == item.size());
+    CHECK(!next_inscription_envelope(item, pos, envelope));
+
+    // an envelope cut short before one with an OP_1 tag, an unknown tag and no body
+    item = from_hex("0063036f7264010101" "0063036f726451046a736f6e010202aabb68");
+    pos = 0;
+    CHECK(next_inscription_envelope(item, pos, envelope));
+    CHECK(text(envelope.content_type) == "json");
+    CHECK(envelope.body_size == 0);
+    CHECK(!next_inscription_envelope(item, pos, envelope));
+
+    // no content type, the body pushed with OP_PUSHDATA1 and OP_1
+    item = from_hex("0063036f7264004c03aabbcc5168");
+    pos = 0;
+    CHECK(next_inscription_envelope(item, pos, envelope));
+    CHECK(envelope.content_type.empty());
+    CHECK(envelope.body_size == 4);
+
+    // the items are read in place from a span
+    std::vector<unsigned char> scratch;
+    span_reader_t reader(item);
+    byte_span_t span = reader.read_span(3, scratch);
+    CHECK(span.data() == item.data());
+    CHECK(scratch.empty());
+    CHECK_THROWS(reader.read_span(item.size(), scratch));
+}
+
+TEST_CASE("script_solver_destination")
+{
+    btc_utils::tx_destination_t dest;
+
+    std::vector<unsigned char> script = btc_utils::from_hex("76a91462e907b15cbf27d5425399ebf6f0fb50ebb88f1888ac");
+    CHECK(btc_utils::solver(script, dest) == btc_utils::TX_PUBKEYHASH);
+    REQUIRE(std::holds_alternative<btc_utils::pk_hash_tx_destination_t>(dest));
+    CHECK(btc_utils::encode_destination(std::get<btc_utils::pk_hash_tx_destination_t>(dest)) == "1A1zP1eP5QGefi2DMPTfTL5SLmv7DivfNa");
+
+    script = btc_utils::from_hex("5128751e76e8199196d454941c45d1b3a323f1433bd6751e76e8199196d454941c45d1b3a323f1433bd6");
+    CHECK(btc_utils::solver(script, dest) == btc_utils::TX_WITNESS_UNKNOWN);
+    REQUIRE(std::holds_alternative<btc_utils::witness_unknown_tx_destination_t>(dest));
+    CHECK(std::get<btc_utils::witness_unknown_tx_destination_t>(dest).version_ == 1);
+    CHECK(std::get<btc_utils::witness_unknown_tx_destination_t>(dest).length_ == 40);
+
+    script = btc_utils::from_hex("6a0b68656c6c6f20776f726c64");
+    CHECK(btc_utils::solver(script, dest) == btc_utils::TX_NULL_DATA);
+    CHECK(std::holds_alternative<btc_utils::no_destination_t>(dest));
+
+    // both solver APIs agree on the script type
+    std::vector<std::vector<unsigned char>> solutions;
+    for (const char* hex : {"4104678afdb0fe5548271967f1a67130b7105cd6a828e03909a67962e0ea1f61deb649f6bc3f4cef38c4f35504e51ec112de5c384df7ba0b8d578a4c702b6bf11d5fac",
+                            "a914748284390f9e263a4b766a75d0633c50426eb87587",
+                            "0014751e76e8199196d454941c45d1b3a323f1433bd6",
+                            "00201863143c14c5166804bd19203356da136c985678cd4d27a1b8c6329604903262",
+                            "0015751e76e8199196d454941c45d1b3a323f1433bd6ff",
+                            ""}) {
+        script = btc_utils::from_hex(hex);
+        CHECK(btc_utils::solver(script, dest) == btc_utils::solver(script, solutions));
+    }
+}
+
+TEST_CASE("script_spending_input")
+{
+    using namespace btc_utils;
+    std::vector<unsigned char> pubkey = from_hex("0279be667ef9dcbbac55a06295ce870b07029bfcdb2dce28d959f2815b16f81798");
+    std::vector<unsigned char> sig(71, 0x11);
+    sig[0] = 0x30;
+    std::pmr::vector<std::pmr::vector<unsigned char>> no_witness;
+    byte_span_t data;
+
+    // P2PKH: <sig> <pubkey>
+    std::vector<unsigned char> script_sig;
+    script_sig.reserve(1 + sig.size() + 1 + pubkey.size());
+    script_sig.push_back(71);
+    script_sig.insert(script_sig.end(), sig.begin(), sig.end());
+    script_sig.push_back(33);
+    script_sig.insert(script_sig.end(), pubkey.begin(), pubkey.end());
+    CHECK(match_spending_input(script_sig, no_witness, data) == TX_PUBKEYHASH);
+    CHECK(to_hex(hash160(data)) == "751e76e8199196d454941c45d1b3a323f1433bd6");
+    // a P2PK spend is the signature alone
+    CHECK(match_spending_input(byte_span_t(script_sig.data(), 72), no_witness, data) == TX_NONSTANDARD);
+
+    // P2WPKH: witness <sig> <pubkey>
+    std::pmr::vector<std::pmr::vector<unsigned char>> witness;
+    witness.emplace_back(sig.begin(), sig.end());
+    witness.emplace_back(pubkey.begin(), pubkey.end());
+    CHECK(match_spending_input(byte_span_t(), witness, data) == TX_WITNESS_V0_KEYHASH);
+    CHECK(to_hex(hash160(data)) == "751e76e8199196d454941c45d1b3a323f1433bd6");
+
+    // P2SH-P2WPKH: the scriptSig pushes the witness program
+    std::vector<unsigned char> nested = from_hex("160014751e76e8199196d454941c45d1b3a323f1433bd6");
+    CHECK(match_spending_input(nested, witness, data) == TX_SCRIPTHASH);
+    CHECK(data.size() == 22);
+    uint160_t batch[2];
+    byte_span_t inputs[2] = {data, byte_span_t(pubkey)};
+    hash160_batch(inputs, 2, batch);
+    CHECK(batch[0] == hash160(data));
+    CHECK(to_hex(batch[1]) == "751e76e8199196d454941c45d1b3a323f1433bd6");
+
+    // uncompressed keys are not allowed in witnesses
+    witness[1].assign(65, 0x04);
+    CHECK(match_spending_input(byte_span_t(), witness, data) == TX_NONSTANDARD);
+}
+
+TEST_CASE("address_encode_per_network")
+{
+    using namespace btc_utils;
+    pk_hash_tx_destination_t pkh(to_hash160("62e907b15cbf27d5425399ebf6f0fb50ebb88f18"));
+    script_hash_tx_destination_t sh(to_hash160("748284390f9e263a4b766a75d0633c50426eb875"));
+    witness_v0_key_hash_tx_destination_t wpkh(to_hash160("751e76e8199196d454941c45d1b3a323f1433bd6"));
+
+    CHECK(encode_destination<chain_params<network_t::mainnet>>(pkh) == "1A1zP1eP5QGefi2DMPTfTL5SLmv7DivfNa");
+    CHECK(encode_destination<chain_params<network_t::testnet>>(pkh) == "mpXwg4jMtRhuSpVq4xS3HFHmCmWp9NyGKt");
+    CHECK(encode_destination<chain_params<network_t::testnet>>(sh) == "2N3sGiyscxqd3r6DQSbgXT738ZwhUpBqkej");
+    CHECK(encode_destination<chain_params<network_t::mainnet>>(wpkh) == "bc1qw508d6qejxtdg4y5r3zarvary0c5xw7kv8f3t4");
+    CHECK(encode_destination<chain_params<network_t::testnet>>(wpkh) == "tb1qw508d6qejxtdg4y5r3zarvary0c5xw7kxpjzsx");
+    CHECK(encode_destination<chain_params<network_t::signet>>(wpkh) == "tb1qw508d6qejxtdg4y5r3zarvary0c5xw7kxpjzsx");
+    CHECK(encode_destination<chain_params<network_t::regtest>>(wpkh) == "bcrt1qw508d6qejxtdg4y5r3zarvary0c5xw7kygt080");
+}
+
+TEST_CASE("address_taproot")
+{
+    using namespace btc_utils;
+    typedef chain_params<network_t::mainnet> main_t;
+    typedef chain_params<network_t::testnet> test_t;
+    // BIP 350 test vectors: witness v1+ programs are encoded with bech32m
+    tx_destination_t dest;
+    CHECK(solver(from_hex("512079be667ef9dcbbac55a06295ce870b07029bfcdb2dce28d959f2815b16f81798"), dest) == TX_WITNESS_V1_TAPROOT);
+    REQUIRE(std::holds_alternative<witness_v1_taproot_tx_destination_t>(dest));
+    CHECK(encode_destination<main_t>(std::get<witness_v1_taproot_tx_destination_t>(dest)) ==
+          "bc1p0xlxvlhemja6c4dqv22uapctqupfhlxm9h8z3k2e72q4k9hcz7vqzk5jj0");
+    CHECK(solver(from_hex("5120000000c4a5cad46221b2a187905e5266362b99d5e91c6ce24d165dab93e86433"), dest) == TX_WITNESS_V1_TAPROOT);
+    CHECK(std::visit([](const auto& d) { return encode_destination<test_t>(d); }, dest) ==
+          "tb1pqqqqp399et2xygdj5xreqhjjvcmzhxw4aywxecjdzew6hylgvsesf3hn0c");
+    CHECK(solver(from_hex("5128751e76e8199196d454941c45d1b3a323f1433bd6751e76e8199196d454941c45d1b3a323f1433bd6"), dest) == TX_WITNESS_UNKNOWN);
+    CHECK(std::visit([](const auto& d) { return encode_destination<main_t>(d); }, dest) ==
+          "bc1pw508d6qejxtdg4y5r3zarvary0c5xw7kw508d6qejxtdg4y5r3zarvary0c5xw7kt5nd6y");
+    CHECK(solver(from_hex("6002751e"), dest) == TX_WITNESS_UNKNOWN);
+    CHECK(std::visit([](const auto& d) { return encode_destination<main_t>(d); }, dest) == "bc1sw50qgdz25j");
+    CHECK(std::string(get_txn_output_type(TX_WITNESS_V1_TAPROOT)) == "witness_v1_taproot");
+
+    dest = decode_destination<main_t>("bc1p0xlxvlhemja6c4dqv22uapctqupfhlxm9h8z3k2e72q4k9hcz7vqzk5jj0");
+    REQUIRE(std::holds_alternative<witness_v1_taproot_tx_destination_t>(dest));
+    CHECK(to_hex(std::get<witness_v1_taproot_tx_destination_t>(dest).data_) ==
+          "79be667ef9dcbbac55a06295ce870b07029bfcdb2dce28d959f2815b16f81798");
+    // a taproot output of the old bech32 encoding is invalid
+    CHECK(std::holds_alternative<no_destination_t>(decode_destination<main_t>("bc1p0xlxvlhemja6c4dqv22uapctqupfhlxm9h8z3k2e72q4k9hcz7vqh2y7hd")));
+
+    CHECK(bech32::Decode("bc1p0xlxvlhemja6c4dqv22uapctqupfhlxm9h8z3k2e72q4k9hcz7vqzk5jj0").encoding == bech32::Encoding::BECH32M);
+    CHECK(bech32::Decode("bc1qw508d6qejxtdg4y5r3zarvary0c5xw7kv8f3t4").encoding == bech32::Encoding::BECH32);
+    CHECK(bech32::Decode("bc1qw508d6qejxtdg4y5r3zarvary0c5xw7kv8f3t5").encoding == bech32::Encoding::INVALID);
+}
+
+TEST_CASE("address_decode")
+{
+    using namespace btc_utils;
+    typedef chain_params<network_t::mainnet> main_t;
+    typedef chain_params<network_t::testnet> test_t;
+    const char* addresses[] = {
+        "1A1zP1eP5QGefi2DMPTfTL5SLmv7DivfNa",
+        "3CMNFxN1oHBc4R1EpboAL5yzHGgE611Xou",
+        "bc1qw508d6qejxtdg4y5r3zarvary0c5xw7kv8f3t4",
+        "bc1qrp33g0q5c5txsp9arysrx4k6zdkfs4nce4xj0gdcccefvpysxf3qccfmv3",
+    };
+    for (const char* addr: addresses) {
+        tx_destination_t dest = decode_destination<main_t>(addr);
+        CHECK(!std::holds_alternative<no_destination_t>(dest));
+        CHECK(std::visit([](const auto& d) { return encode_destination<main_t>(d); }, dest) == addr);
+    }
+    CHECK(std::holds_alternative<pk_hash_tx_destination_t>(decode_destination<main_t>(addresses[0])));
+    CHECK(std::holds_alternative<script_hash_tx_destination_t>(decode_destination<main_t>(addresses[1])));
+    // wrong network, broken checksum, garbage
+    CHECK(std::holds_alternative<no_destination_t>(decode_destination<test_t>(addresses[0])));
+    CHECK(std::holds_alternative<no_destination_t>(decode_destination<test_t>(addresses[2])));
+    CHECK(std::holds_alternative<no_destination_t>(decode_destination<main_t>("1A1zP1eP5QGefi2DMPTfTL5SLmv7DivfNb")));
+    CHECK(std::holds_alternative<no_destination_t>(decode_destination<main_t>("bc1qw508d6qejxtdg4y5r3zarvary0c5xw7kv8f3t5")));
+    CHECK(std::holds_alternative<no_destination_t>(decode_destination<main_t>("0OIl")));
+
+    CHECK(uint256_to_hex(uint256_from_hex("000000000019d6689c085ae165831e934ff763ae46a2a6c172b3f1b60a8ce26f")) ==
+          "000000000019d6689c085ae165831e934ff763ae46a2a6c172b3f1b60a8ce26f");
+}
+
+TEST_CASE("address_decode_keys")
+{
+    using namespace btc_utils;
+    typedef chain_params<network_t::mainnet> main_t;
+    // BIP 350: bech32 for witness v0, bech32m for later versions
+    destination_key_t key;
+    REQUIRE(decode_destination_key<main_t>("bc1p0xlxvlhemja6c4dqv22uapctqupfhlxm9h8z3k2e72q4k9hcz7vqzk5jj0", key));
+    CHECK(key.kind_ == destination_key_t::WITNESS_UNKNOWN);
+    CHECK(key.length_ == 32);
+    CHECK(to_hex(byte_span_t(key.data_.data(), 32)) == "79be667ef9dcbbac55a06295ce870b07029bfcdb2dce28d959f2815b16f81798");
+    REQUIRE(decode_destination_key<main_t>("BC1SW50QGDZ25J", key));
+    CHECK(key.kind_ == destination_key_t::WITNESS_UNKNOWN + 15);
+    CHECK(key.length_ == 2);
+    CHECK(decode_destination_key<main_t>("BC1QW508D6QEJXTDG4Y5R3ZARVARY0C5XW7KV8F3T4", key));
+    CHECK(!decode_destination_key<main_t>("bc1p0xlxvlhemja6c4dqv22uapctqupfhlxm9h8z3k2e72q4k9hcz7vqh2y7hd", key));
+    CHECK(!decode_destination_key<main_t>("bc1qw508d6qejxtdg4y5r3zarvary0c5xw7kemeawh", key));
+    // base58check: non-canonical leading '1's and a slice of a longer string
+    CHECK(!decode_destination_key<main_t>("11A1zP1eP5QGefi2DMPTfTL5SLmv7DivfNa", key));
+    std::string line = "1A1zP1eP5QGefi2DMPTfTL5SLmv7DivfNa extra";
+    CHECK(decode_destination_key<main_t>(std::string_view(line).substr(0, 34), key));
+    CHECK(key.kind_ == destination_key_t::PUBKEYHASH);
+    CHECK(to_hex(byte_span_t(key.data_.data(), 20)) == "62e907b15cbf27d5425399ebf6f0fb50ebb88f18");
+
+    // the batch decoder agrees with the single one on every thread count
+    std::vector<std::string> strs;
+    for (int i = 0; i < 10000; i++) {
+        uint160_t hash;
+        for (size_t j = 0; j < hash.size(); j++)
+            hash[j] = static_cast<unsigned char>(i * 31 + static_cast<int>(j));
+        strs.push_back(i % 2 ? encode_destination<main_t>(pk_hash_tx_destination_t(hash))
+                             : encode_destination<main_t>(witness_v0_key_hash_tx_destination_t(hash)));
+        if (i % 7 == 0)
+            strs.back().back() = strs.back().back() == 'a' ? 'b' : 'a';
+    }
+    std::vector<std::string_view> views(strs.begin(), strs.end());
+    for (unsigned int threads: {1u, 3u}) {
+        std::vector<destination_key_t> keys;
+        std::vector<unsigned char> valid;
+        size_t found = decode_destination_keys<main_t>(views, keys, valid, threads);
+        CHECK(found == 10000 - 1429);
+        bool same = true;
+        for (size_t i = 0; i < views.size(); i++) {
+            destination_key_t single;
+            bool ok = decode_destination_key<main_t>(views[i], single);
+            same = same && ok == (valid[i] != 0) && (!ok || single == keys[i]);
+        }
+        CHECK(same);
+    }
+}
+
+TEST_CASE("watchlist")
+{
+    using namespace btc_utils;
+    typedef chain_params<network_t::mainnet> main_t;
+    std::vector<destination_key_t> keys;
+    for (const char* addr: {"1A1zP1eP5QGefi2DMPTfTL5SLmv7DivfNa", "bc1qw508d6qejxtdg4y5r3zarvary0c5xw7kv8f3t4"}) {
+        destination_key_t key;
+        REQUIRE(make_destination_key(decode_destination<main_t>(addr), key));
+        keys.push_back(key);
+    }
+    watchlist_t watch;
+    watch.build(keys);
+    CHECK(watch.size() == 2);
+    CHECK(watch.contains(keys[0]));
+    CHECK(watch.contains(keys[1]));
+
+    // the same hash as P2SH or as a P2PK with another key does not match
+    destination_key_t key;
+    REQUIRE(make_destination_key(script_hash_tx_destination_t(to_hash160("62e907b15cbf27d5425399ebf6f0fb50ebb88f18")), key));
+    CHECK(!watch.contains(key));
+    std::vector<unsigned char> pubkey = from_hex("0279be667ef9dcbbac55a06295ce870b07029bfcdb2dce28d959f2815b16f81798");
+    REQUIRE(make_destination_key(pub_key_t(pubkey.begin(), pubkey.end()), key));
+    CHECK(!watch.contains(key));
+    CHECK(!make_destination_key(no_destination_t(), key));
+
+    // a P2PK output matches the P2PKH address of its key
+    destination_key_t p2pkh;
+    REQUIRE(make_destination_key(pk_hash_tx_destination_t(pub_key_t(pubkey.begin(), pubkey.end())), p2pkh));
+    CHECK(key == p2pkh);
+}
+
+TEST_CASE("watchlist_fuse_filter")
+{
+    using namespace btc_utils;
+    std::vector<uint64_t> keys;
+    uint64_t x = 1;
+    for (int i = 0; i < 20000; i++) {
+        x = x * 6364136223846793005ull + 1442695040888963407ull;
+        keys.push_back(x);
+    }
+    binary_fuse_filter_t filter;
+    filter.build(keys);
+    bool all = true;
+    for (uint64_t k: keys)
+        all = all && filter.contains(k);
+    CHECK(all);
+    int false_positives = 0;
+    for (int i = 0; i < 100000; i++) {
+        x = x * 6364136223846793005ull + 1442695040888963407ull;
+        false_positives += filter.contains(x) ? 1 : 0;
+    }
+    CHECK(false_positives < 1000);
+
+    // a saved watchlist maps back with the same contents
+    std::vector<destination_key_t> dests(1000);
+    for (size_t i = 0; i < dests.size(); i++) {
+        dests[i].kind_ = destination_key_t::WITNESS_V0_KEYHASH;
+        dests[i].length_ = 20;
+        memcpy(dests[i].data_.data(), &keys[i], sizeof(uint64_t));
+    }
+    watchlist_t built;
+    built.build(dests);
+    temp_file_t file("watchlist_test.bin");
+    const std::string& path = file.path;
+    built.save(path);
+    watchlist_t loaded;
+    loaded.load(path);
+    CHECK(loaded.size() == dests.size());
+    all = true;
+    for (const auto& d: dests)
+        all = all && loaded.contains(d);
+    CHECK(all);
+    destination_key_t other = dests[0];
+    other.kind_ = destination_key_t::PUBKEYHASH;
+    CHECK(!loaded.contains(other));
+
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << "not a watchlist";
+    CHECK_THROWS_AS(loaded.load(path), std::runtime_error);
+}
+
+TEST_CASE("clock_cache")
+{
+    using namespace btc_utils;
+    struct hasher_t
+    {
+        // few distinct hashes, so probe runs overlap and get shifted on eviction
+        uint64_t operator()(int key) const { return static_cast<uint64_t>(key % 5); }
+    };
+    clock_cache_t<int, int, hasher_t> cache(4);
+    int computed = 0;
+    auto square = [&computed](int key) { computed++; return key * key; };
+    for (int key: {1, 2, 3, 4})
+        CHECK(cache.get(key, square) == key * key);
+    CHECK(cache.get(1, square) == 1);
+    CHECK(cache.get(2, square) == 4);
+    CHECK(computed == 4);
+    // 3 is the first entry the hand finds without a second chance
+    CHECK(cache.get(5, square) == 25);
+    CHECK(cache.size() == 4);
+    CHECK(cache.get(1, square) == 1);
+    CHECK(cache.get(2, square) == 4);
+    CHECK(computed == 5);
+    CHECK(cache.get(3, square) == 9);
+    CHECK(computed == 6);
+    CHECK(cache.hits() == 4);
+    CHECK(cache.misses() == 6);
+
+    // values stay right under eviction pressure
+    uint64_t x = 7;
+    bool right = true;
+    for (int i = 0; i < 20000; i++) {
+        x = x * 6364136223846793005ull + 1442695040888963407ull;
+        int key = static_cast<int>((x >> 33) % 11);
+        right = right && cache.get(key, square) == key * key;
+    }
+    CHECK(right);
+    CHECK(cache.size() == 4);
+    for (int i = 0; i < 20000; i++) {
+        x = x * 6364136223846793005ull + 1442695040888963407ull;
+        int key = static_cast<int>((x >> 33) % 11);
+        const int* value = cache.find(key);
+        if (value)
+            right = right && *value == key * key;
+        else
+            cache.insert(key, key * key);
+    }
+    CHECK(right);
+    cache.insert(10, -1);
+    cache.insert(10, -2);
+    REQUIRE(cache.find(10) != nullptr);
+    CHECK(*cache.find(10) == -2);
+    CHECK(cache.size() == 4);
+
+    // the key id cache gives the same ids as computing them
+    uint64_t hits, misses;
+    get_pub_key_cache_stats(hits, misses);
+    std::vector<unsigned char> data = from_hex("0279be667ef9dcbbac55a06295ce870b07029bfcdb2dce28d959f2815b16f81798");
+    bool same = true;
+    for (int i = 0; i < 10000; i++) {
+        data[5] = static_cast<unsigned char>(i % 300);
+        data[6] = static_cast<unsigned char>(i % 7);
+        pub_key_t key(data.begin(), data.end());
+        same = same && key.get_id() == key.compute_id();
+    }
+    CHECK(same);
+    uint64_t hits_after, misses_after;
+    get_pub_key_cache_stats(hits_after, misses_after);
+    CHECK(hits_after + misses_after - hits - misses == 10000);
+    CHECK(hits_after - hits >= 10000 - 2100);
+}
+
+TEST_CASE("block_arena")
+{
+    btc_utils::block_arena_t arena(1024);
+    {
+        btc_utils::block_t block(&arena);
+        block.txes_.resize(3);
+        block.txes_[1].vout.resize(2);
+        set_script(block.txes_[1].vout[1], "76a91462e907b15cbf27d5425399ebf6f0fb50ebb88f1888ac");
+        block.txes_[2].vin.resize(1);
+        block.txes_[2].vin[0].scriptWitness.resize(2);
+        block.txes_[2].vin[0].scriptWitness[1].resize(4000);
+
+        // nested containers take memory from the arena of the block
+        CHECK(block.txes_[1].vout[1].scriptPubKey.get_allocator().resource() == &arena);
+        CHECK(block.txes_[2].vin[0].scriptWitness[1].get_allocator().resource() == &arena);
+        CHECK(block.txes_[1].vout[1].addresses() == std::vector<std::string>{"1A1zP1eP5QGefi2DMPTfTL5SLmv7DivfNa"});
+    }
+    size_t capacity = arena.capacity();
+    CHECK(capacity >= 4000);
+
+    // chunks are reused after reset
+    arena.reset();
+    {
+        btc_utils::block_t block(&arena);
+        block.txes_.resize(3);
+        block.txes_[0].vin.resize(1);
+        block.txes_[0].vin[0].scriptSig.resize(3000);
+    }
+    CHECK(arena.capacity() == capacity);
+
+    void* p = arena.allocate(10, 64);
+    CHECK(reinterpret_cast<uintptr_t>(p) % 64 == 0);
+}
+
+TEST_CASE("serialize_roundtrip")
+{
+    // segwit transaction 2-of-2 P2WSH spend with a P2PKH change, as in BIP143 examples
+    std::vector<unsigned char> raw = btc_utils::from_hex(
+        "01000000000102fff7f7881a8099afa6940d42d1e7f6362bec38171ea3edf433541db4e4ad969f00000000494830450221008b9d1dc26ba6a9cb62127b02742fa9d754cd3bebf337f7a55d114c8e5cdd30be022040529b194ba3f9281a99f2b1c0a19c0489bc22ede944ccf4ecbab4cc618ef3ed01eeffffffef51e1b804cc89d182d279655c3aa89e815b1b309fe287d9b2b55d57b90ec68a0100000000ffffffff02202cb206000000001976a9148280b37df378db99f66f85c95a783a76ac7a6d5988ac9093510d000000001976a9143bde42dbee7e4dbe6a21b2d50ce2f0167faa815988ac000247304402203609e17b84f6a7d30c80bfa610b5b4542f32a8a0d5447a12fb1366d7f01cc44a0220573a954c4518331561406f90300e8f3358f51928d43c212a8caed02de67eebee0121025476c2e83188368da1ff3e292e7acafcdb3566bb0ad253f62fc70f07aeee635711000000");
+    btc_utils::transaction_t tx;
+    btc_utils::span_reader_t reader(raw);
+    reader >> tx;
+    CHECK(reader.eof());
+    CHECK(tx.vin.size() == 2);
+    CHECK(tx.vout.size() == 2);
+    CHECK(tx.has_witness());
+    CHECK(tx.vin[0].scriptWitness.empty());
+    CHECK(tx.vin[1].scriptWitness.size() == 2);
+    CHECK(tx.nLockTime == 0x11);
+
+    std::vector<unsigned char> out;
+    btc_utils::vector_writer_t writer(out);
+    writer << tx;
+    CHECK(out == raw);
+
+    // deserializing a legacy transaction into the same object drops the witnesses
+    std::vector<unsigned char> legacy;
+    btc_utils::vector_writer_t legacy_writer(legacy);
+    tx.serialize(legacy_writer, false);
+    btc_utils::span_reader_t legacy_reader(legacy);
+    legacy_reader >> tx;
+    CHECK(!tx.has_witness());
+    CHECK(tx.vin.size() == 2);
+
+    // counts that can't fit in the bytes left throw before anything is allocated
+    btc_utils::block_t block;
+    std::vector<unsigned char> bogus(80, 0);
+    btc_utils::vector_writer_t bogus_writer(bogus);
+    bogus_writer.write_compact_int(btc_utils::MAX_SIZE);
+    bogus.resize(bogus.size() + 20, 0);
+    btc_utils::span_reader_t bogus_reader(bogus);
+    CHECK_THROWS_AS(bogus_reader >> block, std::ios_base::failure);
+    CHECK(block.txes_.capacity() == 0);
+    std::vector<unsigned char> bogus_vin = btc_utils::from_hex("01000000fe0000100000");
+    btc_utils::span_reader_t vin_reader(bogus_vin);
+    CHECK_THROWS_AS(vin_reader >> tx, std::ios_base::failure);
+}
+
+TEST_CASE("block_index_scan")
+{
+    using namespace btc_utils;
+    typedef chain_params<network_t::mainnet> params_t;
+    std::string genesis = "0100000000000000000000000000000000000000000000000000000000000000000000003ba3edfd7a7b12b2"
+                          "7ac72c3e67768f617fc81bc3888a51323a9fb8aa4b1e5e4a29ab5f49ffff001d1dac2b7c";
+    // garbage with a stray magic byte, a record with a 5 byte body, a record too small
+    // to hold a header, one running past the end and zero padding
+    std::vector<unsigned char> data = from_hex("00f9be" "f9beb4d955000000" + genesis + "0101020304" +
+                                               "f9beb4d928000000" + std::string(80, '0') +
+                                               "f9beb4d9ff000000" + genesis + std::string(64, '0'));
+    std::vector<block_location_t> blocks;
+    uint64_t skipped = scan_block_headers(data, params_t::message_start, 3, blocks);
+    REQUIRE(blocks.size() == 1);
+    CHECK(uint256_to_hex(blocks[0].hash) == "000000000019d6689c085ae165831e934ff763ae46a2a6c172b3f1b60a8ce26f");
+    CHECK(blocks[0].prev == uint256_t());
+    CHECK(blocks[0].time == 1231006505);
+    CHECK(blocks[0].bits == 0x1d00ffff);
+    CHECK(blocks[0].file == 3);
+    CHECK(blocks[0].offset == 11);
+    CHECK(blocks[0].size == 85);
+    CHECK(blocks[0].tx_count == 1);
+    CHECK(skipped == data.size() - 8 - 85);
+
+    // other networks' records are not seen
+    blocks.clear();
+    CHECK(scan_block_headers(data, chain_params<network_t::testnet>::message_start, 0, blocks) == data.size());
+    CHECK(blocks.empty());
+}
+
+TEST_CASE("block_index")
+{
+    using namespace btc_utils;
+    auto location = [](unsigned char id, unsigned char prev, uint32_t file, uint64_t offset, uint32_t size) {
+        block_location_t b;
+        memset(&b, 0, sizeof(b));
+        b.hash[0] = id;
+        b.prev[0] = prev;
+        b.file = file;
+        b.offset = offset;
+        b.size = size;
+        b.tx_count = id;
+        b.bits = 0x207fffff;  // regtest, a work of 2 per block
+        return b;
+    };
+    // 1 <- 2 <- 3 <- 5 with a stale 4 on 2, a duplicate of 2, blocks out of order
+    // across files and 7 whose parent is missing
+    std::vector<block_location_t> blocks = {
+        location(1, 0, 0, 8, 100), location(3, 2, 1, 900, 300), location(2, 1, 0, 116, 100),
+        location(4, 2, 0, 224, 100), location(2, 1, 1, 116, 100), location(7, 6, 1, 224, 100),
+        location(5, 3, 1, 332, 500)};
+    std::vector<blk_file_state_t> files = {{1000, 1}, {2000, 2}};
+    block_index_t index;
+    index.build(blocks, files);
+    REQUIRE(index.size() == 4);
+    CHECK(index.stale_count() == 2);
+    CHECK(index.changed_files(files).empty());
+    std::vector<unsigned char> chain;
+    for (size_t h = 0; h < index.size(); h++) {
+        CHECK(index[h].height == h);
+        chain.push_back(index[h].hash[0]);
+    }
+    CHECK(chain == std::vector<unsigned char>{1, 2, 3, 5});
+    // the first record of a duplicate
+    CHECK(index[1].file == 0);
+    CHECK(index[1].offset == 116);
+    CHECK(index[3].tx_count == 5);
+
+    // the chain of the most work wins over a longer one: 1 <- 2 <- 3 <- 5 has a
+    // work of 8, 1 <- 20 at the minimum mainnet difficulty 2 + 0x100010001
+    {
+        std::vector<block_location_t> forked = blocks;
+        forked.push_back(location(20, 1, 1, 1000, 100));
+        forked.back().bits = 0x1d00ffff;
+        block_index_t most_work;
+        most_work.build(forked, files);
+        REQUIRE(most_work.size() == 2);
+        CHECK(most_work[1].hash[0] == 20);
+        // of two chains of the same work the one whose tip comes first in file order wins:
+        // 8 on 4 in file 0 over 5 in file 1
+        forked.pop_back();
+        forked.push_back(location(8, 4, 0, 500, 100));
+        most_work.build(forked, files);
+        REQUIRE(most_work.size() == 4);
+        CHECK(most_work[2].hash[0] == 4);
+        CHECK(most_work[3].hash[0] == 8);
+    }
+
+    // in reading order 3 comes after 5, parts of about the same size: 100+100+500 | 300
+    std::vector<const block_index_entry_t*> order = index.locate(0, 4);
+    std::vector<unsigned char> read;
+    for (const block_index_entry_t* b: order)
+        read.push_back(b->hash[0]);
+    CHECK(read == std::vector<unsigned char>{1, 2, 5, 3});
+    CHECK(split_by_size(order, 2, 0) == 0);
+    CHECK(split_by_size(order, 2, 1) == 3);
+    CHECK(split_by_size(order, 2, 2) == 4);
+    CHECK(split_by_size(index.locate(1, 3), 4, 2) == 2);
+
+    temp_file_t file("block_index_test.bin");
+    const std::string& path = file.path;
+    index.save(path);
+    block_index_t loaded;
+    loaded.load(path);
+    CHECK(loaded.size() == 4);
+    CHECK(loaded.file_count() == 2);
+    CHECK(loaded.stale_count() == 2);
+    CHECK(memcmp(&loaded[0], &index[0], 4 * sizeof(block_index_entry_t)) == 0);
+
+    // file 1 got 6 on the stale 4 of file 0, and 8 and 9 on it: only file 1 is
+    // scanned again, the chain reorganizes onto 4 and 7 links to 6
+    files[1] = {2000, 3};
+    CHECK(loaded.changed_files(files) == std::vector<uint32_t>{1});
+    std::vector<block_location_t> rescanned = {
+        location(3, 2, 1, 900, 300), location(2, 1, 1, 116, 100), location(7, 6, 1, 224, 100),
+        location(5, 3, 1, 332, 500), location(6, 4, 1, 1208, 100), location(8, 6, 1, 1316, 100),
+        location(9, 8, 1, 1424, 100)};
+    loaded.update(rescanned, files);
+    chain.clear();
+    for (size_t h = 0; h < loaded.size(); h++)
+        chain.push_back(loaded[h].hash[0]);
+    CHECK(chain == std::vector<unsigned char>{1, 2, 4, 6, 8, 9});
+    CHECK(loaded.stale_count() == 3);
+
+    // the records of a file that is gone are dropped
+    files.pop_back();
+    CHECK(loaded.changed_files(files).empty());
+    loaded.update(std::vector<block_location_t>(), files);
+    CHECK(loaded.size() == 3);
+    CHECK(loaded.file_count() == 1);
+
+    // truncated file
+    {
+        std::ofstream f(path, std::ios::binary | std::ios::app);
+        f << 'x';
+    }
+    CHECK_THROWS(loaded.load(path));
+}
@@ -0,0 +1,297 @@
+// Copyright (c) 2020 gladcow
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <watchlist.h>
+#include <chainparams.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+
+namespace btc_utils
+{
+
+uint64_t destination_key_t::hash() const
+{
+   uint64_t h = (static_cast<uint64_t>(kind_) << 8 | length_) * 0xff51afd7ed558ccdull;
+   for (size_t pos = 0; pos < length_; pos += 8)
+   {
+      uint64_t word = 0;
+      memcpy(&word, data_.data() + pos, std::min<size_t>(8, length_ - pos));
+      h = (h ^ word) * 0x9e3779b97f4a7c15ull;
+      h ^= h >> 29;
+   }
+   return h;
+}
+
+namespace {
+
+struct key_builder_t
+{
+   destination_key_t& key_;
+
+   template<size_t N>
+   bool set(unsigned char kind, const std::array<unsigned char, N>& data)
+   {
+      key_.kind_ = kind;
+      key_.length_ = N;
+      std::copy(data.begin(), data.end(), key_.data_.begin());
+      std::fill(key_.data_.begin() + N, key_.data_.end(), 0);
+      return true;
+   }
+
+   bool operator()(const no_destination_t&) { return false; }
+   bool operator()(const pub_key_t& dest) { return set(destination_key_t::PUBKEYHASH, dest.get_id()); }
+   bool operator()(const pk_hash_tx_destination_t& dest) { return set(destination_key_t::PUBKEYHASH, dest.data_); }
+   bool operator()(const script_hash_tx_destination_t& dest) { return set(destination_key_t::SCRIPTHASH, dest.data_); }
+   bool operator()(const witness_v0_key_hash_tx_destination_t& dest) { return set(destination_key_t::WITNESS_V0_KEYHASH, dest.data_); }
+   bool operator()(const witness_v0_script_hash_tx_destination_t& dest) { return set(destination_key_t::WITNESS_V0_SCRIPTHASH, dest.data_); }
+   //! the key a v1 program had before taproot was told apart, so saved watch indexes stay valid
+   bool operator()(const witness_v1_taproot_tx_destination_t& dest) { return set(destination_key_t::WITNESS_UNKNOWN, dest.data_); }
+   bool operator()(const witness_unknown_tx_destination_t& dest)
+   {
+      if (dest.length_ > dest.program_.size())
+         return false;
+      set(static_cast<unsigned char>(destination_key_t::WITNESS_UNKNOWN + dest.version_ - 1), dest.program_);
+      key_.length_ = static_cast<unsigned char>(dest.length_);
+      std::fill(key_.data_.begin() + dest.length_, key_.data_.end(), 0);
+      return true;
+   }
+};
+
+}
+
+bool make_destination_key(const tx_destination_t& dest, destination_key_t& key)
+{
+   return std::visit(key_builder_t{key}, dest);
+}
+
+template<typename P>
+size_t decode_destination_keys(const std::vector<std::string_view>& addresses,
+                               std::vector<destination_key_t>& keys,
+                               std::vector<unsigned char>& valid,
+                               unsigned int threads)
+{
+   // below this many addresses per thread starting threads costs more than it saves
+   const size_t MIN_PER_THREAD = 4096;
+   size_t count = addresses.size();
+   keys.resize(count);
+   valid.assign(count, 0);
+   if (threads == 0)
+      threads = std::max(1u, std::thread::hardware_concurrency());
+   threads = static_cast<unsigned int>(std::min<size_t>(threads, std::max<size_t>(1, count / MIN_PER_THREAD)));
+
+   std::vector<size_t> found(threads, 0);
+   auto worker = [&](unsigned int t) {
+      size_t begin = count * t / threads;
+      size_t end = count * (t + 1) / threads;
+      size_t n = 0;
+      for (size_t i = begin; i < end; i++)
+      {
+         if (decode_destination_key<P>(addresses[i], keys[i]))
+         {
+            valid[i] = 1;
+            n++;
+         }
+      }
+      found[t] = n;
+   };
+   std::vector<std::thread> pool;
+   for (unsigned int t = 1; t < threads; t++)
+      pool.emplace_back(worker, t);
+   worker(0);
+   for (auto& th: pool)
+      th.join();
+   return std::accumulate(found.begin(), found.end(), size_t(0));
+}
+
+#define INSTANTIATE_DECODE_DESTINATION_KEYS(N) \
+   template size_t decode_destination_keys<chain_params<N>>(const std::vector<std::string_view>&, \
+      std::vector<destination_key_t>&, std::vector<unsigned char>&, unsigned int);
+
+INSTANTIATE_DECODE_DESTINATION_KEYS(network_t::mainnet)
+INSTANTIATE_DECODE_DESTINATION_KEYS(network_t::testnet)
+INSTANTIATE_DECODE_DESTINATION_KEYS(network_t::regtest)
+INSTANTIATE_DECODE_DESTINATION_KEYS(network_t::signet)
+
+#undef INSTANTIATE_DECODE_DESTINATION_KEYS
+
+namespace {
+
+const char WATCHLIST_MAGIC[8] = {'B', 'T', 'C', 'W', 'A', 'T', 'C', 'H'};
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+struct watchlist_header_t
+{
+   char magic[8];
+   uint32_t version;
+   uint32_t byte_order;
+   uint64_t key_count;
+   uint32_t directory_bits;
+   uint32_t key_size;
+   binary_fuse_filter_t::params_t filter;
+};
+
+//! section offsets of a saved watchlist, each section starts on a cache line
+struct watchlist_layout_t
+{
+   size_t fingerprints;
+   size_t hashes;
+   size_t keys;
+   size_t directory;
+   size_t end;
+
+   static size_t align(size_t pos) { return (pos + 63) & ~size_t(63); }
+
+   explicit watchlist_layout_t(const watchlist_header_t& header)
+   {
+      size_t count = static_cast<size_t>(header.key_count);
+      fingerprints = align(sizeof(watchlist_header_t));
+      hashes = align(fingerprints + header.filter.array_length);
+      keys = align(hashes + count * sizeof(uint64_t));
+      directory = align(keys + count * sizeof(destination_key_t));
+      end = directory + ((size_t(1) << header.directory_bits) + 1) * sizeof(uint32_t);
+   }
+};
+
+}
+
+watchlist_t::watchlist_t() :
+   hashes_(nullptr), keys_(nullptr), directory_(nullptr), size_(0), shift_(64)
+{
+}
+
+watchlist_t::~watchlist_t() = default;
+
+void watchlist_t::build(std::vector<destination_key_t> keys)
+{
+   std::vector<uint64_t> hashes(keys.size());
+   for (size_t i = 0; i < keys.size(); i++)
+      hashes[i] = keys[i].hash();
+   std::vector<size_t> order(keys.size());
+   std::iota(order.begin(), order.end(), 0);
+   std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      if (hashes[a] != hashes[b])
+         return hashes[a] < hashes[b];
+      return memcmp(&keys[a], &keys[b], sizeof(destination_key_t)) < 0;
+   });
+
+   hash_store_.clear();
+   key_store_.clear();
+   hash_store_.reserve(keys.size());
+   key_store_.reserve(keys.size());
+   for (size_t i: order)
+   {
+      if (!key_store_.empty() && hash_store_.back() == hashes[i] && key_store_.back() == keys[i])
+         continue;
+      hash_store_.push_back(hashes[i]);
+      key_store_.push_back(keys[i]);
+   }
+
+   // about one key per directory bucket
+   unsigned int bits = 1;
+   while (bits < 32 && (size_t(1) << bits) < key_store_.size())
+      bits++;
+   shift_ = 64 - bits;
+   directory_store_.assign((size_t(1) << bits) + 1, 0);
+   for (uint64_t h: hash_store_)
+      directory_store_[static_cast<size_t>(h >> shift_) + 1]++;
+   std::partial_sum(directory_store_.begin(), directory_store_.end(), directory_store_.begin());
+
+   // different keys may share a 64-bit hash, the filter needs distinct ones
+   std::vector<uint64_t> filter_keys(hash_store_);
+   filter_keys.erase(std::unique(filter_keys.begin(), filter_keys.end()), filter_keys.end());
+   filter_.build(filter_keys);
+
+   file_.reset();
+   hashes_ = hash_store_.data();
+   keys_ = key_store_.data();
+   directory_ = directory_store_.data();
+   size_ = key_store_.size();
+}
+
+void watchlist_t::save(const std::string& path) const
+{
+   if (!directory_)
+      throw std::runtime_error("Watchlist is not built");
+   watchlist_header_t header;
+   memset(&header, 0, sizeof(header));
+   memcpy(header.magic, WATCHLIST_MAGIC, sizeof(header.magic));
+   header.version = FILE_VERSION;
+   header.byte_order = BYTE_ORDER_MARK;
+   header.key_count = size_;
+   header.directory_bits = 64 - shift_;
+   header.key_size = sizeof(destination_key_t);
+   header.filter = filter_.params();
+   watchlist_layout_t layout(header);
+
+   std::vector<char> data(layout.end, 0);
+   memcpy(data.data(), &header, sizeof(header));
+   memcpy(data.data() + layout.fingerprints, filter_.fingerprints(), header.filter.array_length);
+   memcpy(data.data() + layout.hashes, hashes_, size_ * sizeof(uint64_t));
+   memcpy(data.data() + layout.keys, keys_, size_ * sizeof(destination_key_t));
+   memcpy(data.data() + layout.directory, directory_, layout.end - layout.directory);
+
+   std::string tmp = path + ".tmp";
+   {
+      std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+      f.write(data.data(), static_cast<std::streamsize>(data.size()));
+      if (!f)
+         throw std::runtime_error("Can't write " + tmp);
+   }
+   if (rename(tmp.c_str(), path.c_str()) != 0)
+      throw std::runtime_error("Can't rename " + tmp + " to " + path + ": " + strerror(errno));
+}
+
+void watchlist_t::load(const std::string& path)
+{
+   std::unique_ptr<mapped_file_t> file(new mapped_file_t(path));
+   watchlist_header_t header;
+   if (file->size() < sizeof(header))
+      throw std::runtime_error(path + " is not a watchlist file");
+   memcpy(&header, file->data(), sizeof(header));
+   if (memcmp(header.magic, WATCHLIST_MAGIC, sizeof(header.magic)) != 0)
+      throw std::runtime_error(path + " is not a watchlist file");
+   if (header.version != FILE_VERSION || header.byte_order != BYTE_ORDER_MARK ||
+       header.key_size != sizeof(destination_key_t))
+      throw std::runtime_error(path + ": unsupported watchlist version or byte order");
+
+   const binary_fuse_filter_t::params_t& fp = header.filter;
+   bool valid = header.directory_bits >= 1 && header.directory_bits <= 32 &&
+                header.key_count < (uint64_t(1) << 32) &&
+                fp.segment_length != 0 && (fp.segment_length & (fp.segment_length - 1)) == 0 &&
+                fp.segment_count != 0 &&
+                static_cast<uint64_t>(fp.array_length) == (static_cast<uint64_t>(fp.segment_count) + 2) * fp.segment_length;
+   watchlist_layout_t layout(header);
+   if (!valid || file->size() != layout.end)
+      throw std::runtime_error(path + ": corrupted watchlist file");
+
+   // the directory bounds every scan, check it before trusting the file
+   const uint32_t* directory = reinterpret_cast<const uint32_t*>(file->data() + layout.directory);
+   size_t buckets = size_t(1) << header.directory_bits;
+   for (size_t i = 0; i < buckets; i++)
+   {
+      if (directory[i] > directory[i + 1])
+         throw std::runtime_error(path + ": corrupted watchlist file");
+   }
+   if (directory[0] != 0 || directory[buckets] != header.key_count)
+      throw std::runtime_error(path + ": corrupted watchlist file");
+
+   filter_.attach(fp, file->data() + layout.fingerprints);
+   hashes_ = reinterpret_cast<const uint64_t*>(file->data() + layout.hashes);
+   keys_ = reinterpret_cast<const destination_key_t*>(file->data() + layout.keys);
+   directory_ = directory;
+   size_ = static_cast<size_t>(header.key_count);
+   shift_ = 64 - header.directory_bits;
+   file_ = std::move(file);
+   hash_store_.clear();
+   key_store_.clear();
+   directory_store_.clear();
+}
+
+}